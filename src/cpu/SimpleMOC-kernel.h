@@ -0,0 +1,64 @@
+#ifndef __SimpleMOC_kernel
+#define __SimpleMOC_kernel
+
+// Library interface of the attenuation kernel (libSimpleMOC-kernel.a).
+// A transport code creates a problem - the source data, fine fluxes and
+// exponential table of its source regions - then hands it batches of
+// tracks to attenuate, each track a run of segments the angular flux
+// flows through in order. Tracks of a batch are spread over the threads;
+// their tallies land in the fine flux by the chosen strategy.
+
+// Opaque handle of a problem
+typedef struct SimpleMOC_Problem SimpleMOC_Problem;
+
+// One segment of a track
+typedef struct{
+	int QSR_id; // 3D source region crossed
+	int FAI_id; // Fine axial interval of the region
+	float ds; // Length
+	float mu; // Cosine of the polar angle
+} SimpleMOC_Segment;
+
+// Tally Strategies
+#define SIMPLEMOC_TALLY_LOCKED 0 // Add every segment under its region's lock
+#define SIMPLEMOC_TALLY_CACHED 1 // Per-thread tally cache, written back
+#define SIMPLEMOC_TALLY_ORDERED 2 // Committed in track order (reproducible)
+
+// Problem Options
+typedef struct{
+	long source_2D_regions;
+	int coarse_axial_intervals;
+	int fine_axial_intervals;
+	int egroups;
+	int nthreads;
+	int tally; // SIMPLEMOC_TALLY_*
+	int tally_cache_lines; // Per thread, a power of two (cached tally)
+	long seed; // Of the source data (-1 = time based)
+} SimpleMOC_Options;
+
+// Fills in the options of the benchmark's default problem
+void simplemoc_default_options( SimpleMOC_Options * O );
+
+// Builds a problem. Returns NULL if the options are invalid, or the
+// problem is too large to address or allocate.
+SimpleMOC_Problem * simplemoc_create( const SimpleMOC_Options * O );
+
+void simplemoc_destroy( SimpleMOC_Problem * P );
+
+// Attenuates a batch of tracks. Track t is made of segments
+// [offsets[t], offsets[t+1]); its angular flux starts from, and is left
+// in, state_flux[t * egroups ...]. Returns 0, or -1 (nothing attenuated)
+// if a segment is outside the problem.
+int simplemoc_attenuate( SimpleMOC_Problem * P,
+		const SimpleMOC_Segment * segments, const long * offsets,
+		int n_tracks, float * state_flux );
+
+// Size of the problem
+int simplemoc_regions( SimpleMOC_Problem * P );
+int simplemoc_fine_axial_intervals( SimpleMOC_Problem * P );
+int simplemoc_egroups( SimpleMOC_Problem * P );
+
+// Fine flux of a source region, [fine axial interval][energy group]
+float * simplemoc_fine_flux( SimpleMOC_Problem * P, int QSR_id );
+
+#endif
@@ -9,9 +9,12 @@
 #include<stdbool.h>
 #include<limits.h>
 #include<assert.h>
+#include<errno.h>
 #include<pthread.h>
 #include<unistd.h>
 
+#include "SimpleMOC-kernel.h"
+
 #ifdef OPENMP
 #include<omp.h>
 #endif
@@ -20,6 +23,477 @@
 #include<papi.h>
 #endif
 
+#ifdef MPI
+#include<mpi.h>
+#endif
+
+#if defined INSTRUMENT && (defined __x86_64__ || defined __i386__)
+#include<x86intrin.h>
+#endif
+
+// Either threading backend (OpenMP or pthreads)
+#if defined OPENMP || defined PTHREADS
+#define MULTITHREADED
+#endif
+
+// Lock type of the threading backend
+#ifdef OPENMP
+typedef omp_lock_t Lock;
+#elif defined PTHREADS
+typedef struct{
+	int locked;
+} Lock;
+#else
+typedef int Lock;
+#endif
+
+#ifdef PERF
+// perf_event_open Counter Groups
+#define PERF_GROUP_FLOPS 0
+#define PERF_GROUP_BANDWIDTH 1
+#define PERF_GROUP_STALLS 2
+#define PERF_GROUP_BRANCH 3
+#define PERF_GROUP_TLB 4
+#define PERF_GROUP_OS 5
+#define N_PERF_GROUPS 6
+#define PERF_MAX_EVENTS 6
+
+// Counts of one event group, per thread and summed over the timed runs
+typedef struct{
+	int group;
+	int n_events;
+	int nthreads;
+	long long * counts; // [thread * PERF_MAX_EVENTS + event]
+	int opened[PERF_MAX_EVENTS]; // Events the machine could count
+	int multiplexed;
+	int intel;
+	int runs; // Timed runs the group was counted on
+	double time; // Wall time of those runs
+	double * run_counts; // [run * PERF_MAX_EVENTS + event], over threads
+	double last[PERF_MAX_EVENTS]; // Totals at the end of the last run
+} Perf_Counters;
+
+// Open counters of one thread
+typedef struct{
+	int fds[PERF_MAX_EVENTS];
+	int event[PERF_MAX_EVENTS];
+	int n;
+	int leader;
+} Perf_Thread;
+#endif
+
+#ifdef INSTRUMENT
+// Lock wait histogram bins (powers of two of timer ticks)
+#define LOCK_WAIT_BINS 32
+
+// Fine source regions listed as the hottest
+#define HOT_FSRS 10
+
+// Instrumentation Counters of one Thread, summed over the timed runs
+typedef struct{
+	long segments;
+	unsigned long long busy; // Ticks spent attenuating segments
+	unsigned long long region; // Ticks spent in the parallel region
+	unsigned long long region_start;
+	unsigned long long lock_wait; // Ticks waiting on contended locks
+	long contended;
+	long uncontended;
+	long wait_hist[LOCK_WAIT_BINS];
+} __attribute__((aligned(64))) Thread_Stats;
+
+typedef struct{
+	Thread_Stats * threads;
+	int nthreads;
+	long * fsr_contended; // Contended acquisitions per fine source region
+	unsigned long long * fsr_wait; // Ticks waited per fine source region
+	long n_fsr;
+	double tick_rate; // Timer ticks per second
+} Instrumentation;
+
+// Reads the time stamp counter (a nanosecond clock off x86)
+static inline unsigned long long read_ticks(void)
+{
+	#if defined __x86_64__ || defined __i386__
+	return __rdtsc();
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	#endif
+}
+#endif
+
+// Segments finished by one kernel thread, in its own cache line
+typedef struct{
+	long segments;
+} __attribute__((aligned(64))) Thread_Progress;
+
+// Random sequence and angular flux of a kernel thread, carried from one
+// block of a checkpointed run to the next
+typedef struct{
+	unsigned int seed;
+	int valid; // Set once a block has stored the state
+	float * state_flux;
+} __attribute__((aligned(64))) Thread_State;
+
+// Fixed size start of a checkpoint file, followed by the runtimes of the
+// finished runs, the thread seeds and angular fluxes, and the fine flux
+typedef struct{
+	char magic[8];
+	int version;
+	int regions;
+	int fine_axial_intervals;
+	int egroups;
+	int nthreads;
+	int repetitions;
+	long segments;
+	long chunk_size;
+	int repetition; // Run in progress
+	long done; // Segments of it done
+	double elapsed; // Time it has taken so far
+} Checkpoint_Header;
+
+// Checkpoint Writer - a snapshot buffer, and a pthread writing it out
+typedef struct{
+	char * fname;
+	double interval; // Seconds between checkpoints
+	int nthreads;
+	int egroups;
+	int repetitions;
+	long flux_count; // Elements of the fine flux
+	long block; // Segments swept between safe points
+	size_t bytes; // Size of a checkpoint
+	Checkpoint_Header header; // Snapshot buffer
+	double * runtimes;
+	unsigned int * seeds;
+	float * state_flux;
+	float * fine_flux;
+	double * results; // Runtimes of the timed runs
+	int repetition; // Run in progress
+	long segments_done; // Segments of it done
+	double run_start;
+	double resumed; // Time the resumed run took before the checkpoint
+	int restored_repetition; // -1 if not restarted
+	double last; // Time of the last checkpoint
+	int pending; // Snapshot waiting to be written
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	long snapshots;
+	long written;
+	long skipped;
+	long failed;
+	double copy_time; // Sweeps stopped copying snapshots
+	double write_time; // Writer busy
+} Checkpoint;
+
+// Live Progress Monitor - a pthread sampling the per-thread counters
+typedef struct{
+	Thread_Progress * threads;
+	int nthreads;
+	long total; // Segments over all timed runs
+	int egroups;
+	double interval; // Seconds between samples
+	FILE * fp; // Sample log (NULL = none)
+	double start;
+	double last_time;
+	long last_done;
+	double peak_rate;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+} Monitor;
+
+// Adds to a thread's own progress counter. Only the owner writes it, so a
+// relaxed load and store suffice - no read-modify-write in the hot loop.
+static inline void monitor_add( long * counter, long n )
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+			__ATOMIC_RELAXED);
+}
+
+// Ways of each set of the tally cache
+#define TALLY_CACHE_WAYS 4
+
+// Per-Thread Tally Cache - group vectors of recently tallied fine source
+// regions, written back to the shared fine flux on eviction
+typedef struct{
+	long * keys; // Fine source region of each line (-1 = empty)
+	unsigned long * used; // Last use of each line, for LRU replacement
+	float * flux; // [line][egroup]
+	int sets;
+	int ways;
+	int egroups;
+	unsigned long clock;
+	long hits; // Segments whose region was cached
+	long misses;
+	long writebacks; // Lines added to the shared flux (one lock each)
+	long updates; // Tallies of tiles into the cache
+} Tally_Cache;
+
+extern __thread Tally_Cache * tally_cache;
+
+// Per-Thread Tally Stage of the reproducible sum mode - the tallies of one
+// chunk of segments, in segment order, until it is the chunk's turn to
+// add them into the fine flux
+typedef struct{
+	long * keys; // Fine source region of each staged segment
+	float * flux; // [segment][egroup]
+	long n;
+	long capacity;
+	int egroups;
+} Tally_Stage;
+
+extern __thread Tally_Stage * tally_stage;
+
+// Bounded Ring Buffer of fixed size entries, between one producer and one
+// consumer. Lock free: the producer only moves the head and the consumer
+// only the tail, each publishing its entries with a release store.
+typedef struct{
+	char * data;
+	size_t entry_bytes;
+	unsigned long mask; // Capacity - 1 (a power of two)
+	unsigned long head __attribute__((aligned(64))); // Next entry to write
+	unsigned long tail __attribute__((aligned(64))); // Next entry to read
+} Ring;
+
+static inline unsigned long ring_count( Ring * R )
+{
+	return __atomic_load_n(&R->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&R->tail, __ATOMIC_ACQUIRE);
+}
+
+// Slot to fill next (NULL if the ring is full), published by ring_push
+static inline void * ring_slot( Ring * R )
+{
+	unsigned long head = __atomic_load_n(&R->head, __ATOMIC_RELAXED);
+	if( head - __atomic_load_n(&R->tail, __ATOMIC_ACQUIRE) > R->mask )
+		return NULL;
+	return R->data + (head & R->mask) * R->entry_bytes;
+}
+
+static inline void ring_push( Ring * R )
+{
+	__atomic_store_n(&R->head, __atomic_load_n(&R->head, __ATOMIC_RELAXED)
+			+ 1, __ATOMIC_RELEASE);
+}
+
+// i-th oldest entry (the caller has checked there are more than i)
+static inline void * ring_peek( Ring * R, unsigned long i )
+{
+	unsigned long tail = __atomic_load_n(&R->tail, __ATOMIC_RELAXED);
+	return R->data + ((tail + i) & R->mask) * R->entry_bytes;
+}
+
+static inline void ring_pop( Ring * R )
+{
+	__atomic_store_n(&R->tail, __atomic_load_n(&R->tail, __ATOMIC_RELAXED)
+			+ 1, __ATOMIC_RELEASE);
+}
+
+// Stages of the Pipelined Mode
+#define PIPE_GENERATE 0
+#define PIPE_ATTENUATE 1
+#define PIPE_TALLY 2
+#define PIPE_STAGES 3
+
+// Entries ahead of the one being processed whose data is prefetched
+#define PIPE_PREFETCH 4
+
+// Segment Descriptor, from the generate stage to the attenuate stage
+typedef struct{
+	int QSR_id;
+	int FAI_id;
+} Segment_Desc;
+
+// Per-Thread Pipeline of the pipelined mode (-Q) - generated segments and
+// computed tallies queue up in rings between the stages
+typedef struct{
+	Ring segments; // Segment_Desc entries
+	Ring tallies; // Fine source region (long), then the group tallies
+	char * pending; // Tally entry of the segment being attenuated
+	int egroups;
+	long time[PIPE_STAGES]; // Nanoseconds in each stage
+	long batches[PIPE_STAGES]; // Times each stage ran
+	long depth[2]; // Segment and tally entries found by their consumers
+	long backpressure; // Attenuate batches stopped by a full tally ring
+	long segments_done;
+} Pipeline;
+
+extern __thread Pipeline * pipeline;
+
+// Out-of-Core I/O Requests
+#define OOC_READ 0
+#define OOC_WRITE 1
+#define OOC_QUEUE 4
+
+typedef struct{
+	int type; // OOC_READ (whole window) or OOC_WRITE (fine fluxes)
+	int window;
+	int slot;
+	int counted; // Part of a timed run
+} OOC_Request;
+
+// Out-of-Core Sources - a backing file holding the source data, two
+// in-memory window slots and the I/O thread filling and draining them
+typedef struct{
+	char * fname;
+	int fd;
+	int regions;
+	int window_regions;
+	int n_windows;
+	long region_flux; // Fine source (or flux) elements per region
+	int egroups;
+	size_t flux_offset; // Start of the fine flux section of the file
+	size_t sigT_offset; // Start of the cross section section
+	size_t file_bytes;
+	float * fine_source[2];
+	float * fine_flux[2];
+	float * sigT[2];
+	OOC_Request queue[OOC_QUEUE];
+	long issued;
+	long completed;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	long windows; // Timed runs only, from here on
+	long bytes_read;
+	long bytes_written;
+	double io_time; // I/O thread busy
+	double stall_time; // Sweeps waiting for a window's read
+	double drain_time; // Sweeps waiting for the last write-back
+	double compute_time;
+} Out_Of_Core;
+
+// Counter-based random number (SplitMix64 finalizer) - the value depends
+// only on the seed, stream and counter, not on which thread draws it
+static inline unsigned long long counter_random( unsigned long long seed,
+		unsigned long long stream, unsigned long long counter )
+{
+	unsigned long long z = seed * 0xD1B54A32D192ED03ULL +
+		stream * 0x8CB92BA72F3D8DD7ULL + counter * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Pin-Cell Lattice of the ray tracing front end (-G). Each pin's fuel is
+// split into equal area rings, and every ring (and the moderator around
+// the fuel) into equal angle sectors, each a 2D source region.
+typedef struct{
+	int pins; // Pin cells per side
+	int rings;
+	int sectors;
+	double pitch; // cm
+	double width; // Of the whole lattice
+	double * ring_r2; // Squared outer radius of each ring
+	int regions_per_pin; // (rings + 1) * sectors, moderator last
+} Lattice;
+
+// 2D Track, from one side of the lattice to another
+typedef struct{
+	double x; // Start
+	double y;
+	double phi; // Azimuthal angle, in (0, pi)
+	double length;
+} Track;
+
+// Segment of a 2D track through one 2D source region
+typedef struct{
+	int region;
+	float length;
+} Segment_2D;
+
+// Ray Tracing Front End - tracks laid down cyclically over the lattice,
+// swept in every axial plane of the subdomain, or (with polar angles)
+// stacked axially into 3D tracks crossing the planes
+typedef struct{
+	Lattice L;
+	int n_azim; // Azimuthal angles over (0, 2 pi)
+	double spacing; // Requested track spacing (cm)
+	double mean_spacing; // After correcting the angles
+	Track * tracks;
+	int n_tracks;
+	int layers; // Axial layers of 2D regions in the subdomain
+	int planes; // Axial planes swept (layers x fine axial intervals)
+	int max_segments; // Of the longest track
+	long segments; // 2D segments over all tracks
+	double total_length;
+	int stored; // Attenuate stored segments in the timed runs (-Y)
+	Segment_2D * store; // All segments, NULL until stored
+	long * offsets; // Of each track's segments in the store
+	double store_time; // Tracing once into the store
+	double trace_time; // A sweep of tracing only
+	double otf_time; // A sweep, tracing on the fly
+	double stored_time; // A sweep from the store
+	int n_polar; // Polar angles over (0, pi) (0 = 2D planes)
+	double * polar_mu; // Cosine of each polar angle, upward then downward
+	double axial_spacing; // Requested 3D track spacing (cm)
+	double plane_height; // Of a fine axial interval (cm)
+	double height; // Of the subdomain
+	long tracks_3D; // 3D tracks over all 2D tracks and polar angles
+	long segments_3D;
+	double total_length_3D;
+	int max_segments_3D; // Bound on the segments of any 3D track
+	SimpleMOC_Segment * store_3D; // All 3D segments, NULL until stored
+	long * offsets_3D; // Of each 2D track's 3D segments in the store
+} Geometry;
+
+// Phases of a Run, in the order they happen
+#define PHASE_CLI 0
+#define PHASE_THREADS 1
+#define PHASE_ALLOCATION 2
+#define PHASE_LOCKS 3
+#define PHASE_FILL 4
+#define PHASE_TRACKS 5
+#define PHASE_TABLE 6
+#define PHASE_DOMAIN 7
+#define PHASE_PROBE 8
+#define PHASE_AUTOTUNE 9
+#define PHASE_WARMUP 10
+#define PHASE_KERNEL 11
+#define PHASE_REFERENCE 12
+#define PHASE_TRACKING 13
+#define PHASE_TEARDOWN 14
+#define N_PHASES 15
+
+// Wall Clock Time of each Phase
+typedef struct{
+	double start; // Start of the run
+	double end; // End of the last phase
+	double begin[N_PHASES];
+	double time[N_PHASES];
+	double * thread_setup; // Per-thread setup in the kernel, per thread
+	int nthreads;
+} Phases;
+
+// Baseline of a Regression Check - a results file written by "-o"
+typedef struct{
+	char * fname;
+	char * text; // Contents of the file
+	double * runtimes;
+	int repetitions;
+	long segments; // Segments attenuated per repetition
+	int egroups;
+} Baseline;
+
+// Scaling Study - lists of values to sweep over
+typedef struct{
+	long * threads;
+	long * egroups;
+	long * segments;
+	long * regions; // 2D source regions
+	int n_threads;
+	int n_egroups;
+	int n_segments;
+	int n_regions;
+} Scaling;
+
 // User inputs
 typedef struct{
 	int source_2D_regions;
@@ -30,8 +504,82 @@ typedef struct{
 	long segments;
 	int egroups;
 	int nthreads;
+	int tile_size; // Energy groups per cache block (-1 = auto from L1)
+	int scheduler; // SCHED_DYNAMIC or SCHED_STEAL
+	long chunk_size; // Segments per scheduling chunk (0 = autotune)
+	int warmup; // Nonzero while running untimed warmup sweeps
+	long steals; // Work stealing - ranges stolen during the last sweep
+	int affinity; // Thread placement policy (AFFINITY_*)
+	int * cpu_list; // Explicit CPU list (AFFINITY_LIST)
+	int n_cpu_list;
+	int * thread_cpus; // CPU each thread is pinned to (NULL if unpinned)
+	int rank; // Axial subdomain of this process
+	int nranks;
+	int sweeps; // Sweeps with boundary flux exchange (MPI)
+	int boundary_tracks; // Tracks crossing each axial face (MPI)
+	int warmup_runs; // Untimed runs before the timed repetitions
+	int repetitions; // Timed runs
+	char * results_file; // JSON/CSV results record (NULL = none)
+	Scaling * scaling; // Scaling study lists (NULL = single run)
+	int probe; // Measure the bandwidth and compute roofs (-B)
+	double peak_bandwidth; // Triad bandwidth in GB/s (0 = not measured)
+	double peak_gflops; // Compute roof in GFLOP/s
+	double monitor_interval; // Seconds between progress samples (0 = off)
+	char * monitor_file; // Progress sample log (NULL = none)
+	Monitor * monitor; // NULL while not monitoring
+	long seed; // Fixed random seed (-1 = seeded from the clock)
+	Baseline * baseline; // Results to check for a regression (NULL = none)
+	double threshold; // Slowdown (%) that fails the regression check
+	Phases * phases;
+	int tally_cache_lines; // Lines of each thread's tally cache (0 = off)
+	long tally_hits; // Tally cache counts, over the timed runs
+	long tally_misses;
+	long tally_writebacks;
+	long tally_updates;
+	int lattice_pins; // Pin cells per side of the lattice (0 = no tracks)
+	int lattice_rings; // Fuel rings per pin
+	int lattice_sectors; // Sectors per ring
+	int azimuthal_angles; // Over (0, 2 pi), a multiple of 4
+	double track_spacing; // cm
+	int store_segments; // Attenuate stored rather than traced segments
+	int polar_angles; // Over (0, pi), even (0 = sweep 2D tracks per plane)
+	double axial_spacing; // Of the 3D tracks stacked on a 2D track (cm)
+	Geometry * geometry; // NULL unless ray tracing (-G)
+	int pipeline_depth; // Ring entries of the pipelined mode (0 = off)
+	int pipeline_tally_depth; // Tally ring entries (segment depth if unset)
+	long pipe_time[PIPE_STAGES]; // Pipeline stats, summed over threads
+	long pipe_batches[PIPE_STAGES];
+	long pipe_depth[2];
+	long pipe_backpressure;
+	long pipe_segments;
+	int reproducible; // Ordered, thread count independent tallies (-D)
+	unsigned long long flux_checksum; // Of the fine flux after the runs
+	double locked_runtime; // Median runtime of the locked tally (-D)
+	char * backing_file; // Out-of-core source data file (NULL = in memory)
+	int window_regions; // Regions per out-of-core window (0 = 1/16th)
+	Out_Of_Core * ooc; // NULL unless out of core
+	char * checkpoint_file; // Checkpoints of the timed runs (NULL = none)
+	double checkpoint_interval; // Seconds between checkpoints
+	int restart; // Resume from the checkpoint file (-y)
+	Checkpoint * checkpoint; // NULL unless checkpointing
+	Thread_State * thread_state; // NULL unless checkpointing
+	#ifdef COMPACT
+	int lock_stripes; // Lock stripes of the compact layout (power of two)
+	#endif
 	size_t nbytes;
 
+	#ifdef INSTRUMENT
+	Instrumentation * stats; // NULL while not instrumenting
+	#endif
+
+	#ifdef PERF
+	int perf_groups[N_PERF_GROUPS]; // PERF_GROUP_* of each selected group
+	int n_perf_groups;
+	int perf_multiplex; // Count all groups at once, rather than in turns
+	int perf_active; // Group counted during this run (if taking turns)
+	Perf_Counters * perf; // One per selected group (NULL while not counting)
+	#endif
+
     #ifdef PAPI
 	int papi_event_set;
     // String for command line PAPI event
@@ -41,16 +589,79 @@ typedef struct{
     #endif
 } Input;
 
-// Source Region Structure
+#ifdef COMPACT
+// Lock Stripe, padded to its own cache line
+typedef struct{
+	Lock lock;
+} __attribute__((aligned(64))) Lock_Stripe;
+#endif
+
+// Source Region Structure. The compact layout (COMPACT) has a single
+// Source holding flat arrays over all regions, addressed by offsets, and
+// a fixed size table of lock stripes shared by the fine source regions.
 typedef struct{
 	float * fine_flux;
 	float * fine_source;
 	float * sigT;
-	#ifdef OPENMP
-	omp_lock_t * locks;
+	#ifdef COMPACT
+	int first_region; // Region at the start of the arrays (out of core)
+	#endif
+	#if defined MULTITHREADED && defined COMPACT
+	Lock_Stripe * stripes;
+	#elif defined MULTITHREADED
+	Lock * locks;
 	#endif
 } Source;
 
+// Fine sources of a region ([FAI][egroup])
+static inline float * region_fine_source( Input * I, Source * S, int QSR_id )
+{
+	#ifdef COMPACT
+	return S->fine_source + (long) (QSR_id - S->first_region) *
+		I->fine_axial_intervals * I->egroups;
+	#else
+	return S[QSR_id].fine_source;
+	#endif
+}
+
+// Fine fluxes of a region ([FAI][egroup])
+static inline float * region_fine_flux( Input * I, Source * S, int QSR_id )
+{
+	#ifdef COMPACT
+	return S->fine_flux + (long) (QSR_id - S->first_region) *
+		I->fine_axial_intervals * I->egroups;
+	#else
+	return S[QSR_id].fine_flux;
+	#endif
+}
+
+// Total cross sections of a region ([egroup])
+static inline float * region_sigT( Input * I, Source * S, int QSR_id )
+{
+	#ifdef COMPACT
+	return S->sigT + (long) (QSR_id - S->first_region) * I->egroups;
+	#else
+	return S[QSR_id].sigT;
+	#endif
+}
+
+#ifdef MULTITHREADED
+// Lock guarding a fine source region. Compact layouts hash the fine source
+// region index (Fibonacci hashing) onto a power of two number of stripes,
+// so neighboring regions land on different cache lines.
+static inline Lock * fsr_lock( Input * I, Source * S, int QSR_id, int FAI_id )
+{
+	#ifdef COMPACT
+	unsigned long long fsr = (unsigned long long) QSR_id *
+		I->fine_axial_intervals + FAI_id;
+	unsigned long long hash = fsr * 0x9E3779B97F4A7C15ULL;
+	return &S->stripes[(hash >> 32) & (I->lock_stripes - 1)].lock;
+	#else
+	return S[QSR_id].locks + FAI_id;
+	#endif
+}
+#endif
+
 // Table structure for computing exponential
 typedef struct{
 	float * values;
@@ -59,6 +670,165 @@ typedef struct{
 	int N;
 } Table;
 
+// Timed Repetitions of a Benchmark Run
+typedef struct{
+	int repetitions;
+	long segments; // Segments attenuated per repetition
+	int egroups;
+	double * runtimes;
+	double min;
+	double max;
+	double median;
+	double mean;
+	double stddev;
+} Results;
+
+// Compile Time Options
+typedef struct{
+	int table;
+	int compact;
+	int intel;
+	int papi;
+	int openmp;
+	int pthreads;
+	int mpi;
+	const char * compiler;
+} Build_Flags;
+
+// Host Description
+typedef struct{
+	char hostname[256];
+	char os[256];
+	char machine[65]; // As long as struct utsname's
+	char date[32];
+	int nprocs;
+	long L1_size;
+} Host_Info;
+
+// One Measurement of a Scaling Study
+typedef struct{
+	int weak;
+	long regions;
+	int egroups;
+	long base_segments; // Segments (strong) or segments per thread (weak)
+	long segments;
+	int nthreads;
+	double runtime;
+	double tpi;
+	double speedup;
+	double efficiency;
+} Scaling_Point;
+
+// Stage Microbenchmark Options
+typedef struct{
+	long * egroups; // Energy group counts to benchmark
+	int n_egroups;
+	int repetitions;
+	long work; // Energy groups attenuated per measurement
+	long dram_bytes; // DRAM working set (0 = 4x L3)
+	char * results_file;
+} Microbench;
+
+// Shared Arguments of the Roofline Probes
+typedef struct{
+	double * a;
+	double * b;
+	double * c;
+	long n; // Triad array length, or compute probe repetitions
+	int init;
+	float * checksum;
+} Probe_Args;
+
+// Floats updated per pass of the compute probe (fits in L1)
+#define PROBE_FMA_WIDTH 256
+
+// Segment Schedulers
+#define SCHED_DYNAMIC 0
+#define SCHED_STEAL 1
+
+// Thread Placement Policies
+#define AFFINITY_NONE 0
+#define AFFINITY_COMPACT 1
+#define AFFINITY_SCATTER 2
+#define AFFINITY_CORE 3
+#define AFFINITY_LIST 4
+
+// Sweeps with their own per-thread random sequences
+#define SWEEP_KERNEL 0
+#define SWEEP_BOUNDARY 1
+
+// Stages of the Attenuation Pipeline
+#define STAGE_SOURCE_FIT 0
+#define STAGE_CROSS_SECTIONS 1
+#define STAGE_EXPONENTIAL 2
+#define STAGE_FLUX_INTEGRAL 3
+#define STAGE_TALLY 4
+#define STAGE_OUTGOING_FLUX 5
+#define N_STAGES 6
+
+// Topology of a Logical CPU
+typedef struct{
+	int cpu;
+	int core;
+	int socket;
+	int smt; // Index among the SMT siblings of its core
+} CPU_Info;
+
+// Per-Thread Work Stealing Deque - a range of segments. The owner takes
+// chunks off the front, thieves split off the back half.
+typedef struct{
+	long begin;
+	long end;
+	long steals;
+	long steal_attempts;
+	Lock lock;
+} __attribute__((aligned(64))) Deque;
+
+// Segment Scheduler. Work stealing uses the deques, while the dynamic
+// scheduler hands out chunks from a shared counter (when not using OpenMP).
+typedef struct{
+	int type;
+	Deque * deques;
+	int nthreads;
+	long chunk;
+	long segments;
+	long next __attribute__((aligned(64)));
+} Scheduler;
+
+#ifdef MPI
+// Axial Subdomain - boundary angular fluxes exchanged with the ranks above
+// and below, and the compute/communication timings
+typedef struct{
+	int below; // -1 at the bottom of the stack
+	int above; // -1 at the top of the stack
+	int tracks;
+	float * send_up;
+	float * send_down;
+	float * recv_up;
+	float * recv_down;
+	double post_time;
+	double interior_time;
+	double wait_time;
+	double boundary_time;
+	long bytes_sent;
+} Domain;
+#endif
+
+// Shared Arguments of the Kernel Parallel Region
+typedef struct{
+	Input * I;
+	Source * S;
+	Table * table;
+	Scheduler * W;
+	long segments;
+	#ifdef MPI
+	Domain * D;
+	#endif
+	long committed; // Chunks whose tallies are in (reproducible mode)
+	int first_region; // Regions the segments cross
+	int regions;
+} Kernel_Args;
+
 // Local SIMD Vector Arrays
 typedef struct{
 	float * q0;
@@ -75,37 +845,366 @@ typedef struct{
 	float * t2;
 	float * t3;
 	float * t4;
+	float ds; // Length of the segment
+	float mu; // Polar angle terms of the source expansion
+	float mu2;
 } SIMD_Vectors;
 
+// Problem Behind a Library Handle
+struct SimpleMOC_Problem{
+	Input * I;
+	Source * S;
+	Table * table; // NULL unless built with TABLE
+	SIMD_Vectors * simd_vecs; // One per thread
+};
+
+// Shared Arguments of the Batch Parallel Region
+typedef struct{
+	SimpleMOC_Problem * P;
+	const SimpleMOC_Segment * segments;
+	const long * offsets;
+	int n_tracks;
+	float * state_flux;
+	long next; // Next track to take
+	long committed; // Tracks whose tallies are in (ordered tally)
+} Batch_Args;
+
 // kernel.c
+void default_segment_geometry( SIMD_Vectors * simd_vecs );
 void run_kernel( Input * I, Source * S, Table * table);
+void run_sweep( Input * I, Source * S, Table * table, long segments );
+void run_window( Input * I, Source * S, Table * table, long segments,
+		int first_region, int regions );
+void kernel_thread( void * args );
 void attenuate_segment( Input * restrict I, Source * restrict S,
 		int QSR_id, int FAI_id, float * restrict state_flux,
 		SIMD_Vectors * restrict simd_vecs, Table * restrict table); 
+void attenuate_tile( Input * restrict I, Source * restrict S,
+		int QSR_id, int FAI_id, int g0, int ng,
+		float * restrict state_flux, SIMD_Vectors * restrict simd_vecs,
+		Table * restrict table );
+void fit_source( Input * restrict I, Source * restrict S,
+		int QSR_id, int FAI_id, int g0, int ng,
+		SIMD_Vectors * restrict simd_vecs );
+void load_cross_sections( Input * restrict I, Source * restrict S,
+		int QSR_id, int g0, int ng, SIMD_Vectors * restrict simd_vecs );
+void exponential_expf( int ng, SIMD_Vectors * restrict simd_vecs );
+void exponential_table( int ng, SIMD_Vectors * restrict simd_vecs,
+		Table * restrict table );
+void compute_flux_integral( int ng, float * restrict state_flux,
+		SIMD_Vectors * restrict simd_vecs );
+void tally_flux( Input * restrict I, Source * restrict S,
+		int QSR_id, int FAI_id, int g0, int ng,
+		SIMD_Vectors * restrict simd_vecs );
+void compute_outgoing_flux( int ng, float * restrict state_flux,
+		SIMD_Vectors * restrict simd_vecs );
+double stage_flops( Input * I, int stage );
+double stage_bytes( Input * I, int stage );
 float interpolateTable( Table * table, float x);
 
 // init.c
 Source * aligned_initialize_sources( Input * I );
+int count_3D_regions( Input * I );
+size_t array_bytes( const char * name, long n1, long n2, long n3,
+		size_t size );
+void set_malloc_exits( int exits );
+void * checked_malloc( size_t bytes, const char * name );
 Source * initialize_sources( Input * I );
+void free_sources( Input * I, Source * S );
 Table * buildExponentialTable( float precision, float maxVal, Input * I );
+void free_table( Table * table );
 Input * set_default_input( void );
 SIMD_Vectors aligned_allocate_simd_vectors(Input * I);
 SIMD_Vectors allocate_simd_vectors(Input * I);
+void free_simd_vectors( SIMD_Vectors * A );
+unsigned int run_seed( Input * I );
+unsigned int thread_seed( Input * I, int thread, int sweep );
 double get_time(void);
-#ifdef OPENMP
-omp_lock_t * init_locks( Input * I );
+long detect_cache_size( int level );
+long detect_L1_size(void);
+int select_tile_size( Input * I );
+#ifdef MULTITHREADED
+Lock * init_locks( Input * I );
+#ifdef COMPACT
+Lock_Stripe * init_lock_stripes( Input * I );
+#endif
 #endif
+long per_region_metadata_bytes( Input * I );
+long source_metadata_bytes( Input * I );
 
 // io.c
 void logo(int version);
 void center_print(const char *s, int width);
 void border_print(void);
-void fancy_int( int a );
+void fancy_int( long a );
+long parse_long( const char * s );
+int parse_int( const char * s );
+double parse_double( const char * s );
+int parse_int_fields( const char * s, int * vals, int max );
 void print_input_summary(Input * input);
 void read_CLI( int argc, char * argv[], Input * input );
 void print_CLI_error(void);
 void read_input_file( Input * I, char * fname);
 
+// sched.c
+Scheduler * init_scheduler( int type, long segments, int nthreads,
+		long chunk );
+void free_scheduler( Scheduler * W );
+int pop_chunk( Scheduler * W, Deque * D, long * begin, long * end );
+int steal_range( Scheduler * W, Deque * victim, long * begin, long * end );
+int next_chunk( Scheduler * W, int thread, unsigned int * seed,
+		long * begin, long * end );
+int next_dynamic_chunk( Scheduler * W, long * begin, long * end );
+long total_steals( Scheduler * W );
+long autotune_chunk_size( Input * I, Source * S, Table * table );
+
+// threads.c
+void set_num_threads( int nthreads );
+void parallel_region( void (*fn)(void *), void * arg );
+int get_thread_num(void);
+int get_num_threads(void);
+int get_num_procs(void);
+void thread_barrier(void);
+void init_lock( Lock * L );
+void destroy_lock( Lock * L );
+void set_lock( Lock * L );
+int test_lock( Lock * L );
+void unset_lock( Lock * L );
+
+// affinity.c
+int read_topology_value( int cpu, const char * name );
+int read_cpu_topology( CPU_Info ** info );
+int compare_compact( const void * a, const void * b );
+int compare_scatter( const void * a, const void * b );
+int compare_core( const void * a, const void * b );
+int parse_cpu_list( const char * str, int ** list );
+void map_threads_to_cpus( Input * I );
+void pin_thread( Input * I, int thread );
+void print_thread_map( Input * I );
+
+// comm.c
+#ifdef MPI
+Domain * init_domain( Input * I );
+int post_exchange( Input * I, Domain * D, MPI_Request * requests );
+void boundary_thread( void * args );
+void run_decomposed( Input * I, Source * S, Table * table, Domain * D );
+void print_domain_summary( Input * I, Domain * D );
+#endif
+
+// bench.c
+Results * init_results( int repetitions, long segments, int egroups );
+int compare_doubles( const void * a, const void * b );
+void compute_statistics( Results * R );
+double time_per_intersection( Results * R, double runtime );
+void print_results( Results * R );
+void get_build_flags( Build_Flags * B );
+void get_host_info( Host_Info * H );
+void write_results_json( FILE * fp, Input * I, Results * R );
+void write_results_csv( FILE * fp, Input * I, Results * R );
+void write_results( Input * I, Results * R, const char * fname );
+
+// scaling.c
+int parse_range_list( const char * str, long ** list );
+double time_configuration( Input * I, Source * S, Table * table );
+void set_thread_count( Input * I, int nthreads );
+void run_scaling_study( Input * I, Table * table );
+void compute_efficiency( Scaling_Point * P, int n );
+void print_scaling_tables( Scaling_Point * P, int n );
+void write_scaling_results( Scaling_Point * P, int n, const char * fname );
+
+// roofline.c
+double flops_per_intersection( Input * I );
+double bytes_per_intersection( Input * I );
+void triad_thread( void * args );
+void fma_thread( void * args );
+double probe_bandwidth( Input * I );
+double probe_compute( Input * I );
+void print_roofline( Input * I, Results * R );
+
+// microbench.c
+Microbench read_microbench_CLI( int argc, char * argv[] );
+void print_microbench_CLI_error(void);
+long working_set_bytes( Input * I );
+Source * build_working_set( Input * I, long bytes );
+double time_stage( Input * I, Source * S, Table * table,
+		SIMD_Vectors * simd_vecs, float * state_flux, int stage,
+		long segments );
+double microbench_flops( Input * I, int stage );
+
+// api.c
+int problem_fits( Input * I );
+int simd_vectors_allocated( SIMD_Vectors * A );
+int check_batch( SimpleMOC_Problem * P, const SimpleMOC_Segment * segments,
+		const long * offsets, int n_tracks );
+void batch_thread( void * args );
+void attenuate_track( Input * I, Source * S, Table * table,
+		const SimpleMOC_Segment * segments, long begin, long end,
+		float * state_flux, SIMD_Vectors * simd_vecs );
+
+// instrument.c
+#ifdef INSTRUMENT
+double calibrate_ticks(void);
+Instrumentation * init_instrumentation( Input * I );
+void instrument_thread_begin( Input * I, int thread );
+void instrument_thread_end(void);
+void instrument_segment( unsigned long long start );
+#ifdef MULTITHREADED
+void instrumented_set_lock( Input * I, Lock * L, long fsr );
+#endif
+void print_instrumentation( Input * I );
+#endif
+
+// ooc.c
+Out_Of_Core * open_out_of_core( Input * I );
+void close_out_of_core( Out_Of_Core * O );
+void out_of_core_transfer( Out_Of_Core * O, int write, void * buf,
+		size_t bytes, off_t offset );
+void window_range( Out_Of_Core * O, int window, int * first, int * regions );
+void out_of_core_io( Out_Of_Core * O, OOC_Request * R );
+void * out_of_core_thread( void * arg );
+long out_of_core_request( Input * I, Out_Of_Core * O, int type, int window,
+		int slot );
+void out_of_core_wait( Out_Of_Core * O, long ticket );
+void map_window( Input * I, Source * S, Out_Of_Core * O, int slot,
+		int first, int regions );
+void fill_out_of_core( Input * I, Out_Of_Core * O, unsigned int * seed );
+void run_out_of_core_sweep( Input * I, Source * S, Table * table,
+		long segments );
+void print_out_of_core( Input * I );
+
+// reduce.c
+void tally_stage_begin( Input * I, long capacity );
+void tally_stage_add( Tally_Stage * T, long fsr, int g0, int ng,
+		float * tally );
+void tally_stage_commit( Input * I, Source * S, Tally_Stage * T,
+		long * committed, long ticket );
+void tally_stage_end( void );
+void attenuate_chunk( Input * I, Source * S, Table * table, long begin,
+		long end, float * state_flux, SIMD_Vectors * simd_vecs );
+unsigned long long flux_checksum( Input * I, Source * S );
+void print_reproducible( Input * I, Results * R );
+
+// geometry.c
+Geometry * init_geometry( Input * I );
+void lay_down_tracks( Geometry * G );
+int trace_cell( Lattice * L, int cx, int cy, Track * T, double t0,
+		double t1, Segment_2D * out );
+int trace_track( Geometry * G, Track * T, Segment_2D * out );
+void count_segments( Input * I, Geometry * G );
+void store_segments( Geometry * G );
+void run_geometry_sweep( Input * I, Source * S, Table * table );
+void run_tracks( Input * I, Source * S, Table * table, Scheduler * W,
+		int thread, unsigned int * seed, float * state_flux,
+		SIMD_Vectors * simd_vecs, long * progress );
+void trace_thread( void * args );
+double time_tracing( Input * I );
+void compare_tracking( Input * I, Source * S, Table * table );
+void print_tracking( Input * I );
+
+// axial.c
+void init_axial( Input * I, Geometry * G );
+int axial_stack( Geometry * G, Track * T, int polar, double * z0,
+		double * dz );
+int trace_axial( Input * I, Geometry * G, Segment_2D * segments, int n,
+		int polar, double z0, SimpleMOC_Segment * out );
+long trace_stacks( Input * I, Geometry * G, Track * T,
+		Segment_2D * segments, int n, SimpleMOC_Segment * out );
+void count_axial_segments( Input * I, Geometry * G );
+void store_axial_segments( Input * I, Geometry * G );
+long sweep_axial( Input * I, Source * S, Table * table, Track * T,
+		Segment_2D * segments, int n, SimpleMOC_Segment * buffer,
+		float * state_flux, SIMD_Vectors * simd_vecs );
+void print_axial( Input * I );
+
+// pipeline.c
+void ring_init( Ring * R, unsigned long capacity, size_t entry_bytes );
+void ring_free( Ring * R );
+void pipeline_begin( Input * I );
+void pipeline_end( Input * I );
+void prefetch_segment( Input * I, Source * S, Segment_Desc * D );
+void pipeline_add_tally( Pipeline * P, long fsr, int g0, int ng,
+		float * tally );
+void pipeline_apply_tally( Input * I, Source * S, long fsr, float * flux );
+void run_pipeline( Input * I, Source * S, Table * table, Scheduler * W,
+		int thread, unsigned int * seed, int first_region, int regions,
+		float * state_flux, SIMD_Vectors * simd_vecs, long * progress );
+void print_pipeline( Input * I );
+
+// tally_cache.c
+void tally_cache_begin( Input * I );
+void tally_cache_write_back( Input * I, Source * S, Tally_Cache * C,
+		int line );
+float * tally_cache_line( Input * I, Source * S, Tally_Cache * C,
+		int QSR_id, int FAI_id, int g0 );
+void tally_cache_end( Input * I, Source * S );
+void print_tally_cache( Input * I );
+
+// phases.c
+Phases * init_phases(void);
+void init_phase_threads( Input * I );
+void phase_begin( Input * I, int phase );
+void phase_end( Input * I, int phase );
+void phase_thread_setup( Input * I, int thread, double t );
+void thread_setup_stats( Phases * P, double * max, double * mean );
+void print_phases( Input * I );
+void write_phases_json( FILE * fp, Input * I );
+void write_phases_csv_header( FILE * fp );
+void write_phases_csv( FILE * fp, Input * I );
+
+// regress.c
+char * read_text_file( const char * fname );
+const char * json_find( const char * text, const char * key );
+double json_number( const char * text, const char * key, double fallback );
+void json_string( const char * text, const char * key, char * buf, int len );
+int json_array( const char * text, const char * key, double ** values );
+Baseline * load_baseline( Input * I, const char * fname );
+double beta_continued_fraction( double a, double b, double x );
+double incomplete_beta( double a, double b, double x );
+void sample_mean_var( double * x, int n, double * mean, double * var );
+double welch_test( double * a, int na, double * b, int nb );
+double print_comparison( const char * name, double * a, int na, double * b,
+		int nb );
+int check_regression( Input * I, Results * R );
+
+// checkpoint.c
+Checkpoint * init_checkpoint( Input * I );
+void finish_checkpoint( Checkpoint * K, int completed );
+Thread_State * thread_state( Input * I, int thread );
+void run_checkpointed( Input * I, Source * S, Table * table );
+void checkpoint_snapshot( Input * I, Source * S );
+void write_checkpoint( Checkpoint * K );
+void * checkpoint_thread( void * arg );
+int restore_checkpoint( Input * I, Source * S, Results * R );
+double checkpoint_resumed_time( Checkpoint * K );
+void print_checkpoint( Input * I );
+
+// monitor.c
+Monitor * start_monitor( Input * I, long segments );
+void stop_monitor( Monitor * M );
+long * monitor_counter( Input * I, int thread );
+void * monitor_thread( void * arg );
+void monitor_sample( Monitor * M );
+
+// perf.c
+#ifdef PERF
+int perf_group_from_name( const char * name );
+const char * perf_group_name( int group );
+const char * perf_event_name( int group, int event );
+int parse_perf_groups( const char * str, int * groups );
+Perf_Counters * perf_init( Input * I );
+int perf_group_active( Input * I, int i );
+void perf_add_run( Input * I, double runtime );
+void perf_open_group( Perf_Counters * P, Perf_Thread * T );
+void perf_close_group( Perf_Counters * P, Perf_Thread * T, int thread );
+void perf_start( Input * I, Perf_Thread * T );
+void perf_stop( Input * I, Perf_Thread * T, int thread );
+double perf_total( Perf_Counters * P, const char * name );
+double perf_find( Input * I, const char * name, Perf_Counters ** P );
+void print_perf_group( Perf_Counters * P );
+void print_perf_counters( Input * I, Results * R );
+void write_perf_json( FILE * fp, Input * I, Results * R );
+#endif
+
 // papi.c
 void papi_serial_init(void);
 void counter_init( int *eventset, int *num_papi_events, Input * I );
@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include "SimpleMOC-kernel_header.h"
+#include<sched.h>
+
+// Reads an integer from a sysfs topology file (-1 if it can't be read)
+int read_topology_value( int cpu, const char * name )
+{
+	char fname[128];
+	int val = -1;
+
+	sprintf(fname, "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	FILE * fp = fopen(fname, "r");
+	if( fp == NULL )
+		return -1;
+	if( fscanf(fp, "%d", &val) != 1 )
+		val = -1;
+	fclose(fp);
+
+	return val;
+}
+
+// Finds the core, socket and SMT sibling index of every CPU the process
+// is allowed to run on. Returns the number of CPUs found.
+int read_cpu_topology( CPU_Info ** info )
+{
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if( sched_getaffinity(0, sizeof(cpu_set_t), &mask) != 0 )
+	{
+		for( int c = 0; c < get_num_procs() && c < CPU_SETSIZE; c++ )
+			CPU_SET(c, &mask);
+	}
+
+	int n = CPU_COUNT(&mask);
+	CPU_Info * cpus = (CPU_Info *) malloc( n * sizeof(CPU_Info));
+
+	int idx = 0;
+	for( int c = 0; c < CPU_SETSIZE && idx < n; c++ )
+	{
+		if( !CPU_ISSET(c, &mask) )
+			continue;
+
+		cpus[idx].cpu = c;
+		cpus[idx].core = read_topology_value(c, "core_id");
+		cpus[idx].socket = read_topology_value(c, "physical_package_id");
+		if( cpus[idx].core < 0 )
+			cpus[idx].core = c;
+		if( cpus[idx].socket < 0 )
+			cpus[idx].socket = 0;
+
+		// SMT index = number of lower numbered CPUs on the same core
+		cpus[idx].smt = 0;
+		for( int j = 0; j < idx; j++ )
+			if( cpus[j].core == cpus[idx].core &&
+					cpus[j].socket == cpus[idx].socket )
+				cpus[idx].smt++;
+
+		idx++;
+	}
+
+	*info = cpus;
+	return idx;
+}
+
+// Compact - fill every SMT sibling of a core, then every core of a socket
+int compare_compact( const void * a, const void * b )
+{
+	const CPU_Info * x = (const CPU_Info *) a;
+	const CPU_Info * y = (const CPU_Info *) b;
+	if( x->socket != y->socket ) return x->socket - y->socket;
+	if( x->core != y->core ) return x->core - y->core;
+	return x->smt - y->smt;
+}
+
+// Scatter - alternate sockets, and only use SMT siblings once every core
+// has a thread
+int compare_scatter( const void * a, const void * b )
+{
+	const CPU_Info * x = (const CPU_Info *) a;
+	const CPU_Info * y = (const CPU_Info *) b;
+	if( x->smt != y->smt ) return x->smt - y->smt;
+	if( x->core != y->core ) return x->core - y->core;
+	return x->socket - y->socket;
+}
+
+// One per core - first SMT sibling of each core, socket by socket
+int compare_core( const void * a, const void * b )
+{
+	const CPU_Info * x = (const CPU_Info *) a;
+	const CPU_Info * y = (const CPU_Info *) b;
+	if( x->smt != y->smt ) return x->smt - y->smt;
+	if( x->socket != y->socket ) return x->socket - y->socket;
+	return x->core - y->core;
+}
+
+// Parses a CPU list such as "0,2,4-7". Returns the number of CPUs.
+int parse_cpu_list( const char * str, int ** list )
+{
+	long * vals;
+	int n = parse_range_list(str, &vals);
+	if( n == 0 )
+		return 0;
+
+	*list = (int *) malloc( n * sizeof(int));
+	for( int i = 0; i < n; i++ )
+		(*list)[i] = (int) vals[i];
+	free(vals);
+
+	return n;
+}
+
+// Decides which CPU every thread will be pinned to. Threads wrap around the
+// CPU ordering when there are more threads than CPUs.
+void map_threads_to_cpus( Input * I )
+{
+	I->thread_cpus = NULL;
+	if( I->affinity == AFFINITY_NONE )
+		return;
+
+	I->thread_cpus = (int *) malloc( I->nthreads * sizeof(int));
+
+	if( I->affinity == AFFINITY_LIST )
+	{
+		for( int t = 0; t < I->nthreads; t++ )
+			I->thread_cpus[t] = I->cpu_list[t % I->n_cpu_list];
+		return;
+	}
+
+	CPU_Info * cpus;
+	int n = read_cpu_topology(&cpus);
+
+	if( I->affinity == AFFINITY_COMPACT )
+		qsort(cpus, n, sizeof(CPU_Info), compare_compact);
+	else if( I->affinity == AFFINITY_SCATTER )
+		qsort(cpus, n, sizeof(CPU_Info), compare_scatter);
+	else
+	{
+		qsort(cpus, n, sizeof(CPU_Info), compare_core);
+
+		int cores = 0;
+		while( cores < n && cpus[cores].smt == 0 )
+			cores++;
+		if( I->nthreads > cores )
+			printf("Warning: %d threads but only %d cores - "
+					"placing extra threads on SMT siblings\n",
+					I->nthreads, cores);
+	}
+
+	for( int t = 0; t < I->nthreads; t++ )
+		I->thread_cpus[t] = cpus[t % n].cpu;
+
+	free(cpus);
+}
+
+// CPU the calling thread was last pinned to (or tried to be), -1 if none
+static __thread int pinned_cpu = -1;
+
+// Set once a pinning failure has been reported
+static int pin_failed = 0;
+
+// Pins the calling thread to its CPU. Called at the start of every parallel
+// region by every thread, but the threads persist between regions, so each
+// is only pinned again if its CPU changed. A failure is reported once.
+void pin_thread( Input * I, int thread )
+{
+	if( I->thread_cpus == NULL || pinned_cpu == I->thread_cpus[thread] )
+		return;
+
+	pinned_cpu = I->thread_cpus[thread];
+
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(pinned_cpu, &mask);
+
+	if( pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask) != 0
+			&& !__atomic_exchange_n(&pin_failed, 1, __ATOMIC_RELAXED) )
+	{
+		fprintf(stderr, "Unable to pin thread %d to CPU %d (further "
+				"failures not reported)\n", thread, pinned_cpu);
+	}
+}
+
+// Prints the thread -> CPU/core/socket map
+void print_thread_map( Input * I )
+{
+	if( I->thread_cpus == NULL )
+		return;
+
+	printf("%-10s%-10s%-10s%-10s\n", "  Thread", "CPU", "Core", "Socket");
+	for( int t = 0; t < I->nthreads; t++ )
+	{
+		int cpu = I->thread_cpus[t];
+		printf("  %-8d%-10d%-10d%-10d\n", t, cpu,
+				read_topology_value(cpu, "core_id"),
+				read_topology_value(cpu, "physical_package_id"));
+	}
+}
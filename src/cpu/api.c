@@ -0,0 +1,291 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Library interface (SimpleMOC-kernel.h). A problem wraps the Input, Source
+// and Table the benchmark builds, plus SIMD vectors for every thread, so a
+// batch costs no allocations beyond the tally strategy's per-thread state.
+// Tracks of a batch are handed out one at a time from a shared counter.
+// The ordered tally stages every track and commits them in track order,
+// exactly as the reproducible sum mode (-D) commits its chunks.
+
+void simplemoc_default_options( SimpleMOC_Options * O )
+{
+	Input * I = set_default_input();
+
+	O->source_2D_regions = I->source_2D_regions;
+	O->coarse_axial_intervals = I->coarse_axial_intervals;
+	O->fine_axial_intervals = I->fine_axial_intervals;
+	O->egroups = I->egroups;
+	O->nthreads = I->nthreads;
+	O->tally = SIMPLEMOC_TALLY_LOCKED;
+	O->tally_cache_lines = 64;
+	O->seed = I->seed;
+
+	free(I->phases);
+	free(I);
+}
+
+SimpleMOC_Problem * simplemoc_create( const SimpleMOC_Options * O )
+{
+	int lines = O->tally_cache_lines;
+	if( O->source_2D_regions < 1 || O->source_2D_regions > INT_MAX ||
+			O->coarse_axial_intervals < 1 ||
+			O->fine_axial_intervals < 2 || O->egroups < 1 ||
+			O->nthreads < 1 || O->tally < SIMPLEMOC_TALLY_LOCKED ||
+			O->tally > SIMPLEMOC_TALLY_ORDERED ||
+			(O->tally == SIMPLEMOC_TALLY_CACHED &&
+			 (lines < 1 || (lines & (lines - 1)) != 0)) )
+	{
+		fprintf(stderr, "Invalid SimpleMOC problem options\n");
+		return NULL;
+	}
+
+	Input * I = set_default_input();
+	I->source_2D_regions = O->source_2D_regions;
+	I->coarse_axial_intervals = O->coarse_axial_intervals;
+	I->fine_axial_intervals = O->fine_axial_intervals;
+	I->egroups = O->egroups;
+	I->nthreads = O->nthreads;
+	I->seed = O->seed;
+	if( O->tally == SIMPLEMOC_TALLY_CACHED )
+		I->tally_cache_lines = lines;
+	I->reproducible = O->tally == SIMPLEMOC_TALLY_ORDERED;
+
+	// A library must not exit, so a problem too big to address or to
+	// allocate comes back as NULL instead
+	if( !problem_fits(I) )
+	{
+		fprintf(stderr, "SimpleMOC problem is too large\n");
+		free(I->phases);
+		free(I);
+		return NULL;
+	}
+
+	I->source_3D_regions = count_3D_regions(I);
+	I->tile_size = select_tile_size(I);
+	set_num_threads(I->nthreads);
+
+	SimpleMOC_Problem * P = (SimpleMOC_Problem *) calloc( 1,
+			sizeof(SimpleMOC_Problem));
+	if( P == NULL )
+	{
+		free(I->phases);
+		free(I);
+		return NULL;
+	}
+	P->I = I;
+
+	set_malloc_exits(0);
+	P->S = initialize_sources(I);
+	set_malloc_exits(1);
+	if( P->S == NULL )
+	{
+		free(I->phases);
+		free(I);
+		free(P);
+		return NULL;
+	}
+
+	P->table = NULL;
+	#ifdef TABLE
+	P->table = buildExponentialTable( 0.01, 10.0, I );
+	#endif
+
+	// Zeroed, so a failure part way can free them all
+	P->simd_vecs = (SIMD_Vectors *) calloc( I->nthreads,
+			sizeof(SIMD_Vectors));
+	int allocated = P->simd_vecs != NULL;
+	for( int t = 0; allocated && t < I->nthreads; t++ )
+	{
+		#ifdef INTEL
+		P->simd_vecs[t] = aligned_allocate_simd_vectors(I);
+		#else
+		P->simd_vecs[t] = allocate_simd_vectors(I);
+		#endif
+		allocated = simd_vectors_allocated(&P->simd_vecs[t]);
+	}
+	if( !allocated )
+	{
+		fprintf(stderr, "Unable to allocate the SimpleMOC SIMD vectors\n");
+		simplemoc_destroy(P);
+		return NULL;
+	}
+
+	return P;
+}
+
+// Whether the regions fit in an int and every array of the problem in
+// size_t - the checks count_3D_regions and array_bytes would exit on
+int problem_fits( Input * I )
+{
+	double regions = ceil((double) I->source_2D_regions *
+			I->coarse_axial_intervals / I->decomp_assemblies_ax);
+	if( regions > INT_MAX )
+		return 0;
+
+	size_t bytes;
+	return !__builtin_mul_overflow((size_t) regions,
+			(size_t) I->fine_axial_intervals, &bytes) &&
+		!__builtin_mul_overflow(bytes, (size_t) I->egroups, &bytes) &&
+		!__builtin_mul_overflow(bytes, sizeof(float), &bytes) &&
+		!__builtin_mul_overflow((size_t) I->egroups, 14 * sizeof(float),
+				&bytes);
+}
+
+// Whether every vector of a thread's SIMD vectors was allocated
+int simd_vectors_allocated( SIMD_Vectors * A )
+{
+	float * vecs[14] = { A->q0, A->q1, A->q2, A->sigT, A->tau, A->sigT2,
+		A->expVal, A->reuse, A->flux_integral, A->tally, A->t1, A->t2,
+		A->t3, A->t4 };
+	for( int v = 0; v < 14; v++ )
+		if( vecs[v] == NULL )
+			return 0;
+	return 1;
+}
+
+void simplemoc_destroy( SimpleMOC_Problem * P )
+{
+	if( P->simd_vecs != NULL )
+		for( int t = 0; t < P->I->nthreads; t++ )
+			free_simd_vectors(&P->simd_vecs[t]);
+	free(P->simd_vecs);
+
+	#ifdef TABLE
+	free_table(P->table);
+	#endif
+
+	free_sources(P->I, P->S);
+	free(P->I->phases);
+	free(P->I);
+	free(P);
+}
+
+// Checks the offsets are ordered and every segment lies in the problem
+int check_batch( SimpleMOC_Problem * P, const SimpleMOC_Segment * segments,
+		const long * offsets, int n_tracks )
+{
+	Input * I = P->I;
+
+	for( int t = 0; t < n_tracks; t++ )
+	{
+		if( offsets[t+1] < offsets[t] )
+			return 0;
+
+		for( long s = offsets[t]; s < offsets[t+1]; s++ )
+		{
+			const SimpleMOC_Segment * seg = &segments[s];
+			if( seg->QSR_id < 0 || seg->QSR_id >= I->source_3D_regions ||
+					seg->FAI_id < 0 ||
+					seg->FAI_id >= I->fine_axial_intervals ||
+					!(seg->ds >= 0) )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+int simplemoc_attenuate( SimpleMOC_Problem * P,
+		const SimpleMOC_Segment * segments, const long * offsets,
+		int n_tracks, float * state_flux )
+{
+	if( n_tracks < 1 )
+		return 0;
+
+	if( !check_batch(P, segments, offsets, n_tracks) )
+	{
+		fprintf(stderr, "Batch has a segment outside the problem\n");
+		return -1;
+	}
+
+	Batch_Args args;
+	args.P = P;
+	args.segments = segments;
+	args.offsets = offsets;
+	args.n_tracks = n_tracks;
+	args.state_flux = state_flux;
+	args.next = 0;
+	args.committed = 0;
+
+	// A lone track (or thread) skips the parallel region. Otherwise the
+	// region runs on the problem's own threads, as the thread count is
+	// global and another problem (or the caller) may have changed it.
+	if( n_tracks == 1 || P->I->nthreads == 1 )
+		batch_thread(&args);
+	else
+	{
+		set_num_threads(P->I->nthreads);
+		parallel_region( batch_thread, &args );
+	}
+
+	return 0;
+}
+
+// Body of the batch parallel region, run by every thread
+void batch_thread( void * args )
+{
+	Batch_Args * B = (Batch_Args *) args;
+	Input * I = B->P->I;
+	Source * S = B->P->S;
+	Table * table = B->P->table;
+
+	// There are only SIMD vectors for the problem's threads
+	int thread = get_thread_num();
+	if( thread >= I->nthreads )
+		return;
+	SIMD_Vectors * simd_vecs = &B->P->simd_vecs[thread];
+
+	tally_cache_begin(I);
+	tally_stage_begin(I, 64);
+
+	long t;
+	while( (t = __atomic_fetch_add(&B->next, 1, __ATOMIC_RELAXED)) <
+			B->n_tracks )
+	{
+		attenuate_track( I, S, table, B->segments, B->offsets[t],
+				B->offsets[t+1], B->state_flux + t * I->egroups,
+				simd_vecs );
+
+		if( tally_stage != NULL )
+			tally_stage_commit( I, S, tally_stage, &B->committed, t );
+	}
+
+	tally_cache_end(I, S);
+	tally_stage_end();
+}
+
+// Attenuates segments [begin, end) of a batch, one after another
+void attenuate_track( Input * I, Source * S, Table * table,
+		const SimpleMOC_Segment * segments, long begin, long end,
+		float * state_flux, SIMD_Vectors * simd_vecs )
+{
+	for( long s = begin; s < end; s++ )
+	{
+		simd_vecs->ds = segments[s].ds;
+		simd_vecs->mu = segments[s].mu;
+		simd_vecs->mu2 = segments[s].mu * segments[s].mu;
+
+		attenuate_segment( I, S, segments[s].QSR_id, segments[s].FAI_id,
+				state_flux, simd_vecs, table );
+	}
+}
+
+int simplemoc_regions( SimpleMOC_Problem * P )
+{
+	return P->I->source_3D_regions;
+}
+
+int simplemoc_fine_axial_intervals( SimpleMOC_Problem * P )
+{
+	return P->I->fine_axial_intervals;
+}
+
+int simplemoc_egroups( SimpleMOC_Problem * P )
+{
+	return P->I->egroups;
+}
+
+float * simplemoc_fine_flux( SimpleMOC_Problem * P, int QSR_id )
+{
+	return region_fine_flux(P->I, P->S, QSR_id);
+}
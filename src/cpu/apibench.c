@@ -0,0 +1,417 @@
+#include "SimpleMOC-kernel.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<limits.h>
+#include<time.h>
+
+#ifdef MPI
+#include<mpi.h>
+#endif
+
+// Call overhead of the library interface. The same tracks are attenuated
+// through simplemoc_attenuate() in batches of a few tracks up to all of
+// them at once. The single whole batch is the reference time per segment;
+// whatever a smaller batch takes beyond it is the cost of the calls (the
+// batch check, starting the parallel region, and setting up and draining
+// the tally strategy's per-thread state). Like any code linked against
+// the library, it only uses the public header, so it has its own timer
+// and option parsing.
+
+// API Benchmark Options
+typedef struct{
+	long * batches; // Tracks per batch to benchmark
+	int n_batches;
+	int egroups;
+	int nthreads;
+	int tally; // SIMPLEMOC_TALLY_*
+	int track_length; // Segments per track
+	long segments; // Segments attenuated per measurement
+	int repetitions;
+	char * results_file;
+} Apibench;
+
+Apibench read_apibench_CLI( int argc, char * argv[] );
+void print_apibench_CLI_error(void);
+long apibench_parse_long( const char * s );
+int apibench_parse_int( const char * s );
+int parse_batch_list( const char * str, long ** list );
+double apibench_time(void);
+void apibench_border_print(void);
+double time_batches( SimpleMOC_Problem * P, SimpleMOC_Segment * segments,
+		long * offsets, long n_tracks, float * state_flux, long batch );
+
+static const char * tally_names[3] = { "locked", "cached", "ordered" };
+
+int main( int argc, char * argv[] )
+{
+	#ifdef MPI
+	MPI_Init(&argc, &argv);
+	#endif
+
+	Apibench A = read_apibench_CLI( argc, argv );
+
+	SimpleMOC_Options O;
+	simplemoc_default_options(&O);
+	O.egroups = A.egroups;
+	if( A.nthreads > 0 )
+		O.nthreads = A.nthreads;
+	O.tally = A.tally;
+	O.seed = 1;
+
+	SimpleMOC_Problem * P = simplemoc_create(&O);
+	if( P == NULL )
+		print_apibench_CLI_error();
+
+	apibench_border_print();
+	printf("%25s%s\n", "", "LIBRARY CALL OVERHEAD BENCHMARK");
+	apibench_border_print();
+
+	// Random Tracks through the Problem
+	long n_tracks = A.segments / A.track_length;
+	long n_segments = n_tracks * A.track_length;
+	SimpleMOC_Segment * segments = (SimpleMOC_Segment *) malloc( n_segments *
+			sizeof(SimpleMOC_Segment));
+	long * offsets = (long *) malloc( (n_tracks + 1) * sizeof(long));
+	float * state_flux = (float *) malloc( n_tracks * O.egroups *
+			sizeof(float));
+
+	srand(1);
+	for( long s = 0; s < n_segments; s++ )
+	{
+		segments[s].QSR_id = rand() % simplemoc_regions(P);
+		segments[s].FAI_id = rand() % simplemoc_fine_axial_intervals(P);
+		segments[s].ds = 0.1f + 0.9f * rand() / RAND_MAX;
+		segments[s].mu = 0.2f + 0.8f * rand() / RAND_MAX;
+	}
+	for( long t = 0; t <= n_tracks; t++ )
+		offsets[t] = t * A.track_length;
+	for( long i = 0; i < n_tracks * O.egroups; i++ )
+		state_flux[i] = (float) rand() / RAND_MAX;
+
+	printf("%-25s%d\n", "Threads:", O.nthreads);
+	printf("%-25s%d\n", "Energy Groups:", O.egroups);
+	printf("%-25s%s\n", "Tally Strategy:", tally_names[A.tally]);
+	printf("%-25s%d segments\n", "Track Length:", A.track_length);
+	printf("%-25s%ld tracks, %ld segments\n", "Per Measurement:", n_tracks,
+			n_segments);
+	printf("%-25s%d\n", "Repetitions (best of):", A.repetitions);
+	apibench_border_print();
+
+	// Every batch size is the best of the repetitions, after one pass to
+	// warm up the source data. Repetitions sweep over all batch sizes in
+	// turn, so drift in the machine's speed hits them all alike.
+	double * best = (double *) malloc( (A.n_batches + 1) * sizeof(double));
+	for( int r = 0; r <= A.repetitions; r++ )
+	{
+		for( int b = 0; b <= A.n_batches; b++ )
+		{
+			long batch = b == A.n_batches ? n_tracks : A.batches[b];
+			if( batch > n_tracks )
+				batch = n_tracks;
+
+			double t = time_batches(P, segments, offsets, n_tracks,
+					state_flux, batch);
+			if( r == 1 || (r > 1 && t < best[b]) )
+				best[b] = t;
+		}
+	}
+
+	double reference = best[A.n_batches] / n_segments;
+
+	FILE * fp = NULL;
+	if( A.results_file != NULL )
+	{
+		fp = fopen(A.results_file, "w");
+		if( fp == NULL )
+			fprintf(stderr, "Unable to open results file %s\n",
+					A.results_file);
+		else
+			fprintf(fp, "tally,nthreads,egroups,tracks_per_batch,"
+					"segments_per_batch,calls,ns_per_segment,us_per_call,"
+					"overhead_us_per_call,overhead_percent\n");
+	}
+
+	printf("%-10s%-12s%-10s%-12s%-12s%-16s%s\n", "Tracks", "Segments",
+			"Calls", "ns/Segment", "us/Call", "Overhead/Call", "Overhead");
+	for( int b = 0; b < A.n_batches; b++ )
+	{
+		long batch = A.batches[b] < n_tracks ? A.batches[b] : n_tracks;
+		long calls = n_tracks / batch;
+		long segs = calls * batch * A.track_length;
+		double per_segment = best[b] / segs;
+		double per_call = best[b] / calls;
+		double overhead = (best[b] - segs * reference) / calls;
+
+		printf("%-10ld%-12ld%-10ld%-12.3lf%-12.3lf%-16.3lf%.1lf%%\n",
+				batch, batch * A.track_length, calls, per_segment * 1.0e9,
+				per_call * 1.0e6, overhead * 1.0e6,
+				(per_segment / reference - 1.0) * 100.);
+
+		if( fp != NULL )
+			fprintf(fp, "%s,%d,%d,%ld,%ld,%ld,%.6lf,%.6lf,%.6lf,%.6lf\n",
+					tally_names[A.tally], O.nthreads, O.egroups, batch,
+					batch * A.track_length, calls, per_segment * 1.0e9,
+					per_call * 1.0e6, overhead * 1.0e6,
+					(per_segment / reference - 1.0) * 100.);
+	}
+	apibench_border_print();
+	printf("%-25s%.3lf ns per segment (one batch of %ld tracks)\n",
+			"Reference:", reference * 1.0e9, n_tracks);
+	apibench_border_print();
+
+	if( fp != NULL )
+		fclose(fp);
+
+	free(best);
+	free(segments);
+	free(offsets);
+	free(state_flux);
+	simplemoc_destroy(P);
+
+	#ifdef MPI
+	MPI_Finalize();
+	#endif
+
+	return 0;
+}
+
+Apibench read_apibench_CLI( int argc, char * argv[] )
+{
+	Apibench A;
+	A.n_batches = parse_batch_list("1-4096:x4", &A.batches);
+	A.egroups = 128;
+	A.nthreads = 0;
+	A.tally = SIMPLEMOC_TALLY_LOCKED;
+	A.track_length = 10;
+	A.segments = 1L << 16;
+	A.repetitions = 3;
+	A.results_file = NULL;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		char * arg = argv[i];
+
+		// List of tracks per batch (-b)
+		if( strcmp(arg, "-b") == 0 )
+		{
+			if( ++i < argc )
+			{
+				free(A.batches);
+				A.n_batches = parse_batch_list(argv[i], &A.batches);
+				if( A.n_batches == 0 )
+					print_apibench_CLI_error();
+			}
+			else
+				print_apibench_CLI_error();
+		}
+		// Energy groups (-e)
+		else if( strcmp(arg, "-e") == 0 )
+		{
+			if( ++i < argc )
+				A.egroups = apibench_parse_int(argv[i]);
+			else
+				print_apibench_CLI_error();
+		}
+		// Threads (-t)
+		else if( strcmp(arg, "-t") == 0 )
+		{
+			if( ++i < argc )
+				A.nthreads = apibench_parse_int(argv[i]);
+			else
+				print_apibench_CLI_error();
+		}
+		// Tally strategy (-T)
+		else if( strcmp(arg, "-T") == 0 )
+		{
+			if( ++i >= argc )
+				print_apibench_CLI_error();
+			else if( strcmp(argv[i], "locked") == 0 )
+				A.tally = SIMPLEMOC_TALLY_LOCKED;
+			else if( strcmp(argv[i], "cached") == 0 )
+				A.tally = SIMPLEMOC_TALLY_CACHED;
+			else if( strcmp(argv[i], "ordered") == 0 )
+				A.tally = SIMPLEMOC_TALLY_ORDERED;
+			else
+				print_apibench_CLI_error();
+		}
+		// Segments per track (-l)
+		else if( strcmp(arg, "-l") == 0 )
+		{
+			if( ++i < argc )
+				A.track_length = apibench_parse_int(argv[i]);
+			else
+				print_apibench_CLI_error();
+		}
+		// Segments per measurement (-s)
+		else if( strcmp(arg, "-s") == 0 )
+		{
+			if( ++i < argc )
+				A.segments = apibench_parse_long(argv[i]);
+			else
+				print_apibench_CLI_error();
+		}
+		// Repetitions (-r)
+		else if( strcmp(arg, "-r") == 0 )
+		{
+			if( ++i < argc )
+				A.repetitions = apibench_parse_int(argv[i]);
+			else
+				print_apibench_CLI_error();
+		}
+		// CSV results file (-o)
+		else if( strcmp(arg, "-o") == 0 )
+		{
+			if( ++i < argc )
+				A.results_file = argv[i];
+			else
+				print_apibench_CLI_error();
+		}
+		else
+			print_apibench_CLI_error();
+	}
+
+	if( A.egroups < 1 || A.nthreads < 0 || A.track_length < 1 ||
+			A.segments < A.track_length || A.repetitions < 1 )
+		print_apibench_CLI_error();
+
+	return A;
+}
+
+void print_apibench_CLI_error(void)
+{
+	printf("Usage: ./SimpleMOC-apibench <options>\n");
+	printf("Options include:\n");
+	printf("  -b <tracks>               Tracks per batch, e.g. 1,16 or 1-4096:x4\n");
+	printf("  -e <groups>               Energy groups\n");
+	printf("  -t <threads>              Threads\n");
+	printf("  -T <strategy>             Tally strategy: locked, cached or ordered\n");
+	printf("  -l <segments>             Segments per track\n");
+	printf("  -s <segments>             Segments attenuated per measurement\n");
+	printf("  -r <repetitions>          Timed repetitions (best is kept)\n");
+	printf("  -o <file.csv>             Write the results to a CSV file\n");
+	exit(1);
+}
+
+// Attenuates all tracks, the given number per call. Tracks left over
+// from the last whole batch are not run.
+double time_batches( SimpleMOC_Problem * P, SimpleMOC_Segment * segments,
+		long * offsets, long n_tracks, float * state_flux, long batch )
+{
+	int egroups = simplemoc_egroups(P);
+	long calls = n_tracks / batch;
+
+	double start = apibench_time();
+
+	for( long c = 0; c < calls; c++ )
+		simplemoc_attenuate(P, segments, offsets + c * batch, (int) batch,
+				state_flux + c * batch * egroups);
+
+	return apibench_time() - start;
+}
+
+// Parses a whole decimal argument, rejecting anything else
+long apibench_parse_long( const char * s )
+{
+	char * end;
+	errno = 0;
+	long v = strtol(s, &end, 10);
+	if( errno != 0 || end == s || *end != '\0' )
+		print_apibench_CLI_error();
+	return v;
+}
+
+// As apibench_parse_long, for arguments stored in an int
+int apibench_parse_int( const char * s )
+{
+	long v = apibench_parse_long(s);
+	if( v < INT_MIN || v > INT_MAX )
+		print_apibench_CLI_error();
+	return (int) v;
+}
+
+// Parses a list of batch sizes such as "1,16", a range "1-64", a stepped
+// range "1-64:8" or a geometric range "1-4096:x4". Returns the number of
+// values, or 0 if the list is malformed or has a value below 1.
+int parse_batch_list( const char * str, long ** list )
+{
+	int n = 0;
+	int max = 16;
+	long * vals = (long *) malloc( max * sizeof(long));
+
+	const char * p = str;
+	while( *p != '\0' )
+	{
+		char * next;
+		long first = strtol(p, &next, 10);
+		long last = first;
+		long step = 1;
+		int geometric = 0;
+		int ok = next != p && first >= 1;
+
+		if( ok && *next == '-' )
+		{
+			p = next + 1;
+			last = strtol(p, &next, 10);
+			ok = next != p && last >= first;
+
+			if( ok && *next == ':' )
+			{
+				p = next + 1;
+				if( *p == 'x' )
+				{
+					geometric = 1;
+					p++;
+				}
+				step = strtol(p, &next, 10);
+				ok = next != p && step >= (geometric ? 2 : 1);
+			}
+		}
+
+		if( ok && *next == ',' )
+			next++;
+		else if( *next != '\0' )
+			ok = 0;
+
+		if( !ok )
+		{
+			free(vals);
+			return 0;
+		}
+
+		for( long v = first; v <= last; v = geometric ? v * step : v + step )
+		{
+			if( n == max )
+			{
+				max *= 2;
+				vals = (long *) realloc( vals, max * sizeof(long));
+			}
+			vals[n++] = v;
+
+			// Stop before the next value would overflow
+			if( geometric ? v > last / step : v > last - step )
+				break;
+		}
+
+		p = next;
+	}
+
+	*list = vals;
+	return n;
+}
+
+// Wall clock time (s)
+double apibench_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1.0e-9;
+}
+
+void apibench_border_print(void)
+{
+	printf(
+	"==================================================================="
+	"=============\n");
+}
@@ -0,0 +1,265 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Axial on-the-fly tracking (-V). Instead of sweeping each 2D track flat
+// through every axial plane, every 2D track and polar angle gets a stack
+// of 3D tracks, evenly spaced in z, rising (or, for the downward half of
+// the angles, falling) along the 2D track through the subdomain. A 3D
+// track's segments are made from the 2D segments it follows, split
+// wherever it crosses into the next fine axial interval - so each segment
+// has its real 3D source region, fine axial interval, length and polar
+// angle. By default the 3D segments are made on the fly, a track at a
+// time, from the 2D segments (themselves traced on the fly, or stored
+// with -Y); "-Y" stores every 3D segment instead.
+
+// Height of each axial layer of 2D regions (one coarse interval, cm)
+static const double layer_height = 10.0;
+
+// Shortest 3D segment kept - shorter ones are corners of plane crossings
+static const double min_length = 1.0e-6;
+
+void init_axial( Input * I, Geometry * G )
+{
+	G->n_polar = I->polar_angles;
+	G->axial_spacing = I->axial_spacing;
+	G->plane_height = layer_height / I->fine_axial_intervals;
+	G->height = G->layers * layer_height;
+
+	// Upward polar angles, evenly spaced in their cosine, then their
+	// downward mirror images
+	int n_half = G->n_polar / 2;
+	G->polar_mu = (double *) malloc( G->n_polar * sizeof(double));
+	for( int p = 0; p < n_half; p++ )
+	{
+		G->polar_mu[p] = (p + 0.5) / n_half;
+		G->polar_mu[n_half + p] = -G->polar_mu[p];
+	}
+
+	// A 3D track crosses at most every 2D segment of its track, split at
+	// every plane
+	G->max_segments_3D = G->max_segments + G->planes;
+
+	count_axial_segments(I, G);
+
+	if( G->stored )
+		store_axial_segments(I, G);
+}
+
+// Stack of 3D tracks on a 2D track at a polar angle. Tracks start below
+// the subdomain (if they must, to reach its top by the end of the 2D
+// track) up to its top, the spacing corrected so a whole number fit.
+// Downward tracks are the same stack measured down from the top. Returns
+// the number of tracks, with the start of the first and the spacing.
+int axial_stack( Geometry * G, Track * T, int polar, double * z0,
+		double * dz )
+{
+	double mu = fabs(G->polar_mu[polar]);
+	double cot = mu / sqrt(1.0 - mu * mu);
+	double span = G->height + T->length * cot;
+
+	int n = (int) (span / G->axial_spacing) + 1;
+	*dz = span / n;
+	*z0 = -T->length * cot + 0.5 * *dz;
+	return n;
+}
+
+// Makes the segments of the 3D track starting at height z0 over the given
+// 2D segments. A downward track is traced as if rising from the top (z0
+// below the top), its planes counted back down from the top one. Returns
+// the number of segments written.
+int trace_axial( Input * I, Geometry * G, Segment_2D * segments, int n,
+		int polar, double z0, SimpleMOC_Segment * out )
+{
+	float mu = (float) G->polar_mu[polar];
+	int down = G->polar_mu[polar] < 0;
+	double sin_theta = sqrt(1.0 - G->polar_mu[polar] * G->polar_mu[polar]);
+	double cot = fabs(G->polar_mu[polar]) / sin_theta;
+
+	// Part of the 2D track (by distance along it) inside the subdomain
+	double s_bottom = -z0 / cot;
+	double s_top = (G->height - z0) / cot;
+
+	int written = 0;
+	double s = 0;
+	for( int i = 0; i < n; i++ )
+	{
+		double s0 = s > s_bottom ? s : s_bottom;
+		s += segments[i].length;
+		double s1 = s < s_top ? s : s_top;
+		if( s1 - s0 <= 0 )
+			continue;
+
+		int plane = (int) ((z0 + s0 * cot) / G->plane_height);
+		if( plane < 0 )
+			plane = 0;
+		if( plane > G->planes - 1 )
+			plane = G->planes - 1;
+
+		// Split the 2D segment at every plane it rises through. The
+		// crossings are clamped to the segment, so rounding can't step
+		// back along it, and the top plane runs to its end.
+		while( s0 < s1 )
+		{
+			double s_next = s1;
+			if( plane < G->planes - 1 )
+				s_next = ((plane + 1) * G->plane_height - z0) / cot;
+			if( s_next > s1 )
+				s_next = s1;
+			if( s_next < s0 )
+				s_next = s0;
+
+			double ds = (s_next - s0) / sin_theta;
+			if( ds >= min_length )
+			{
+				int z_plane = down ? G->planes - 1 - plane : plane;
+				int layer = z_plane / I->fine_axial_intervals;
+				out[written].QSR_id = (int) (layer * I->source_2D_regions +
+						segments[i].region);
+				out[written].FAI_id = z_plane % I->fine_axial_intervals;
+				out[written].ds = (float) ds;
+				out[written].mu = mu;
+				written++;
+			}
+
+			s0 = s_next;
+			plane++;
+		}
+	}
+
+	return written;
+}
+
+// Makes every 3D track over a 2D track, one after another. Returns the
+// number of segments written.
+long trace_stacks( Input * I, Geometry * G, Track * T,
+		Segment_2D * segments, int n, SimpleMOC_Segment * out )
+{
+	long written = 0;
+	for( int p = 0; p < G->n_polar; p++ )
+	{
+		double z0, dz;
+		int stack = axial_stack(G, T, p, &z0, &dz);
+		for( int k = 0; k < stack; k++ )
+			written += trace_axial(I, G, segments, n, p, z0 + k * dz,
+					out + written);
+	}
+	return written;
+}
+
+// Makes every 3D track once, to count the segments of a sweep
+void count_axial_segments( Input * I, Geometry * G )
+{
+	Segment_2D * segments = (Segment_2D *) malloc( G->max_segments *
+			sizeof(Segment_2D));
+	SimpleMOC_Segment * buffer = (SimpleMOC_Segment *) malloc(
+			G->max_segments_3D * sizeof(SimpleMOC_Segment));
+
+	G->tracks_3D = 0;
+	G->segments_3D = 0;
+	G->total_length_3D = 0;
+	for( int t = 0; t < G->n_tracks; t++ )
+	{
+		Track * T = &G->tracks[t];
+		int n = trace_track(G, T, segments);
+		for( int p = 0; p < G->n_polar; p++ )
+		{
+			double z0, dz;
+			int stack = axial_stack(G, T, p, &z0, &dz);
+			G->tracks_3D += stack;
+			for( int k = 0; k < stack; k++ )
+			{
+				int m = trace_axial(I, G, segments, n, p, z0 + k * dz,
+						buffer);
+				G->segments_3D += m;
+				for( int s = 0; s < m; s++ )
+					G->total_length_3D += buffer[s].ds;
+			}
+		}
+	}
+
+	free(segments);
+	free(buffer);
+
+	// Every timed run sweeps every 3D track
+	I->segments = G->segments_3D;
+}
+
+// Makes every 3D track into the store, grouped by 2D track
+void store_axial_segments( Input * I, Geometry * G )
+{
+	double start = get_time();
+
+	Segment_2D * segments = (Segment_2D *) malloc( G->max_segments *
+			sizeof(Segment_2D));
+	G->store_3D = (SimpleMOC_Segment *) checked_malloc( array_bytes(
+				"3D segment store", G->segments_3D, 1, 1,
+				sizeof(SimpleMOC_Segment)), "3D segment store");
+	G->offsets_3D = (long *) malloc( (G->n_tracks + 1) * sizeof(long));
+
+	G->offsets_3D[0] = 0;
+	for( int t = 0; t < G->n_tracks; t++ )
+	{
+		int n = trace_track(G, &G->tracks[t], segments);
+		G->offsets_3D[t+1] = G->offsets_3D[t] + trace_stacks(I, G,
+				&G->tracks[t], segments, n, G->store_3D + G->offsets_3D[t]);
+	}
+
+	free(segments);
+	G->store_time = get_time() - start;
+}
+
+// Attenuates every 3D track over a 2D track, making each track's segments
+// just before it is swept. Returns the number of segments attenuated.
+long sweep_axial( Input * I, Source * S, Table * table, Track * T,
+		Segment_2D * segments, int n, SimpleMOC_Segment * buffer,
+		float * state_flux, SIMD_Vectors * simd_vecs )
+{
+	Geometry * G = I->geometry;
+	long swept = 0;
+
+	for( int p = 0; p < G->n_polar; p++ )
+	{
+		double z0, dz;
+		int stack = axial_stack(G, T, p, &z0, &dz);
+		for( int k = 0; k < stack; k++ )
+		{
+			int m = trace_axial(I, G, segments, n, p, z0 + k * dz, buffer);
+			attenuate_track( I, S, table, buffer, 0, m, state_flux,
+					simd_vecs );
+			swept += m;
+		}
+	}
+
+	return swept;
+}
+
+// Prints the 3D tracks, and the memory of making their segments on the
+// fly against storing them
+void print_axial( Input * I )
+{
+	Geometry * G = I->geometry;
+	double otf_mb = (double) I->nthreads * (G->max_segments *
+			sizeof(Segment_2D) + G->max_segments_3D *
+			sizeof(SimpleMOC_Segment)) / 1024.0 / 1024.0;
+	double stored_mb = (G->segments_3D * sizeof(SimpleMOC_Segment) +
+			(G->n_tracks + 1) * sizeof(long)) / 1024.0 / 1024.0;
+
+	printf("%-25s%d (%.2lf cm planes, %.2lf cm tall)\n", "Polar Angles:",
+			G->n_polar, G->plane_height, G->height);
+	printf("%-25s%ld (%.3lf cm requested spacing)\n", "3D Tracks:",
+			G->tracks_3D, G->axial_spacing);
+	printf("%-25s%ld, %.4lf cm mean length\n", "3D Segments:",
+			G->segments_3D, G->total_length_3D / G->segments_3D);
+	printf("%-25s%.6lf s (%.3lf ns per 3D segment)\n", "Tracking Only:",
+			G->trace_time, G->trace_time / G->segments_3D * 1.0e9);
+	printf("%-25s%.2lf M segments/s\n", "Generation Rate:",
+			G->segments_3D / G->trace_time / 1.0e6);
+	printf("%-25s%.6lf s (%.3lf ns per segment)\n", "Attenuation:",
+			G->stored_time, G->stored_time / G->segments_3D * 1.0e9);
+	printf("%-25s%.6lf s per sweep (%.3lf MB of buffers)\n",
+			"On-the-Fly Sweep:", G->otf_time, otf_mb);
+	printf("%-25s%.6lf s per sweep (%.2lf MB, stored in %.6lf s)\n",
+			"Stored Sweep:", G->stored_time, stored_mb, G->store_time);
+	printf("%-25s%s by %.2lf%%\n", "Faster Per Sweep:",
+			G->otf_time < G->stored_time ? "on the fly" : "stored",
+			fabs(G->otf_time / G->stored_time - 1.0) * 100.);
+}
@@ -0,0 +1,351 @@
+#include "SimpleMOC-kernel_header.h"
+#include<sys/utsname.h>
+
+Results * init_results( int repetitions, long segments, int egroups )
+{
+	Results * R = (Results *) malloc(sizeof(Results));
+	R->repetitions = repetitions;
+	R->segments = segments;
+	R->egroups = egroups;
+	R->runtimes = (double *) calloc( repetitions, sizeof(double));
+	return R;
+}
+
+int compare_doubles( const void * a, const void * b )
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+// Computes min/median/mean/stddev of the runtimes of the repetitions
+void compute_statistics( Results * R )
+{
+	int n = R->repetitions;
+	double * sorted = (double *) malloc( n * sizeof(double));
+	memcpy(sorted, R->runtimes, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), compare_doubles);
+
+	R->min = sorted[0];
+	R->max = sorted[n-1];
+	if( n % 2 == 1 )
+		R->median = sorted[n/2];
+	else
+		R->median = 0.5 * (sorted[n/2 - 1] + sorted[n/2]);
+
+	double sum = 0;
+	for( int i = 0; i < n; i++ )
+		sum += sorted[i];
+	R->mean = sum / n;
+
+	// Sample standard deviation
+	double var = 0;
+	for( int i = 0; i < n; i++ )
+		var += (sorted[i] - R->mean) * (sorted[i] - R->mean);
+	R->stddev = n > 1 ? sqrt(var / (n - 1)) : 0;
+
+	free(sorted);
+}
+
+// Converts a runtime to time per intersection (ns)
+double time_per_intersection( Results * R, double runtime )
+{
+	return runtime / (double) R->segments / (double) R->egroups * 1.0e9;
+}
+
+// Prints the runtime statistics in the results summary
+void print_results( Results * R )
+{
+	printf("%-25s%.3lf seconds\n", "Runtime:", R->median);
+	printf("%-25s%.3lf ns\n", "Time per Intersection:",
+			time_per_intersection(R, R->median));
+
+	if( R->repetitions > 1 )
+	{
+		printf("%-25s%d\n", "Repetitions:", R->repetitions);
+		printf("%-25s%-12s%s\n", "", "Runtime (s)", "Time/Int (ns)");
+		printf("%-25s%-12.4lf%.3lf\n", "  Min:", R->min,
+				time_per_intersection(R, R->min));
+		printf("%-25s%-12.4lf%.3lf\n", "  Median:", R->median,
+				time_per_intersection(R, R->median));
+		printf("%-25s%-12.4lf%.3lf\n", "  Mean:", R->mean,
+				time_per_intersection(R, R->mean));
+		printf("%-25s%-12.4lf%.3lf\n", "  Std Dev:", R->stddev,
+				time_per_intersection(R, R->stddev));
+	}
+}
+
+// Build flags the binary was compiled with
+void get_build_flags( Build_Flags * B )
+{
+	memset(B, 0, sizeof(Build_Flags));
+	#ifdef TABLE
+	B->table = 1;
+	#endif
+	#ifdef COMPACT
+	B->compact = 1;
+	#endif
+	#ifdef INTEL
+	B->intel = 1;
+	#endif
+	#ifdef PAPI
+	B->papi = 1;
+	#endif
+	#ifdef OPENMP
+	B->openmp = 1;
+	#endif
+	#ifdef PTHREADS
+	B->pthreads = 1;
+	#endif
+	#ifdef MPI
+	B->mpi = 1;
+	#endif
+	#ifdef __VERSION__
+	B->compiler = __VERSION__;
+	#else
+	B->compiler = "unknown";
+	#endif
+}
+
+// Host the benchmark ran on
+void get_host_info( Host_Info * H )
+{
+	struct utsname u;
+	memset(H, 0, sizeof(Host_Info));
+
+	if( gethostname(H->hostname, sizeof(H->hostname) - 1) != 0 )
+		strcpy(H->hostname, "unknown");
+	if( uname(&u) == 0 )
+	{
+		snprintf(H->os, sizeof(H->os), "%s %s", u.sysname, u.release);
+		snprintf(H->machine, sizeof(H->machine), "%s", u.machine);
+	}
+	H->nprocs = get_num_procs();
+	H->L1_size = detect_L1_size();
+
+	time_t now = time(NULL);
+	strftime(H->date, sizeof(H->date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+}
+
+// Writes the inputs, build flags, host and results as one JSON object
+void write_results_json( FILE * fp, Input * I, Results * R )
+{
+	Build_Flags B;
+	Host_Info H;
+	get_build_flags(&B);
+	get_host_info(&H);
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"version\": 4,\n");
+
+	fprintf(fp, "  \"input\": {\n");
+	fprintf(fp, "    \"source_2D_regions\": %d,\n", I->source_2D_regions);
+	fprintf(fp, "    \"source_3D_regions\": %d,\n", I->source_3D_regions);
+	fprintf(fp, "    \"coarse_axial_intervals\": %d,\n",
+			I->coarse_axial_intervals);
+	fprintf(fp, "    \"fine_axial_intervals\": %d,\n", I->fine_axial_intervals);
+	fprintf(fp, "    \"decomp_assemblies_ax\": %d,\n", I->decomp_assemblies_ax);
+	fprintf(fp, "    \"segments\": %ld,\n", I->segments);
+	fprintf(fp, "    \"egroups\": %d,\n", I->egroups);
+	fprintf(fp, "    \"nthreads\": %d,\n", I->nthreads);
+	fprintf(fp, "    \"tile_size\": %d,\n", I->tile_size);
+	fprintf(fp, "    \"scheduler\": %d,\n", I->scheduler);
+	fprintf(fp, "    \"chunk_size\": %ld,\n", I->chunk_size);
+	fprintf(fp, "    \"affinity\": %d,\n", I->affinity);
+	fprintf(fp, "    \"nranks\": %d,\n", I->nranks);
+	fprintf(fp, "    \"sweeps\": %d,\n", I->sweeps);
+	fprintf(fp, "    \"boundary_tracks\": %d,\n", I->boundary_tracks);
+	fprintf(fp, "    \"warmup_runs\": %d,\n", I->warmup_runs);
+	fprintf(fp, "    \"repetitions\": %d,\n", I->repetitions);
+	fprintf(fp, "    \"seed\": %ld,\n", I->seed);
+	fprintf(fp, "    \"tally_cache_lines\": %d,\n", I->tally_cache_lines);
+	fprintf(fp, "    \"pipeline_depth\": %d,\n", I->pipeline_depth);
+	fprintf(fp, "    \"pipeline_tally_depth\": %d,\n",
+			I->pipeline_tally_depth);
+	fprintf(fp, "    \"lattice_pins\": %d,\n", I->lattice_pins);
+	fprintf(fp, "    \"lattice_rings\": %d,\n", I->lattice_rings);
+	fprintf(fp, "    \"lattice_sectors\": %d,\n", I->lattice_sectors);
+	fprintf(fp, "    \"azimuthal_angles\": %d,\n", I->azimuthal_angles);
+	fprintf(fp, "    \"track_spacing\": %g,\n", I->track_spacing);
+	fprintf(fp, "    \"store_segments\": %d,\n", I->store_segments);
+	fprintf(fp, "    \"polar_angles\": %d,\n", I->polar_angles);
+	fprintf(fp, "    \"axial_spacing\": %g,\n", I->axial_spacing);
+	fprintf(fp, "    \"reproducible\": %d,\n", I->reproducible);
+	fprintf(fp, "    \"out_of_core_window\": %d,\n",
+			I->ooc != NULL ? I->ooc->window_regions : 0);
+	#ifdef COMPACT
+	fprintf(fp, "    \"lock_stripes\": %d,\n", I->lock_stripes);
+	#endif
+	#ifdef PAPI
+	fprintf(fp, "    \"papi_event_set\": %d,\n", I->papi_event_set);
+	#endif
+	fprintf(fp, "    \"nbytes\": %zu\n", I->nbytes);
+	fprintf(fp, "  },\n");
+
+	fprintf(fp, "  \"build\": {\n");
+	fprintf(fp, "    \"TABLE\": %s,\n", B.table ? "true" : "false");
+	fprintf(fp, "    \"COMPACT\": %s,\n", B.compact ? "true" : "false");
+	fprintf(fp, "    \"INTEL\": %s,\n", B.intel ? "true" : "false");
+	fprintf(fp, "    \"PAPI\": %s,\n", B.papi ? "true" : "false");
+	fprintf(fp, "    \"OPENMP\": %s,\n", B.openmp ? "true" : "false");
+	fprintf(fp, "    \"PTHREADS\": %s,\n", B.pthreads ? "true" : "false");
+	fprintf(fp, "    \"MPI\": %s,\n", B.mpi ? "true" : "false");
+	fprintf(fp, "    \"compiler\": \"%s\"\n", B.compiler);
+	fprintf(fp, "  },\n");
+
+	fprintf(fp, "  \"host\": {\n");
+	fprintf(fp, "    \"hostname\": \"%s\",\n", H.hostname);
+	fprintf(fp, "    \"os\": \"%s\",\n", H.os);
+	fprintf(fp, "    \"machine\": \"%s\",\n", H.machine);
+	fprintf(fp, "    \"nprocs\": %d,\n", H.nprocs);
+	fprintf(fp, "    \"L1_size\": %ld,\n", H.L1_size);
+	fprintf(fp, "    \"date\": \"%s\"\n", H.date);
+	fprintf(fp, "  },\n");
+
+	fprintf(fp, "  \"results\": {\n");
+	fprintf(fp, "    \"runtimes\": [");
+	for( int i = 0; i < R->repetitions; i++ )
+		fprintf(fp, "%s%.9lf", i ? ", " : "", R->runtimes[i]);
+	fprintf(fp, "],\n");
+	fprintf(fp, "    \"segments_per_run\": %ld,\n", R->segments);
+	fprintf(fp, "    \"runtime_min\": %.9lf,\n", R->min);
+	fprintf(fp, "    \"runtime_median\": %.9lf,\n", R->median);
+	fprintf(fp, "    \"runtime_mean\": %.9lf,\n", R->mean);
+	fprintf(fp, "    \"runtime_stddev\": %.9lf,\n", R->stddev);
+	fprintf(fp, "    \"time_per_intersection_min\": %.6lf,\n",
+			time_per_intersection(R, R->min));
+	fprintf(fp, "    \"time_per_intersection_median\": %.6lf,\n",
+			time_per_intersection(R, R->median));
+	fprintf(fp, "    \"time_per_intersection_mean\": %.6lf,\n",
+			time_per_intersection(R, R->mean));
+	fprintf(fp, "    \"time_per_intersection_stddev\": %.6lf",
+			time_per_intersection(R, R->stddev));
+	if( I->reproducible )
+	{
+		fprintf(fp, ",\n    \"flux_checksum\": \"%016llx\",\n",
+				I->flux_checksum);
+		fprintf(fp, "    \"locked_runtime_median\": %.9lf",
+				I->locked_runtime);
+	}
+	fprintf(fp, "\n  },\n");
+
+	double flops = flops_per_intersection(I);
+	double bytes = bytes_per_intersection(I);
+	double intersections = (double) R->segments * R->egroups;
+	fprintf(fp, "  \"roofline\": {\n");
+	fprintf(fp, "    \"flops_per_intersection\": %.3lf,\n", flops);
+	fprintf(fp, "    \"bytes_per_intersection\": %.3lf,\n", bytes);
+	fprintf(fp, "    \"arithmetic_intensity\": %.6lf,\n", flops / bytes);
+	fprintf(fp, "    \"gflops\": %.6lf,\n",
+			flops * intersections / R->median / 1.0e9);
+	fprintf(fp, "    \"gbps\": %.6lf,\n",
+			bytes * intersections / R->median / 1.0e9);
+	fprintf(fp, "    \"peak_bandwidth\": %.6lf,\n", I->peak_bandwidth);
+	fprintf(fp, "    \"peak_gflops\": %.6lf\n", I->peak_gflops);
+	fprintf(fp, "  },\n");
+	write_phases_json(fp, I);
+
+	#ifdef PERF
+	if( I->perf != NULL )
+	{
+		fprintf(fp, ",\n");
+		write_perf_json(fp, I, R);
+	}
+	#endif
+
+	fprintf(fp, "\n}\n");
+}
+
+// Writes one CSV row, preceded by a header if the file is new/empty
+void write_results_csv( FILE * fp, Input * I, Results * R )
+{
+	Build_Flags B;
+	Host_Info H;
+	get_build_flags(&B);
+	get_host_info(&H);
+
+	fseek(fp, 0, SEEK_END);
+	int new_file = ftell(fp) == 0;
+	if( new_file )
+	{
+		fprintf(fp, "date,hostname,os,machine,nprocs,L1_size,compiler,"
+				"TABLE,COMPACT,INTEL,PAPI,OPENMP,PTHREADS,MPI,"
+				"source_2D_regions,source_3D_regions,coarse_axial_intervals,"
+				"fine_axial_intervals,decomp_assemblies_ax,segments,egroups,"
+				"nthreads,tile_size,scheduler,chunk_size,affinity,nranks,"
+				"sweeps,boundary_tracks,warmup_runs,repetitions,seed,"
+				"tally_cache_lines,pipeline_depth,pipeline_tally_depth,"
+				"reproducible,"
+				"out_of_core_window,lock_stripes,lattice_pins,lattice_rings,"
+				"lattice_sectors,azimuthal_angles,track_spacing,"
+				"store_segments,polar_angles,axial_spacing,nbytes,"
+				"runtime_min,runtime_median,runtime_mean,runtime_stddev,"
+				"tpi_min,tpi_median,tpi_mean,tpi_stddev,"
+				"flops_per_intersection,bytes_per_intersection,gflops,gbps,"
+				"peak_bandwidth,peak_gflops");
+		write_phases_csv_header(fp);
+		fprintf(fp, "\n");
+	}
+
+	fprintf(fp, "%s,%s,%s,%s,%d,%ld,\"%s\",", H.date, H.hostname, H.os,
+			H.machine, H.nprocs, H.L1_size, B.compiler);
+	fprintf(fp, "%d,%d,%d,%d,%d,%d,%d,", B.table, B.compact, B.intel, B.papi,
+			B.openmp, B.pthreads, B.mpi);
+	fprintf(fp, "%d,%d,%d,%d,%d,%ld,%d,", I->source_2D_regions,
+			I->source_3D_regions, I->coarse_axial_intervals,
+			I->fine_axial_intervals, I->decomp_assemblies_ax, I->segments,
+			I->egroups);
+	fprintf(fp, "%d,%d,%d,%ld,%d,%d,%d,%d,%d,%d,%ld,", I->nthreads,
+			I->tile_size, I->scheduler, I->chunk_size, I->affinity,
+			I->nranks, I->sweeps, I->boundary_tracks, I->warmup_runs,
+			I->repetitions, I->seed);
+
+	int lock_stripes = 0;
+	#ifdef COMPACT
+	lock_stripes = I->lock_stripes;
+	#endif
+	fprintf(fp, "%d,%d,%d,%d,%d,%d,", I->tally_cache_lines,
+			I->pipeline_depth, I->pipeline_tally_depth, I->reproducible,
+			I->ooc != NULL ? I->ooc->window_regions : 0, lock_stripes);
+	fprintf(fp, "%d,%d,%d,%d,%g,%d,%d,%g,%zu,", I->lattice_pins,
+			I->lattice_rings, I->lattice_sectors, I->azimuthal_angles,
+			I->track_spacing, I->store_segments, I->polar_angles,
+			I->axial_spacing, I->nbytes);
+	fprintf(fp, "%.9lf,%.9lf,%.9lf,%.9lf,", R->min, R->median, R->mean,
+			R->stddev);
+	fprintf(fp, "%.6lf,%.6lf,%.6lf,%.6lf,", time_per_intersection(R, R->min),
+			time_per_intersection(R, R->median),
+			time_per_intersection(R, R->mean),
+			time_per_intersection(R, R->stddev));
+
+	double flops = flops_per_intersection(I);
+	double bytes = bytes_per_intersection(I);
+	double intersections = (double) R->segments * R->egroups;
+	fprintf(fp, "%.3lf,%.3lf,%.6lf,%.6lf,%.6lf,%.6lf", flops, bytes,
+			flops * intersections / R->median / 1.0e9,
+			bytes * intersections / R->median / 1.0e9,
+			I->peak_bandwidth, I->peak_gflops);
+	write_phases_csv(fp, I);
+	fprintf(fp, "\n");
+}
+
+// Writes the results file - CSV if the name ends in ".csv", JSON otherwise
+void write_results( Input * I, Results * R, const char * fname )
+{
+	size_t len = strlen(fname);
+	int csv = len > 4 && strcmp(fname + len - 4, ".csv") == 0;
+
+	FILE * fp = fopen(fname, csv ? "a+" : "w");
+	if( fp == NULL )
+	{
+		fprintf(stderr, "Unable to open results file %s\n", fname);
+		return;
+	}
+
+	if( csv )
+		write_results_csv(fp, I, R);
+	else
+		write_results_json(fp, I, R);
+
+	fclose(fp);
+}
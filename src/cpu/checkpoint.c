@@ -0,0 +1,342 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Checkpoint/restart of the timed runs (-k). A checkpointed run is swept
+// in blocks of segments. Between blocks every thread has left the
+// parallel region, its tally cache is flushed and its random sequence and
+// angular flux are saved, so the state is consistent. Once the interval
+// has passed, the fine flux, thread states and progress are copied into a
+// snapshot buffer and a writer thread stores it in the background, while
+// the next block runs. If the writer is still busy with the last
+// snapshot, the checkpoint is skipped instead of stalling the sweep.
+// Files are written under a temporary name and renamed, so a killed job
+// always leaves a whole checkpoint behind.
+
+Checkpoint * init_checkpoint( Input * I )
+{
+	Checkpoint * K = (Checkpoint *) calloc(1, sizeof(Checkpoint));
+	K->fname = I->checkpoint_file;
+	K->interval = I->checkpoint_interval;
+	K->nthreads = I->nthreads;
+	K->egroups = I->egroups;
+	K->repetitions = I->repetitions;
+	K->restored_repetition = -1;
+	K->flux_count = (long) I->source_3D_regions * I->fine_axial_intervals *
+		I->egroups;
+
+	// Blocks of 1/64th of a run, but at least a few chunks per thread
+	K->block = I->segments / 64;
+	if( K->block < 4 * I->chunk_size * I->nthreads )
+		K->block = 4 * I->chunk_size * I->nthreads;
+
+	// Thread states, which the kernel threads carry between blocks
+	I->thread_state = (Thread_State *) calloc( I->nthreads,
+			sizeof(Thread_State));
+	for( int t = 0; t < I->nthreads; t++ )
+		I->thread_state[t].state_flux = (float *) malloc( I->egroups *
+				sizeof(float));
+
+	// Snapshot buffer
+	Checkpoint_Header * H = &K->header;
+	memcpy(H->magic, "SMOCCKPT", 8);
+	H->version = 1;
+	H->regions = I->source_3D_regions;
+	H->fine_axial_intervals = I->fine_axial_intervals;
+	H->egroups = I->egroups;
+	H->nthreads = I->nthreads;
+	H->repetitions = I->repetitions;
+	H->segments = I->segments;
+	K->runtimes = (double *) calloc( I->repetitions, sizeof(double));
+	K->seeds = (unsigned int *) malloc( I->nthreads * sizeof(unsigned int));
+	K->state_flux = (float *) checked_malloc( array_bytes("checkpoint",
+				I->nthreads, I->egroups, 1, sizeof(float)),
+			"checkpoint thread states");
+	K->fine_flux = (float *) checked_malloc( array_bytes("checkpoint",
+				K->flux_count, 1, 1, sizeof(float)),
+			"checkpoint fine flux");
+	K->bytes = sizeof(Checkpoint_Header) +
+		I->repetitions * sizeof(double) +
+		I->nthreads * (sizeof(unsigned int) + I->egroups * sizeof(float)) +
+		K->flux_count * sizeof(float);
+	I->nbytes += K->bytes;
+
+	pthread_mutex_init(&K->mutex, NULL);
+	pthread_cond_init(&K->wake, NULL);
+	pthread_cond_init(&K->idle, NULL);
+	if( pthread_create(&K->thread, NULL, checkpoint_thread, K) != 0 )
+	{
+		fprintf(stderr, "Unable to start the checkpoint writer\n");
+		exit(1);
+	}
+
+	K->last = get_time();
+	return K;
+}
+
+// Waits for the last snapshot to be written and stops the writer. A run
+// that completed removes its checkpoint.
+void finish_checkpoint( Checkpoint * K, int completed )
+{
+	pthread_mutex_lock(&K->mutex);
+	K->stop = 1;
+	pthread_cond_signal(&K->wake);
+	pthread_mutex_unlock(&K->mutex);
+	pthread_join(K->thread, NULL);
+
+	pthread_mutex_destroy(&K->mutex);
+	pthread_cond_destroy(&K->wake);
+	pthread_cond_destroy(&K->idle);
+	free(K->runtimes);
+	free(K->seeds);
+	free(K->state_flux);
+	free(K->fine_flux);
+
+	if( completed )
+		unlink(K->fname);
+}
+
+// Kernel thread's state to carry between blocks (NULL if not checkpointing
+// this run)
+Thread_State * thread_state( Input * I, int thread )
+{
+	if( I->thread_state == NULL || I->warmup )
+		return NULL;
+	return &I->thread_state[thread];
+}
+
+// Runs a timed run in blocks, snapshotting between them once the
+// interval has passed
+void run_checkpointed( Input * I, Source * S, Table * table )
+{
+	Checkpoint * K = I->checkpoint;
+	K->run_start = get_time();
+
+	while( K->segments_done < I->segments )
+	{
+		long n = I->segments - K->segments_done;
+		if( n > K->block )
+			n = K->block;
+
+		run_sweep(I, S, table, n);
+		K->segments_done += n;
+
+		if( K->segments_done < I->segments && get_time() - K->last >= K->interval )
+			checkpoint_snapshot(I, S);
+	}
+
+	// The next run starts from fresh thread states
+	K->segments_done = 0;
+	for( int t = 0; t < I->nthreads; t++ )
+		I->thread_state[t].valid = 0;
+}
+
+// Copies the state into the snapshot buffer and hands it to the writer.
+// Skipped if the writer hasn't finished the last one.
+void checkpoint_snapshot( Input * I, Source * S )
+{
+	Checkpoint * K = I->checkpoint;
+	double start = get_time();
+
+	pthread_mutex_lock(&K->mutex);
+	int busy = K->pending;
+	pthread_mutex_unlock(&K->mutex);
+	if( busy )
+	{
+		K->skipped++;
+		return;
+	}
+
+	Checkpoint_Header * H = &K->header;
+	H->chunk_size = I->chunk_size;
+	H->repetition = K->repetition;
+	H->done = K->segments_done;
+	H->elapsed = start - K->run_start + K->resumed;
+	memcpy(K->runtimes, K->results, K->repetition * sizeof(double));
+	for( int t = 0; t < K->nthreads; t++ )
+	{
+		K->seeds[t] = I->thread_state[t].seed;
+		memcpy(&K->state_flux[(long) t * K->egroups],
+				I->thread_state[t].state_flux, K->egroups * sizeof(float));
+	}
+	memcpy(K->fine_flux, region_fine_flux(I, S, 0),
+			K->flux_count * sizeof(float));
+
+	pthread_mutex_lock(&K->mutex);
+	K->pending = 1;
+	pthread_cond_signal(&K->wake);
+	pthread_mutex_unlock(&K->mutex);
+
+	double now = get_time();
+	K->copy_time += now - start;
+	K->last = now;
+	K->snapshots++;
+}
+
+// Writes the snapshot buffer to "<file>.tmp", syncs it and renames it
+// over the checkpoint
+void write_checkpoint( Checkpoint * K )
+{
+	char tmp[1024];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", K->fname);
+
+	FILE * fp = fopen(tmp, "wb");
+	if( fp == NULL )
+	{
+		fprintf(stderr, "Unable to write checkpoint %s\n", tmp);
+		K->failed++;
+		return;
+	}
+
+	size_t ok = fwrite(&K->header, sizeof(Checkpoint_Header), 1, fp);
+	ok &= fwrite(K->runtimes, sizeof(double), K->repetitions, fp) ==
+		(size_t) K->repetitions;
+	ok &= fwrite(K->seeds, sizeof(unsigned int), K->nthreads, fp) ==
+		(size_t) K->nthreads;
+	ok &= fwrite(K->state_flux, sizeof(float), (size_t) K->nthreads *
+			K->egroups, fp) == (size_t) K->nthreads * K->egroups;
+	ok &= fwrite(K->fine_flux, sizeof(float), K->flux_count, fp) ==
+		(size_t) K->flux_count;
+	ok &= fflush(fp) == 0 && fdatasync(fileno(fp)) == 0;
+	ok &= fclose(fp) == 0;
+
+	if( !ok || rename(tmp, K->fname) != 0 )
+	{
+		fprintf(stderr, "Unable to write checkpoint %s\n", K->fname);
+		unlink(tmp);
+		K->failed++;
+	}
+}
+
+// Body of the writer thread
+void * checkpoint_thread( void * arg )
+{
+	Checkpoint * K = (Checkpoint *) arg;
+
+	pthread_mutex_lock(&K->mutex);
+	while( 1 )
+	{
+		while( !K->pending && !K->stop )
+			pthread_cond_wait(&K->wake, &K->mutex);
+		if( !K->pending )
+			break;
+		pthread_mutex_unlock(&K->mutex);
+
+		double start = get_time();
+		write_checkpoint(K);
+		double t = get_time() - start;
+
+		pthread_mutex_lock(&K->mutex);
+		K->write_time += t;
+		K->written++;
+		K->pending = 0;
+		pthread_cond_broadcast(&K->idle);
+	}
+	pthread_mutex_unlock(&K->mutex);
+
+	return NULL;
+}
+
+// Restores the fine flux, thread states, finished runtimes and progress
+// from the checkpoint. Returns the repetition to resume (0 if there's no
+// checkpoint to resume from).
+int restore_checkpoint( Input * I, Source * S, Results * R )
+{
+	Checkpoint * K = I->checkpoint;
+	FILE * fp = fopen(K->fname, "rb");
+	if( fp == NULL )
+	{
+		if( I->rank == 0 )
+			printf("No checkpoint in %s, starting from the beginning.\n",
+					K->fname);
+		return 0;
+	}
+
+	Checkpoint_Header H;
+	if( fread(&H, sizeof(Checkpoint_Header), 1, fp) != 1 ||
+			memcmp(H.magic, "SMOCCKPT", 8) != 0 || H.version != 1 )
+	{
+		fprintf(stderr, "%s is not a checkpoint\n", K->fname);
+		exit(1);
+	}
+	if( H.regions != I->source_3D_regions ||
+			H.fine_axial_intervals != I->fine_axial_intervals ||
+			H.egroups != I->egroups || H.nthreads != I->nthreads ||
+			H.repetitions != I->repetitions || H.segments != I->segments )
+	{
+		fprintf(stderr, "Checkpoint %s is of a different problem "
+				"(regions, intervals, groups, threads, runs or segments)\n",
+				K->fname);
+		exit(1);
+	}
+
+	size_t ok = fread(R->runtimes, sizeof(double), H.repetitions, fp) ==
+		(size_t) H.repetitions;
+	ok &= fread(K->seeds, sizeof(unsigned int), H.nthreads, fp) ==
+		(size_t) H.nthreads;
+	ok &= fread(K->state_flux, sizeof(float), (size_t) H.nthreads *
+			H.egroups, fp) == (size_t) H.nthreads * H.egroups;
+	ok &= fread(region_fine_flux(I, S, 0), sizeof(float), K->flux_count,
+			fp) == (size_t) K->flux_count;
+	fclose(fp);
+	if( !ok )
+	{
+		fprintf(stderr, "Checkpoint %s is truncated\n", K->fname);
+		exit(1);
+	}
+
+	for( int t = 0; t < I->nthreads; t++ )
+	{
+		Thread_State * T = &I->thread_state[t];
+		T->seed = K->seeds[t];
+		memcpy(T->state_flux, &K->state_flux[(long) t * I->egroups],
+				I->egroups * sizeof(float));
+		T->valid = H.done > 0;
+	}
+
+	// Timed runs resume in the same blocks, with the same chunks
+	I->chunk_size = H.chunk_size;
+	K->segments_done = H.done;
+	K->resumed = H.elapsed;
+	K->restored_repetition = H.repetition;
+
+	if( I->rank == 0 )
+		printf("Resuming from %s: run %d of %d, %ld of %ld segments done.\n",
+				K->fname, H.repetition + 1, H.repetitions, H.done,
+				H.segments);
+
+	return H.repetition;
+}
+
+// Time a resumed run had spent before the checkpoint (0 for later runs)
+double checkpoint_resumed_time( Checkpoint * K )
+{
+	double t = K->resumed;
+	K->resumed = 0;
+	return t;
+}
+
+void print_checkpoint( Input * I )
+{
+	Checkpoint * K = I->checkpoint;
+	double mb = K->bytes / 1024.0 / 1024.0;
+
+	printf("%-25s%s (every %g s)\n", "Checkpoint File:", K->fname,
+			K->interval);
+	if( K->restored_repetition >= 0 )
+		printf("%-25s%s\n", "Restarted:", "yes");
+	printf("%-25s%ld written, %ld skipped (writer busy)\n", "Checkpoints:",
+			K->written, K->skipped);
+	printf("%-25s%.2lf\n", "Checkpoint Size (MB):", mb);
+	if( K->snapshots > 0 )
+		printf("%-25s%.3lf ms per checkpoint\n", "Snapshot Copy:",
+				K->copy_time / K->snapshots * 1000.);
+	if( K->written > 0 && K->write_time > 0 )
+		printf("%-25s%.3lf s per checkpoint (%.2lf MB/s)\n",
+				"Background Write:", K->write_time / K->written,
+				mb * K->written / K->write_time);
+	double kernel_time = I->phases->time[PHASE_KERNEL];
+	if( kernel_time > 0 )
+		printf("%-25s%.3lf%% of the timed runs\n", "Checkpoint Overhead:",
+				K->copy_time / kernel_time * 100.);
+	if( K->failed > 0 )
+		printf("%-25s%ld\n", "Failed Writes:", K->failed);
+}
@@ -0,0 +1,223 @@
+#include "SimpleMOC-kernel_header.h"
+
+#ifdef MPI
+
+// Sets up the axial boundary flux buffers of this rank's subdomain. Ranks
+// are stacked axially, rank 0 at the bottom.
+Domain * init_domain( Input * I )
+{
+	Domain * D = (Domain *) malloc(sizeof(Domain));
+	D->below = I->rank - 1;
+	D->above = I->rank + 1 < I->nranks ? I->rank + 1 : -1;
+	D->tracks = I->boundary_tracks;
+
+	long n = (long) D->tracks * I->egroups;
+	D->send_up = (float *) malloc( n * sizeof(float));
+	D->send_down = (float *) malloc( n * sizeof(float));
+	D->recv_up = (float *) malloc( n * sizeof(float));
+	D->recv_down = (float *) malloc( n * sizeof(float));
+	I->nbytes += 4 * n * sizeof(float);
+
+	// Outgoing fluxes of the first sweep are a random initial guess, while
+	// the outer faces of the stack are vacuum boundaries
+	for( long i = 0; i < n; i++ )
+	{
+		D->send_up[i] = (float) rand() / RAND_MAX;
+		D->send_down[i] = (float) rand() / RAND_MAX;
+		D->recv_up[i] = 0;
+		D->recv_down[i] = 0;
+	}
+
+	D->post_time = 0;
+	D->interior_time = 0;
+	D->wait_time = 0;
+	D->boundary_time = 0;
+	D->bytes_sent = 0;
+
+	return D;
+}
+
+// Starts the exchange of boundary angular fluxes with the axial
+// neighbors. Returns the number of requests posted.
+int post_exchange( Input * I, Domain * D, MPI_Request * requests )
+{
+	int n = 0;
+	int count = D->tracks * I->egroups;
+
+	// Fluxes moving up enter from the subdomain below, and fluxes moving
+	// down enter from the subdomain above
+	if( D->below >= 0 )
+	{
+		MPI_Irecv(D->recv_up, count, MPI_FLOAT, D->below, 0,
+				MPI_COMM_WORLD, &requests[n++]);
+		MPI_Isend(D->send_down, count, MPI_FLOAT, D->below, 1,
+				MPI_COMM_WORLD, &requests[n++]);
+		D->bytes_sent += count * sizeof(float);
+	}
+	if( D->above >= 0 )
+	{
+		MPI_Irecv(D->recv_down, count, MPI_FLOAT, D->above, 1,
+				MPI_COMM_WORLD, &requests[n++]);
+		MPI_Isend(D->send_up, count, MPI_FLOAT, D->above, 0,
+				MPI_COMM_WORLD, &requests[n++]);
+		D->bytes_sent += count * sizeof(float);
+	}
+
+	return n;
+}
+
+// Body of the boundary track parallel region. Each track starts from the
+// angular flux received from a neighbor, crosses every fine axial interval
+// of a random source region, and leaves its flux to be sent on to the
+// neighbor on the other side in the next sweep.
+void boundary_thread( void * args )
+{
+	Input * I = ((Kernel_Args *) args)->I;
+	Source * S = ((Kernel_Args *) args)->S;
+	Table * table = ((Kernel_Args *) args)->table;
+	Scheduler * W = ((Kernel_Args *) args)->W;
+	Domain * D = ((Kernel_Args *) args)->D;
+
+	int thread = get_thread_num();
+	unsigned int seed = thread_seed(I, thread, SWEEP_BOUNDARY);
+	int egroups = I->egroups;
+	long * progress = monitor_counter(I, thread);
+	double setup_start = get_time();
+
+	#ifdef INTEL
+	SIMD_Vectors simd_vecs = aligned_allocate_simd_vectors(I);
+	float * state_flux = (float *) _mm_malloc( egroups * sizeof(float), 64);
+	#else
+	SIMD_Vectors simd_vecs = allocate_simd_vectors(I);
+	float * state_flux = (float *) malloc( egroups * sizeof(float));
+	#endif
+	// Tracks Commit their Tallies in Order (if reproducible)
+	long * committed = &((Kernel_Args *) args)->committed;
+	unsigned long long track_stream = ((unsigned long long) I->rank << 2) | 2;
+	tally_stage_begin(I, W->chunk * I->fine_axial_intervals);
+	phase_thread_setup(I, thread, get_time() - setup_start);
+
+	// Tracks [0, tracks) move up, [tracks, 2*tracks) move down
+	long begin, end;
+	while( next_dynamic_chunk(W, &begin, &end) )
+	{
+		for( long t = begin; t < end; t++ )
+		{
+			int up = t < D->tracks;
+			long offset = (up ? t : t - D->tracks) * egroups;
+			float * in = up ? &D->recv_up[offset] : &D->recv_down[offset];
+			float * out = up ? &D->send_up[offset] : &D->send_down[offset];
+
+			memcpy(state_flux, in, egroups * sizeof(float));
+
+			int QSR_id;
+			if( I->reproducible )
+				QSR_id = (int) (counter_random(run_seed(I), track_stream, t)
+						% I->source_3D_regions);
+			else
+				QSR_id = rand_r(&seed) % I->source_3D_regions;
+			for( int f = 0; f < I->fine_axial_intervals; f++ )
+			{
+				int FAI_id = up ? f : I->fine_axial_intervals - 1 - f;
+				attenuate_segment( I, S, QSR_id, FAI_id, state_flux,
+						&simd_vecs, table);
+			}
+
+			memcpy(out, state_flux, egroups * sizeof(float));
+		}
+
+		if( I->reproducible )
+			tally_stage_commit( I, S, tally_stage, committed,
+					begin / W->chunk );
+
+		if( progress != NULL )
+			monitor_add(progress, (end - begin) * I->fine_axial_intervals);
+	}
+
+	tally_stage_end();
+	free_simd_vectors(&simd_vecs);
+	#ifdef INTEL
+	_mm_free(state_flux);
+	#else
+	free(state_flux);
+	#endif
+}
+
+// Runs the sweeps of an axially decomposed problem. In each sweep the
+// boundary fluxes from the last sweep are exchanged while the interior
+// segments are attenuated, then the boundary tracks are attenuated with
+// the fluxes just received.
+void run_decomposed( Input * I, Source * S, Table * table, Domain * D )
+{
+	MPI_Request requests[4];
+
+	for( int sweep = 0; sweep < I->sweeps; sweep++ )
+	{
+		long segments = I->segments / I->sweeps;
+		if( sweep == I->sweeps - 1 )
+			segments = I->segments - segments * (I->sweeps - 1);
+
+		double t0 = get_time();
+		int n_requests = post_exchange(I, D, requests);
+
+		double t1 = get_time();
+		run_sweep(I, S, table, segments);
+
+		double t2 = get_time();
+		MPI_Waitall(n_requests, requests, MPI_STATUSES_IGNORE);
+
+		double t3 = get_time();
+		Kernel_Args args;
+		args.I = I;
+		args.S = S;
+		args.table = table;
+		args.D = D;
+		args.segments = 2L * D->tracks;
+		args.committed = 0;
+		args.W = init_scheduler( SCHED_DYNAMIC, args.segments, I->nthreads,
+				16 );
+		parallel_region( boundary_thread, &args );
+		free_scheduler(args.W);
+
+		double t4 = get_time();
+		D->post_time += t1 - t0;
+		D->interior_time += t2 - t1;
+		D->wait_time += t3 - t2;
+		D->boundary_time += t4 - t3;
+	}
+}
+
+// Gathers the compute/communication split from all ranks and prints it
+void print_domain_summary( Input * I, Domain * D )
+{
+	double local[4] = { D->interior_time, D->boundary_time,
+		D->post_time, D->wait_time };
+	double max[4], sum[4];
+	long bytes;
+
+	MPI_Reduce(local, max, 4, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	MPI_Reduce(local, sum, 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&D->bytes_sent, &bytes, 1, MPI_LONG, MPI_SUM, 0,
+			MPI_COMM_WORLD);
+
+	if( I->rank != 0 )
+		return;
+
+	const char * names[4] = { "Interior Compute:", "Boundary Compute:",
+		"Exchange Posting:", "Exchange Wait:" };
+	double total = sum[0] + sum[1] + sum[2] + sum[3];
+
+	border_print();
+	center_print("DOMAIN DECOMPOSITION", 79);
+	border_print();
+	printf("%-25s%d\n", "Axial Subdomains:", I->nranks);
+	printf("%-25s%.2f\n", "Data Exchanged (MB):", bytes/1024.0/1024.0);
+	printf("%-25s%-12s%-12s%s\n", "", "Avg (s)", "Max (s)", "Share");
+	for( int i = 0; i < 4; i++ )
+		printf("%-25s%-12.4lf%-12.4lf%.1lf%%\n", names[i],
+				sum[i] / I->nranks, max[i], sum[i] / total * 100.);
+	printf("%-25s%.1lf%%\n", "Communication Share:",
+			(sum[2] + sum[3]) / total * 100.);
+}
+
+#endif
@@ -0,0 +1,527 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Ray tracing front end (-G). In place of random segments, the kernel
+// sweeps real tracks: a square lattice of pin cells, each split into fuel
+// rings and sectors (the 2D source regions), is covered by tracks laid
+// down cyclically - the angles are corrected so that tracks leaving one
+// side of the lattice line up with tracks entering on the opposite side.
+// Each track is ray traced cell by cell into segments with real lengths,
+// and swept through every axial plane of the subdomain (each 2D region of
+// an axial layer, at each fine axial interval). By default every sweep
+// traces its tracks on the fly, into a small per-thread buffer; "-Y"
+// traces them once into a store and attenuates the stored segments.
+// After the timed runs, a sweep of tracing alone and a sweep in each mode
+// are timed to see whether on-the-fly ray tracing beats storing segments.
+// With polar angles (-V), the tracks are stacked into 3D tracks instead
+// (axial.c).
+
+// Pin cell dimensions of a typical PWR lattice (cm)
+static const double pin_pitch = 1.26;
+static const double fuel_radius = 0.54;
+
+// Shortest sub-segment kept - shorter ones are crossings of coincident
+// surfaces
+static const double min_length = 1.0e-9;
+
+Geometry * init_geometry( Input * I )
+{
+	Geometry * G = (Geometry *) calloc(1, sizeof(Geometry));
+	Lattice * L = &G->L;
+
+	L->pins = I->lattice_pins;
+	L->rings = I->lattice_rings;
+	L->sectors = I->lattice_sectors;
+	L->pitch = pin_pitch;
+	L->width = L->pins * L->pitch;
+	L->regions_per_pin = (L->rings + 1) * L->sectors;
+
+	// Equal area rings of the fuel
+	L->ring_r2 = (double *) malloc( L->rings * sizeof(double));
+	for( int r = 0; r < L->rings; r++ )
+		L->ring_r2[r] = fuel_radius * fuel_radius * (r + 1) / L->rings;
+
+	// Every plane of the subdomain sweeps the 2D regions of one axial layer
+	// at one fine axial interval
+	G->layers = I->source_3D_regions / I->source_2D_regions;
+	if( G->layers < 1 )
+	{
+		fprintf(stderr, "Ray tracing needs a whole axial layer of 2D "
+				"regions per subdomain (%d 3D regions for %d 2D regions)\n",
+				I->source_3D_regions, I->source_2D_regions);
+		exit(1);
+	}
+	G->planes = G->layers * I->fine_axial_intervals;
+
+	G->n_azim = I->azimuthal_angles;
+	G->spacing = I->track_spacing;
+	G->stored = I->store_segments;
+	lay_down_tracks(G);
+	count_segments(I, G);
+
+	if( I->polar_angles > 0 )
+		init_axial(I, G);
+	else if( G->stored )
+		store_segments(G);
+
+	return G;
+}
+
+// Lays down tracks cyclically over (0, pi). Each angle is corrected so a
+// whole number of tracks cross each side, at the same spacing along x
+// (nx tracks) and along y (ny tracks).
+void lay_down_tracks( Geometry * G )
+{
+	Lattice * L = &G->L;
+	double W = L->width;
+	int n_half = G->n_azim / 2;
+
+	int n = 0;
+	int * nx = (int *) malloc( n_half * sizeof(int));
+	int * ny = (int *) malloc( n_half * sizeof(int));
+	for( int a = 0; a < n_half; a++ )
+	{
+		double phi = M_PI / n_half * (a + 0.5);
+		nx[a] = (int) (W / G->spacing * fabs(sin(phi))) + 1;
+		ny[a] = (int) (W / G->spacing * fabs(cos(phi))) + 1;
+		n += nx[a] + ny[a];
+	}
+
+	G->tracks = (Track *) malloc( n * sizeof(Track));
+	G->n_tracks = n;
+	G->mean_spacing = 0;
+
+	n = 0;
+	for( int a = 0; a < n_half; a++ )
+	{
+		double phi = atan((double) nx[a] / ny[a]);
+		if( a >= n_half / 2 )
+			phi = M_PI - phi;
+		double dx = W / nx[a];
+		double dy = W / ny[a];
+		G->mean_spacing += dx * sin(phi) / n_half;
+
+		// Tracks starting on the bottom side
+		for( int i = 0; i < nx[a]; i++ )
+		{
+			G->tracks[n].x = dx * (i + 0.5);
+			G->tracks[n].y = 0;
+			G->tracks[n++].phi = phi;
+		}
+
+		// Tracks starting on the left side (right, if heading left)
+		for( int j = 0; j < ny[a]; j++ )
+		{
+			G->tracks[n].x = phi < M_PI / 2 ? 0 : W;
+			G->tracks[n].y = dy * (j + 0.5);
+			G->tracks[n++].phi = phi;
+		}
+	}
+
+	// Distance to the side each track leaves by
+	for( int t = 0; t < G->n_tracks; t++ )
+	{
+		Track * T = &G->tracks[t];
+		double ux = cos(T->phi);
+		double uy = sin(T->phi);
+		double tx = ux > 0 ? (W - T->x) / ux : ux < 0 ? -T->x / ux : INFINITY;
+		double ty = (W - T->y) / uy;
+		T->length = tx < ty ? tx : ty;
+	}
+
+	free(nx);
+	free(ny);
+}
+
+// Traces the part [t0, t1] of a track inside pin cell (cx, cy). Every ring
+// and sector boundary crossed splits the part; the region of each piece is
+// found at its midpoint. Returns the number of segments written.
+int trace_cell( Lattice * L, int cx, int cy, Track * T, double t0,
+		double t1, Segment_2D * out )
+{
+	double ux = cos(T->phi);
+	double uy = sin(T->phi);
+
+	// Track start, relative to the pin center
+	double px = T->x - (cx + 0.5) * L->pitch;
+	double py = T->y - (cy + 0.5) * L->pitch;
+
+	// Crossings of the ring circles and the sector lines
+	double cuts[2 * L->rings + L->sectors + 2];
+	int n = 0;
+	cuts[n++] = t0;
+	cuts[n++] = t1;
+
+	double b = px * ux + py * uy;
+	for( int r = 0; r < L->rings; r++ )
+	{
+		double disc = b * b - (px * px + py * py - L->ring_r2[r]);
+		if( disc <= 0 )
+			continue;
+		double root = sqrt(disc);
+		if( -b - root > t0 && -b - root < t1 )
+			cuts[n++] = -b - root;
+		if( -b + root > t0 && -b + root < t1 )
+			cuts[n++] = -b + root;
+	}
+
+	for( int s = 0; s < L->sectors; s++ )
+	{
+		double theta = 2 * M_PI * s / L->sectors;
+		double vx = cos(theta);
+		double vy = sin(theta);
+		double denom = ux * vy - uy * vx;
+		if( fabs(denom) < 1.0e-12 )
+			continue;
+		double t = (py * vx - px * vy) / denom;
+		if( t > t0 && t < t1 )
+			cuts[n++] = t;
+	}
+
+	// Sort the crossings (there are only a few)
+	for( int i = 1; i < n; i++ )
+	{
+		double c = cuts[i];
+		int j = i - 1;
+		for( ; j >= 0 && cuts[j] > c; j-- )
+			cuts[j+1] = cuts[j];
+		cuts[j+1] = c;
+	}
+
+	int pin = cy * L->pins + cx;
+	int written = 0;
+	for( int i = 0; i < n - 1; i++ )
+	{
+		double length = cuts[i+1] - cuts[i];
+		if( length < min_length )
+			continue;
+
+		double mid = 0.5 * (cuts[i] + cuts[i+1]);
+		double mx = px + mid * ux;
+		double my = py + mid * uy;
+		double r2 = mx * mx + my * my;
+
+		int ring = 0;
+		while( ring < L->rings && r2 >= L->ring_r2[ring] )
+			ring++;
+
+		double angle = atan2(my, mx);
+		if( angle < 0 )
+			angle += 2 * M_PI;
+		int sector = (int) (angle / (2 * M_PI) * L->sectors);
+		if( sector >= L->sectors )
+			sector = L->sectors - 1;
+
+		int region = pin * L->regions_per_pin + ring * L->sectors + sector;
+
+		// A sector line that isn't a boundary on this side of the center
+		// splits a region in two - join the pieces back up
+		if( written > 0 && out[written-1].region == region )
+			out[written-1].length += (float) length;
+		else
+		{
+			out[written].region = region;
+			out[written].length = (float) length;
+			written++;
+		}
+	}
+
+	return written;
+}
+
+// Traces a track through the lattice, cell by cell. Returns the number of
+// segments written.
+int trace_track( Geometry * G, Track * T, Segment_2D * out )
+{
+	Lattice * L = &G->L;
+	double ux = cos(T->phi);
+	double uy = sin(T->phi);
+
+	int cx = (int) floor(T->x / L->pitch);
+	int cy = (int) floor(T->y / L->pitch);
+	if( cx > L->pins - 1 )
+		cx = L->pins - 1;
+	if( cy > L->pins - 1 )
+		cy = L->pins - 1;
+
+	int n = 0;
+	double t = 0;
+	while( t < T->length && cx >= 0 && cx < L->pins && cy < L->pins )
+	{
+		// Distances to the cell's x and y sides
+		double tx = ux > 0 ? ((cx + 1) * L->pitch - T->x) / ux :
+			ux < 0 ? (cx * L->pitch - T->x) / ux : INFINITY;
+		double ty = ((cy + 1) * L->pitch - T->y) / uy;
+		double t_exit = tx < ty ? tx : ty;
+		if( t_exit > T->length )
+			t_exit = T->length;
+
+		if( t_exit > t )
+			n += trace_cell(L, cx, cy, T, t, t_exit, out + n);
+		t = t_exit;
+
+		// Step into the next cell (both ways, through a corner)
+		if( tx <= ty + min_length )
+			cx += ux > 0 ? 1 : -1;
+		if( ty <= tx + min_length )
+			cy++;
+	}
+
+	return n;
+}
+
+// Traces every track once, to size the per-thread buffers and count the
+// segments of a sweep
+void count_segments( Input * I, Geometry * G )
+{
+	Lattice * L = &G->L;
+
+	// Bound on the segments of any track - it crosses at most 2 pins per
+	// pin pitch of its length, each split by at most every boundary
+	long bound = (long) (2 * L->pins + 2) * (2 * L->rings + L->sectors + 1);
+	Segment_2D * buffer = (Segment_2D *) malloc( bound * sizeof(Segment_2D));
+
+	G->segments = 0;
+	G->max_segments = 0;
+	G->total_length = 0;
+	for( int t = 0; t < G->n_tracks; t++ )
+	{
+		int n = trace_track(G, &G->tracks[t], buffer);
+		G->segments += n;
+		if( n > G->max_segments )
+			G->max_segments = n;
+		for( int s = 0; s < n; s++ )
+			G->total_length += buffer[s].length;
+	}
+	free(buffer);
+
+	// Every timed run sweeps every track through every plane
+	I->segments = G->segments * G->planes;
+}
+
+// Traces every track into the store
+void store_segments( Geometry * G )
+{
+	double start = get_time();
+
+	G->store = (Segment_2D *) checked_malloc( array_bytes("segment store",
+				G->segments, 1, 1, sizeof(Segment_2D)), "segment store");
+	G->offsets = (long *) malloc( (G->n_tracks + 1) * sizeof(long));
+
+	G->offsets[0] = 0;
+	for( int t = 0; t < G->n_tracks; t++ )
+		G->offsets[t+1] = G->offsets[t] + trace_track(G, &G->tracks[t],
+				G->store + G->offsets[t]);
+
+	G->store_time = get_time() - start;
+}
+
+// Sweeps all tracks across all threads, one track at a time
+void run_geometry_sweep( Input * I, Source * S, Table * table )
+{
+	Kernel_Args args;
+	args.I = I;
+	args.S = S;
+	args.table = table;
+	args.segments = I->segments;
+	args.committed = 0;
+	args.first_region = 0;
+	args.regions = I->source_3D_regions;
+	args.W = init_scheduler( I->scheduler, I->geometry->n_tracks,
+			I->nthreads, 1 );
+
+	parallel_region( kernel_thread, &args );
+
+	I->steals = total_steals(args.W);
+	free_scheduler(args.W);
+}
+
+// Body of a kernel thread's sweep of the tracks. Each track is traced (or
+// looked up in the store) once, then attenuated through every plane - or
+// its 3D tracks are made and attenuated, if stacking them.
+void run_tracks( Input * I, Source * S, Table * table, Scheduler * W,
+		int thread, unsigned int * seed, float * state_flux,
+		SIMD_Vectors * simd_vecs, long * progress )
+{
+	Geometry * G = I->geometry;
+	Segment_2D * buffer = NULL;
+	SimpleMOC_Segment * buffer_3D = NULL;
+	if( !G->stored )
+		buffer = (Segment_2D *) malloc( G->max_segments *
+				sizeof(Segment_2D));
+	if( !G->stored && G->n_polar > 0 )
+		buffer_3D = (SimpleMOC_Segment *) malloc( G->max_segments_3D *
+				sizeof(SimpleMOC_Segment));
+
+	long begin, end;
+	while( next_chunk(W, thread, seed, &begin, &end) )
+	{
+		for( long t = begin; t < end; t++ )
+		{
+			// Stored 3D segments, or 3D segments made from the 2D ones
+			if( G->n_polar > 0 )
+			{
+				long swept;
+				if( G->stored )
+				{
+					attenuate_track( I, S, table, G->store_3D,
+							G->offsets_3D[t], G->offsets_3D[t+1], state_flux,
+							simd_vecs );
+					swept = G->offsets_3D[t+1] - G->offsets_3D[t];
+				}
+				else
+				{
+					int n = trace_track(G, &G->tracks[t], buffer);
+					swept = sweep_axial( I, S, table, &G->tracks[t], buffer,
+							n, buffer_3D, state_flux, simd_vecs );
+				}
+
+				if( progress != NULL )
+					monitor_add(progress, swept);
+				continue;
+			}
+
+			Segment_2D * segments;
+			int n;
+			if( G->stored )
+			{
+				segments = G->store + G->offsets[t];
+				n = (int) (G->offsets[t+1] - G->offsets[t]);
+			}
+			else
+			{
+				segments = buffer;
+				n = trace_track(G, &G->tracks[t], buffer);
+			}
+
+			for( int p = 0; p < G->planes; p++ )
+			{
+				int layer = p / I->fine_axial_intervals;
+				int FAI_id = p % I->fine_axial_intervals;
+				int first = (int) (layer * I->source_2D_regions);
+
+				for( int s = 0; s < n; s++ )
+				{
+					simd_vecs->ds = segments[s].length;
+					attenuate_segment( I, S, first + segments[s].region,
+							FAI_id, state_flux, simd_vecs, table );
+				}
+			}
+
+			if( progress != NULL )
+				monitor_add(progress, (long) n * G->planes);
+		}
+	}
+
+	free(buffer);
+	free(buffer_3D);
+}
+
+// Body of the tracing-only sweep - traces the thread's share of the tracks
+// once each (and makes their 3D tracks, if stacking them), as the
+// on-the-fly sweep does, without attenuating
+void trace_thread( void * args )
+{
+	Input * I = (Input *) args;
+	Geometry * G = I->geometry;
+	int thread = get_thread_num();
+	int nthreads = get_num_threads();
+
+	Segment_2D * buffer = (Segment_2D *) malloc( G->max_segments *
+			sizeof(Segment_2D));
+	SimpleMOC_Segment * buffer_3D = NULL;
+	if( G->n_polar > 0 )
+		buffer_3D = (SimpleMOC_Segment *) malloc( G->max_segments_3D *
+				sizeof(SimpleMOC_Segment));
+
+	long segments = 0;
+	for( int t = thread; t < G->n_tracks; t += nthreads )
+	{
+		Track * T = &G->tracks[t];
+		int n = trace_track(G, T, buffer);
+		segments += n;
+
+		for( int p = 0; p < G->n_polar; p++ )
+		{
+			double z0, dz;
+			int stack = axial_stack(G, T, p, &z0, &dz);
+			for( int k = 0; k < stack; k++ )
+				segments += trace_axial(I, G, buffer, n, p, z0 + k * dz,
+						buffer_3D);
+		}
+	}
+	free(buffer);
+	free(buffer_3D);
+
+	// Keep the tracing from being optimized away
+	if( segments < 0 )
+		printf("%ld\n", segments);
+}
+
+double time_tracing( Input * I )
+{
+	double start = get_time();
+	parallel_region( trace_thread, I );
+	return get_time() - start;
+}
+
+// Times a sweep of tracing only, a sweep tracing on the fly and a sweep of
+// stored segments (storing them first, if the timed runs didn't)
+void compare_tracking( Input * I, Source * S, Table * table )
+{
+	Geometry * G = I->geometry;
+	int stored = G->stored;
+
+	if( G->n_polar > 0 && G->store_3D == NULL )
+		store_axial_segments(I, G);
+	else if( G->n_polar == 0 && G->store == NULL )
+		store_segments(G);
+
+	I->warmup = 1;
+	G->trace_time = time_tracing(I);
+
+	G->stored = 0;
+	double start = get_time();
+	run_geometry_sweep(I, S, table);
+	G->otf_time = get_time() - start;
+
+	G->stored = 1;
+	start = get_time();
+	run_geometry_sweep(I, S, table);
+	G->stored_time = get_time() - start;
+
+	G->stored = stored;
+	I->warmup = 0;
+}
+
+void print_tracking( Input * I )
+{
+	Geometry * G = I->geometry;
+	Lattice * L = &G->L;
+	double segments = (double) G->segments * G->planes;
+	double mb = G->segments * sizeof(Segment_2D) / 1024.0 / 1024.0;
+
+	printf("%-25s%dx%d pins, %d rings, %d sectors (%.2lf cm pitch)\n",
+			"Lattice:", L->pins, L->pins, L->rings, L->sectors, L->pitch);
+	printf("%-25s%d (%d angles, %.4lf cm spacing)\n", "2D Tracks:",
+			G->n_tracks, G->n_azim, G->mean_spacing);
+	printf("%-25s%d (%d layers x %d fine intervals)\n", "Axial Planes:",
+			G->planes, G->layers, I->fine_axial_intervals);
+	printf("%-25s%ld %s, %.4lf cm mean length\n", "2D Segments:",
+			G->segments, G->n_polar > 0 ? "over all tracks" : "per plane",
+			G->total_length / G->segments);
+	if( G->n_polar > 0 )
+	{
+		print_axial(I);
+		return;
+	}
+	printf("%-25s%.6lf s (%.3lf ns per 2D segment)\n", "Tracing Only:",
+			G->trace_time, G->trace_time / G->segments * 1.0e9);
+	printf("%-25s%.6lf s (%.3lf ns per segment)\n", "Attenuation:",
+			G->stored_time, G->stored_time / segments * 1.0e9);
+	printf("%-25s%.6lf s per sweep\n", "On-the-Fly Sweep:", G->otf_time);
+	printf("%-25s%.6lf s per sweep (+%.2lf MB, stored in %.6lf s)\n",
+			"Stored Sweep:", G->stored_time, mb, G->store_time);
+	printf("%-25s%s by %.2lf%%\n", "Faster Per Sweep:",
+			G->otf_time < G->stored_time ? "on the fly" : "stored",
+			fabs(G->otf_time / G->stored_time - 1.0) * 100.);
+}
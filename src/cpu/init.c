@@ -11,6 +11,84 @@ Input * set_default_input( void )
 	I->decomp_assemblies_ax = 20; // Number of subdomains per assembly axially
 	I->segments = 50000000;
 	I->egroups = 128;
+	I->tile_size = -1;
+	I->scheduler = SCHED_DYNAMIC;
+	I->chunk_size = 100;
+	I->warmup = 0;
+	I->steals = 0;
+	I->affinity = AFFINITY_NONE;
+	I->cpu_list = NULL;
+	I->n_cpu_list = 0;
+	I->thread_cpus = NULL;
+	I->rank = 0;
+	I->nranks = 1;
+	I->sweeps = 10;
+	I->boundary_tracks = 1000;
+	I->warmup_runs = 0;
+	I->repetitions = 1;
+	I->results_file = NULL;
+	I->scaling = NULL;
+	I->probe = 0;
+	I->peak_bandwidth = 0;
+	I->peak_gflops = 0;
+	I->monitor_interval = 0;
+	I->monitor_file = NULL;
+	I->monitor = NULL;
+	I->seed = -1;
+	I->baseline = NULL;
+	I->threshold = 5.0;
+	I->phases = init_phases();
+	I->tally_cache_lines = 0;
+	I->tally_hits = 0;
+	I->tally_misses = 0;
+	I->tally_writebacks = 0;
+	I->tally_updates = 0;
+	I->lattice_pins = 0;
+	I->lattice_rings = 3;
+	I->lattice_sectors = 8;
+	I->azimuthal_angles = 16;
+	I->track_spacing = 0.1;
+	I->store_segments = 0;
+	I->polar_angles = 0;
+	I->axial_spacing = 0.5;
+	I->geometry = NULL;
+	I->pipeline_depth = 0;
+	I->pipeline_tally_depth = 0;
+	for( int s = 0; s < PIPE_STAGES; s++ )
+	{
+		I->pipe_time[s] = 0;
+		I->pipe_batches[s] = 0;
+	}
+	I->pipe_depth[0] = 0;
+	I->pipe_depth[1] = 0;
+	I->pipe_backpressure = 0;
+	I->pipe_segments = 0;
+	I->reproducible = 0;
+	I->flux_checksum = 0;
+	I->locked_runtime = 0;
+	I->backing_file = NULL;
+	I->window_regions = 0;
+	I->ooc = NULL;
+	I->checkpoint_file = NULL;
+	I->checkpoint_interval = 10;
+	I->restart = 0;
+	I->checkpoint = NULL;
+	I->thread_state = NULL;
+	#ifdef COMPACT
+	I->lock_stripes = 4096;
+	#endif
+
+	#ifdef INSTRUMENT
+	I->stats = NULL;
+	#endif
+
+	#ifdef PERF
+	I->perf_groups[0] = PERF_GROUP_FLOPS;
+	I->n_perf_groups = 1;
+	I->perf_multiplex = 0;
+	I->perf_active = 0;
+	I->perf = NULL;
+	#endif
 
 	#ifdef PAPI
 	I->papi_event_set = 0;
@@ -18,65 +96,235 @@ Input * set_default_input( void )
 
 	#ifdef OPENMP
 	I->nthreads = omp_get_max_threads();
+	#elif defined PTHREADS
+	I->nthreads = get_num_procs();
+	#else
+	I->nthreads = 1;
 	#endif
 
 	return I;
 }
 
+// Number of 3D source regions in each axial subdomain
+int count_3D_regions( Input * I )
+{
+	double regions = ceil((double) I->source_2D_regions *
+			I->coarse_axial_intervals / I->decomp_assemblies_ax);
+	if( regions > INT_MAX )
+	{
+		fprintf(stderr, "%.0lf 3D source regions is more than the %d "
+				"supported\n", regions, INT_MAX);
+		exit(1);
+	}
+	return (int) regions;
+}
+
+// Bytes of an array of n1 * n2 * n3 elements. Exits if that overflows.
+size_t array_bytes( const char * name, long n1, long n2, long n3,
+		size_t size )
+{
+	size_t bytes;
+	if( n1 < 0 || n2 < 0 || n3 < 0 ||
+			__builtin_mul_overflow((size_t) n1, (size_t) n2, &bytes) ||
+			__builtin_mul_overflow(bytes, (size_t) n3, &bytes) ||
+			__builtin_mul_overflow(bytes, size, &bytes) )
+	{
+		fprintf(stderr, "Size of the %s overflows (%ld x %ld x %ld)\n",
+				name, n1, n2, n3);
+		exit(1);
+	}
+	return bytes;
+}
+
+// Whether checked_malloc exits when out of memory. The library turns it
+// off while it builds a problem, so the failure comes back as NULL.
+static __thread int malloc_exits = 1;
+
+void set_malloc_exits( int exits )
+{
+	malloc_exits = exits;
+}
+
+// malloc that exits, saying how much was asked for, when out of memory
+// (or returns NULL, if set_malloc_exits(0) was called)
+void * checked_malloc( size_t bytes, const char * name )
+{
+	void * ptr = malloc(bytes);
+	if( ptr == NULL && bytes > 0 )
+	{
+		fprintf(stderr, "Unable to allocate %.2lf GB for the %s\n",
+				bytes / 1024.0 / 1024.0 / 1024.0, name);
+		if( malloc_exits )
+			exit(1);
+	}
+	return ptr;
+}
+
 Source * initialize_sources( Input * I )
 {
 	I->nbytes = 0;
+	phase_begin(I, PHASE_ALLOCATION);
 
-	// Source Data Structure Allocation
-	Source * sources = (Source *) malloc( I->source_3D_regions * sizeof(Source));
-	I->nbytes += I->source_3D_regions * sizeof(Source);
-
-	// Allocate Fine Source Data
-	float * data = (float *) malloc(
-			I->source_3D_regions * I->fine_axial_intervals *
-			I->egroups * sizeof(float));
-	I->nbytes += I->source_3D_regions * I->fine_axial_intervals * I->egroups * sizeof(float);
-	for( int i = 0; i < I->source_3D_regions; i++ )
-		sources[i].fine_source = &data[i*I->fine_axial_intervals*I->egroups];
-
-	// Allocate Fine Flux Data
-	data = (float *) malloc(
-			I->source_3D_regions * I->fine_axial_intervals *
-			I->egroups * sizeof(float));
-	I->nbytes += I->source_3D_regions * I->fine_axial_intervals * I->egroups * sizeof(float);
-	for( int i = 0; i < I->source_3D_regions; i++ )
-		sources[i].fine_flux = &data[i*I->fine_axial_intervals*I->egroups];
-
-	// Allocate SigT
-	data = (float *) malloc( I->source_3D_regions * I->egroups * sizeof(float));
-	I->nbytes += I->source_3D_regions * I->egroups * sizeof(float);
-	for( int i = 0; i < I->source_3D_regions; i++ )
-		sources[i].sigT = &data[i * I->egroups];
-
-	// Allocate Locks
-	#ifdef OPENMP
-	omp_lock_t * locks = init_locks(I);
+	// Elements per region of each array
+	long region_flux = (long) I->fine_axial_intervals * I->egroups;
+	size_t flux_bytes = array_bytes("fine source data", I->source_3D_regions,
+			I->fine_axial_intervals, I->egroups, sizeof(float));
+	size_t sigT_bytes = array_bytes("cross section data", I->source_3D_regions,
+			I->egroups, 1, sizeof(float));
+
+	// Source Data Structure Allocation (just one in the compact layout)
+	#ifdef COMPACT
+	Source * sources = (Source *) checked_malloc( sizeof(Source),
+			"source structure");
+	I->nbytes += sizeof(Source);
+	#else
+	size_t source_bytes = array_bytes("source structures",
+			I->source_3D_regions, 1, 1, sizeof(Source));
+	Source * sources = (Source *) checked_malloc( source_bytes,
+			"source structures");
+	I->nbytes += source_bytes;
+	#endif
+	if( sources == NULL )
+	{
+		phase_end(I, PHASE_ALLOCATION);
+		return NULL;
+	}
+
+	// Out of Core, Source Data Lives in a Backing File (-F)
+	#ifdef COMPACT
+	sources->first_region = 0;
+	#endif
+	if( I->backing_file != NULL )
+		I->ooc = open_out_of_core(I);
+	else
+	{
+		// Allocate Fine Source, Fine Flux and SigT Data
+		float * fine_source = (float *) checked_malloc( flux_bytes,
+				"fine sources");
+		float * fine_flux = (float *) checked_malloc( flux_bytes,
+				"fine fluxes");
+		float * sigT = (float *) checked_malloc( sigT_bytes,
+				"cross sections");
+		if( fine_source == NULL || fine_flux == NULL || sigT == NULL )
+		{
+			free(fine_source);
+			free(fine_flux);
+			free(sigT);
+			free(sources);
+			phase_end(I, PHASE_ALLOCATION);
+			return NULL;
+		}
+		I->nbytes += 2 * flux_bytes + sigT_bytes;
+
+		#ifdef COMPACT
+		sources->fine_source = fine_source;
+		sources->fine_flux = fine_flux;
+		sources->sigT = sigT;
+		#else
+		for( int i = 0; i < I->source_3D_regions; i++ )
+		{
+			sources[i].fine_source = &fine_source[i * region_flux];
+			sources[i].fine_flux = &fine_flux[i * region_flux];
+			sources[i].sigT = &sigT[(long) i * I->egroups];
+		}
+		#endif
+	}
+
+	phase_end(I, PHASE_ALLOCATION);
+
+	// Allocate Locks (or lock stripes)
+	#ifdef MULTITHREADED
+	phase_begin(I, PHASE_LOCKS);
+	#ifdef COMPACT
+	Lock_Stripe * locks = init_lock_stripes(I);
+	#else
+	Lock * locks = init_locks(I);
+	#endif
+	if( locks == NULL )
+	{
+		if( I->ooc != NULL )
+			close_out_of_core(I->ooc);
+		else
+		{
+			free(sources[0].fine_source);
+			free(sources[0].fine_flux);
+			free(sources[0].sigT);
+		}
+		free(sources);
+		phase_end(I, PHASE_LOCKS);
+		return NULL;
+	}
+	#ifdef COMPACT
+	sources->stripes = locks;
+	#else
 	for( int i = 0; i < I->source_3D_regions; i++)
-		sources[i].locks = &locks[i * I->fine_axial_intervals];
+		sources[i].locks = &locks[(long) i * I->fine_axial_intervals];
+	#endif
+	phase_end(I, PHASE_LOCKS);
 	#endif
 
-	// Initialize fine source and flux to random numbers
-	for( int i = 0; i < I->source_3D_regions; i++ )
-		for( int j = 0; j < I->fine_axial_intervals; j++ )
-			for( int k = 0; k < I->egroups; k++ )
+	phase_begin(I, PHASE_FILL);
+
+	// The fill has its own random state, so it neither depends on nor
+	// disturbs rand() of the caller (the library builds sources too)
+	unsigned int seed = run_seed(I) + I->rank;
+
+	// Fill the backing file a window at a time (out of core)
+	if( I->ooc != NULL )
+		fill_out_of_core(I, I->ooc, &seed);
+	else
+	{
+		// Initialize fine source and flux to random numbers
+		for( int i = 0; i < I->source_3D_regions; i++ )
+		{
+			float * fine_source = region_fine_source(I, sources, i);
+			float * fine_flux = region_fine_flux(I, sources, i);
+			for( long j = 0; j < region_flux; j++ )
 			{
-				sources[i].fine_source[j * I->egroups + k] = (float) rand() / RAND_MAX;
-				sources[i].fine_flux[j * I->egroups + k] = (float) rand() / RAND_MAX;
+				fine_source[j] = (float) rand_r(&seed) / RAND_MAX;
+				fine_flux[j] = (float) rand_r(&seed) / RAND_MAX;
 			}
+		}
+
+		// Initialize SigT Values
+		for( int i = 0; i < I->source_3D_regions; i++ )
+		{
+			float * sigT = region_sigT(I, sources, i);
+			for( int j = 0; j < I->egroups; j++ )
+				sigT[j] = (float) rand_r(&seed) / RAND_MAX;
+		}
+	}
 
-	// Initialize SigT Values
-	for( int i = 0; i < I->source_3D_regions; i++ )
-		for( int j = 0; j < I->egroups; j++ )
-			sources[i].sigT[j] = (float) rand() / RAND_MAX;
+	phase_end(I, PHASE_FILL);
 
 	return sources;
 }
 
+void free_sources( Input * I, Source * S )
+{
+	// Each array is one allocation, starting at the first region (or the
+	// window slots and backing file, if out of core)
+	if( I->ooc != NULL )
+		close_out_of_core(I->ooc);
+	else
+	{
+		free(S[0].fine_source);
+		free(S[0].fine_flux);
+		free(S[0].sigT);
+	}
+	#if defined MULTITHREADED && defined COMPACT
+	for( int i = 0; i < I->lock_stripes; i++ )
+		destroy_lock(&S[0].stripes[i].lock);
+	free(S[0].stripes);
+	#elif defined MULTITHREADED
+	long n_locks = (long) I->source_3D_regions * I->fine_axial_intervals;
+	for( long i = 0; i < n_locks; i++ )
+		destroy_lock(&S[0].locks[i]);
+	free(S[0].locks);
+	#endif
+	free(S);
+}
+
 // Builds a table of exponential values for linear interpolation
 Table * buildExponentialTable( float precision, float maxVal, Input * I )
 {
@@ -116,6 +364,16 @@ Table * buildExponentialTable( float precision, float maxVal, Input * I )
 	return table;
 }
 
+void free_table( Table * table )
+{
+	#ifdef INTEL
+	_mm_free(table->values);
+	#else
+	free(table->values);
+	#endif
+	free(table);
+}
+
 #ifdef INTEL
 SIMD_Vectors aligned_allocate_simd_vectors(Input * I)
 {
@@ -134,6 +392,7 @@ SIMD_Vectors aligned_allocate_simd_vectors(Input * I)
 	A.t2 = (float *) _mm_malloc(I->egroups * sizeof(float), 64);
 	A.t3 = (float *) _mm_malloc(I->egroups * sizeof(float), 64);
 	A.t4 = (float *) _mm_malloc(I->egroups * sizeof(float), 64);
+	default_segment_geometry(&A);
 	return A;
 }
 #endif
@@ -141,7 +400,8 @@ SIMD_Vectors aligned_allocate_simd_vectors(Input * I)
 SIMD_Vectors allocate_simd_vectors(Input * I)
 {
 	SIMD_Vectors A;
-	float * ptr = (float * ) malloc( I->egroups * 14 * sizeof(float));
+	float * ptr = (float * ) malloc( (size_t) I->egroups * 14 *
+			sizeof(float));
 	A.q0 = ptr;
 	ptr += I->egroups;
 	A.q1 = ptr;
@@ -169,36 +429,224 @@ SIMD_Vectors allocate_simd_vectors(Input * I)
 	A.t3 = ptr;
 	ptr += I->egroups;
 	A.t4 = ptr;
+	default_segment_geometry(&A);
 
 	return A;
 }
 
-#ifdef OPENMP
-// Intialized OpenMP Source Region Locks
-omp_lock_t * init_locks( Input * I )
+void free_simd_vectors( SIMD_Vectors * A )
+{
+	#ifdef INTEL
+	_mm_free(A->q0);
+	_mm_free(A->q1);
+	_mm_free(A->q2);
+	_mm_free(A->sigT);
+	_mm_free(A->tau);
+	_mm_free(A->sigT2);
+	_mm_free(A->expVal);
+	_mm_free(A->reuse);
+	_mm_free(A->flux_integral);
+	_mm_free(A->tally);
+	_mm_free(A->t1);
+	_mm_free(A->t2);
+	_mm_free(A->t3);
+	_mm_free(A->t4);
+	#else
+	// Vectors share one allocation, starting at q0
+	free(A->q0);
+	#endif
+}
+
+#ifdef MULTITHREADED
+// Intialized Source Region Locks
+Lock * init_locks( Input * I )
 {
 	// Allocate locks array
-	long n_locks = I->source_3D_regions * I->fine_axial_intervals; 
-	omp_lock_t * locks = (omp_lock_t *) malloc( n_locks* sizeof(omp_lock_t));
-	I->nbytes += n_locks * sizeof(omp_lock_t);
+	long n_locks = (long) I->source_3D_regions * I->fine_axial_intervals;
+	size_t lock_bytes = array_bytes("locks", n_locks, 1, 1, sizeof(Lock));
+	Lock * locks = (Lock *) checked_malloc( lock_bytes, "locks");
+	if( locks == NULL )
+		return NULL;
+	I->nbytes += lock_bytes;
 
 	// Initialize locks array
 	for( long i = 0; i < n_locks; i++ )
-		omp_init_lock(&locks[i]);
+		init_lock(&locks[i]);
 
 	return locks;
 }	
+
+#ifdef COMPACT
+// Initializes the fixed size lock stripe table of the compact layout
+Lock_Stripe * init_lock_stripes( Input * I )
+{
+	Lock_Stripe * stripes;
+	if( posix_memalign((void **) &stripes, 64,
+				I->lock_stripes * sizeof(Lock_Stripe)) != 0 )
+	{
+		fprintf(stderr, "Unable to allocate lock stripes\n");
+		if( malloc_exits )
+			exit(1);
+		return NULL;
+	}
+	I->nbytes += I->lock_stripes * sizeof(Lock_Stripe);
+
+	for( int i = 0; i < I->lock_stripes; i++ )
+		init_lock(&stripes[i].lock);
+
+	return stripes;
+}
 #endif
+#endif
+
+// Bytes of source metadata (region structures and locks) in the per-region
+// layout - four pointers per region and a lock per fine source region
+long per_region_metadata_bytes( Input * I )
+{
+	long bytes = (long) I->source_3D_regions * 4 * sizeof(float *);
+	#ifdef MULTITHREADED
+	bytes += (long) I->source_3D_regions * I->fine_axial_intervals *
+		sizeof(Lock);
+	#endif
+	return bytes;
+}
+
+// Bytes of source metadata in the layout this binary was built with
+long source_metadata_bytes( Input * I )
+{
+	#ifdef COMPACT
+	long bytes = sizeof(Source);
+	#ifdef MULTITHREADED
+	bytes += (long) I->lock_stripes * sizeof(Lock_Stripe);
+	#endif
+	return bytes;
+	#else
+	return per_region_metadata_bytes(I);
+	#endif
+}
+
+// Returns the size in bytes of the given level of data cache (32 KB, 1 MB
+// and 8 MB for L1, L2 and L3 if it can't be found)
+long detect_cache_size( int level )
+{
+	long size = 0;
+
+	#if defined _SC_LEVEL1_DCACHE_SIZE && defined _SC_LEVEL3_CACHE_SIZE
+	if( level == 1 )
+		size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	else if( level == 2 )
+		size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	else
+		size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	#endif
 
-// Timer function. Depends on if compiled with MPI, openmp, or vanilla
+	// Fall back on sysfs, looking for a data or unified cache of that level
+	for( int idx = 0; size <= 0 && idx < 8; idx++ )
+	{
+		char fname[128];
+		char type[32] = "";
+		int cache_level = 0;
+		long kb = 0;
+
+		sprintf(fname, "/sys/devices/system/cpu/cpu0/cache/index%d/level", idx);
+		FILE * fp = fopen(fname, "r");
+		if( fp == NULL )
+			break;
+		if( fscanf(fp, "%d", &cache_level) != 1 )
+			cache_level = 0;
+		fclose(fp);
+
+		sprintf(fname, "/sys/devices/system/cpu/cpu0/cache/index%d/type", idx);
+		if( (fp = fopen(fname, "r")) != NULL )
+		{
+			if( fscanf(fp, "%31s", type) != 1 )
+				type[0] = '\0';
+			fclose(fp);
+		}
+
+		sprintf(fname, "/sys/devices/system/cpu/cpu0/cache/index%d/size", idx);
+		if( cache_level == level && strcmp(type, "Instruction") != 0 &&
+				(fp = fopen(fname, "r")) != NULL )
+		{
+			if( fscanf(fp, "%ldK", &kb) == 1 )
+				size = kb * 1024;
+			fclose(fp);
+		}
+	}
+
+	if( size <= 0 )
+		size = level == 1 ? 32 * 1024 : level == 2 ? 1024 * 1024 :
+			8 * 1024 * 1024;
+
+	return size;
+}
+
+// Returns the L1 data cache size in bytes
+long detect_L1_size(void)
+{
+	return detect_cache_size(1);
+}
+
+// Picks the number of energy groups attenuated per cache block. Each group
+// touches the 14 SIMD vectors, state_flux, 3 fine sources, sigT and the FSR
+// flux (20 floats). Tiles fill half of L1 and are kept a multiple of 16
+// groups so every tile starts on a 64 byte boundary.
+int select_tile_size( Input * I )
+{
+	int tile = I->tile_size;
+
+	if( tile < 0 )
+	{
+		long L1 = detect_L1_size();
+		tile = (int) (L1 / 2 / (20 * sizeof(float)));
+	}
+
+	// 0 disables tiling
+	if( tile == 0 || tile >= I->egroups )
+		return I->egroups;
+
+	tile = (tile / 16) * 16;
+	if( tile < 16 )
+		tile = 16;
+	if( tile > I->egroups )
+		tile = I->egroups;
+
+	return tile;
+}
+
+// Base of the random seeds - the fixed seed (-d), else the clock
+unsigned int run_seed( Input * I )
+{
+	if( I->seed >= 0 )
+		return (unsigned int) I->seed;
+	return (unsigned int) time(NULL);
+}
+
+// Seed of a thread's rand_r() sequence in a kernel or boundary sweep. It
+// is hashed from the run seed, rank, thread and sweep (a stream the
+// counter-based draws of reduce.c and comm.c don't use), so no two
+// threads or ranks repeat each other's segments - even with "-d 0".
+unsigned int thread_seed( Input * I, int thread, int sweep )
+{
+	unsigned long long stream = ((unsigned long long) I->rank << 2) | 3;
+	return (unsigned int) counter_random(run_seed(I), stream,
+			((unsigned long long) thread << 1) | sweep);
+}
+
+// Timer function. Depends on if compiled with MPI, openmp, or vanilla.
+// The vanilla timer used to be clock(), which counts CPU time rather than
+// wall time, so it now reads the monotonic clock instead.
 double get_time(void)
 {
+    #ifdef MPI
+    return MPI_Wtime();
+    #endif
+
     #ifdef OPENMP
     return omp_get_wtime();
     #endif
 
-    time_t time;
-    time = clock();
-
-    return (double) time / (double) CLOCKS_PER_SEC;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1.0e-9;
 }
@@ -0,0 +1,224 @@
+#include "SimpleMOC-kernel_header.h"
+
+#ifdef INSTRUMENT
+
+// Per-thread timing and lock instrumentation. Timers read the time stamp
+// counter, and every thread only writes its own padded counters, so the
+// instrumentation barely perturbs the kernel. Contended locks also bump
+// per fine source region counters, to find the hottest regions.
+
+// Counters of the calling thread (NULL outside of timed kernel runs)
+static __thread Thread_Stats * thread_stats = NULL;
+
+// Ticks of the time stamp counter per second, measured against get_time()
+double calibrate_ticks(void)
+{
+	double start = get_time();
+	unsigned long long t0 = read_ticks();
+	while( get_time() - start < 0.05 )
+		;
+	unsigned long long t1 = read_ticks();
+	return (t1 - t0) / (get_time() - start);
+}
+
+Instrumentation * init_instrumentation( Input * I )
+{
+	Instrumentation * N = (Instrumentation *) malloc(sizeof(Instrumentation));
+	N->nthreads = I->nthreads;
+	// Cache line aligned, so threads never share a line
+	if( posix_memalign((void **) &N->threads, 64,
+				I->nthreads * sizeof(Thread_Stats)) != 0 )
+	{
+		fprintf(stderr, "Unable to allocate instrumentation counters\n");
+		exit(1);
+	}
+	memset(N->threads, 0, I->nthreads * sizeof(Thread_Stats));
+
+	N->n_fsr = (long) I->source_3D_regions * I->fine_axial_intervals;
+	N->fsr_contended = (long *) calloc( N->n_fsr, sizeof(long));
+	N->fsr_wait = (unsigned long long *) calloc( N->n_fsr,
+			sizeof(unsigned long long));
+	N->tick_rate = calibrate_ticks();
+
+	return N;
+}
+
+// Called by every thread at the start of the kernel parallel region
+void instrument_thread_begin( Input * I, int thread )
+{
+	if( I->stats == NULL || I->warmup )
+	{
+		thread_stats = NULL;
+		return;
+	}
+
+	thread_stats = &I->stats->threads[thread];
+	thread_stats->region_start = read_ticks();
+}
+
+// Called by every thread once it has run out of segments
+void instrument_thread_end(void)
+{
+	if( thread_stats == NULL )
+		return;
+
+	thread_stats->region += read_ticks() - thread_stats->region_start;
+	thread_stats = NULL;
+}
+
+// Counts one attenuated segment, started at the given tick
+void instrument_segment( unsigned long long start )
+{
+	if( thread_stats == NULL )
+		return;
+
+	thread_stats->segments++;
+	thread_stats->busy += read_ticks() - start;
+}
+
+#ifdef MULTITHREADED
+// Acquires a fine source region lock, timing the wait if it was contended
+void instrumented_set_lock( Input * I, Lock * L, long fsr )
+{
+	if( thread_stats == NULL )
+	{
+		set_lock(L);
+		return;
+	}
+
+	if( test_lock(L) )
+	{
+		thread_stats->uncontended++;
+		return;
+	}
+
+	unsigned long long start = read_ticks();
+	set_lock(L);
+	unsigned long long wait = read_ticks() - start;
+
+	thread_stats->contended++;
+	thread_stats->lock_wait += wait;
+
+	// Bin i holds waits of [2^i, 2^(i+1)) ticks
+	int bin = 0;
+	while( bin < LOCK_WAIT_BINS - 1 && (wait >> (bin + 1)) != 0 )
+		bin++;
+	thread_stats->wait_hist[bin]++;
+
+	__atomic_fetch_add(&I->stats->fsr_contended[fsr], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&I->stats->fsr_wait[fsr], wait, __ATOMIC_RELAXED);
+}
+#endif
+
+// Prints the per-thread table, the lock wait histogram and the fine source
+// regions with the most contended acquisitions
+void print_instrumentation( Input * I )
+{
+	Instrumentation * N = I->stats;
+	double rate = N->tick_rate;
+
+	border_print();
+	center_print("THREAD INSTRUMENTATION", 79);
+	border_print();
+
+	printf("%-8s%-11s%-11s%-11s%-15s%-12s%s\n", "Thread", "Segments",
+			"Busy (s)", "Idle (s)", "Lock Wait (s)", "Contended",
+			"Uncontended");
+
+	Thread_Stats total;
+	memset(&total, 0, sizeof(total));
+	double max_busy = 0;
+	for( int t = 0; t < N->nthreads; t++ )
+	{
+		Thread_Stats * T = &N->threads[t];
+		double busy = T->busy / rate;
+		printf("%-8d%-11ld%-11.4lf%-11.4lf%-15.6lf%-12ld%ld\n", t,
+				T->segments, busy, (T->region - T->busy) / rate,
+				T->lock_wait / rate, T->contended, T->uncontended);
+
+		total.segments += T->segments;
+		total.busy += T->busy;
+		total.region += T->region;
+		total.lock_wait += T->lock_wait;
+		total.contended += T->contended;
+		total.uncontended += T->uncontended;
+		for( int b = 0; b < LOCK_WAIT_BINS; b++ )
+			total.wait_hist[b] += T->wait_hist[b];
+		if( busy > max_busy )
+			max_busy = busy;
+	}
+	printf("%-8s%-11ld%-11.4lf%-11.4lf%-15.6lf%-12ld%ld\n", "Total",
+			total.segments, total.busy / rate,
+			(total.region - total.busy) / rate, total.lock_wait / rate,
+			total.contended, total.uncontended);
+
+	double mean_busy = total.busy / rate / N->nthreads;
+	long acquisitions = total.contended + total.uncontended;
+	printf("\n");
+	if( mean_busy > 0 )
+		printf("%-25s%.3lf (max/mean busy time)\n", "Load Imbalance:",
+				max_busy / mean_busy);
+	if( total.busy > 0 )
+		printf("%-25s%.3lf%%\n", "Lock Wait Share:",
+				(double) total.lock_wait / total.busy * 100.);
+	if( acquisitions > 0 )
+		printf("%-25s%.3lf%%\n", "Contended Acquisitions:",
+				(double) total.contended / acquisitions * 100.);
+	printf("%-25s%.2lf GHz\n", "Timer Rate:", rate / 1.0e9);
+
+	if( total.contended == 0 )
+		return;
+
+	// Histogram of contended lock waits
+	long max_bin = 0;
+	for( int b = 0; b < LOCK_WAIT_BINS; b++ )
+		if( total.wait_hist[b] > max_bin )
+			max_bin = total.wait_hist[b];
+
+	printf("\nContended Lock Waits\n");
+	printf("%-24s%-12s\n", "  Wait (ns)", "Count");
+	for( int b = 0; b < LOCK_WAIT_BINS; b++ )
+	{
+		if( total.wait_hist[b] == 0 )
+			continue;
+
+		char range[32];
+		sprintf(range, "  %.0lf - %.0lf", (double) (1ULL << b) / rate * 1.0e9,
+				(double) (2ULL << b) / rate * 1.0e9);
+		int bar = (int) (40 * total.wait_hist[b] / max_bin);
+		printf("%-24s%-12ld", range, total.wait_hist[b]);
+		for( int i = 0; i < bar; i++ )
+			printf("#");
+		printf("\n");
+	}
+
+	// Hottest fine source regions, by contended acquisitions
+	printf("\nHottest Fine Source Regions\n");
+	printf("%-12s%-12s%-12s%s\n", "  QSR", "FAI", "Contended", "Wait (us)");
+	int fai = I->fine_axial_intervals;
+	long * shown = (long *) malloc( HOT_FSRS * sizeof(long));
+	int n_shown = 0;
+	while( n_shown < HOT_FSRS )
+	{
+		long hottest = -1;
+		for( long f = 0; f < N->n_fsr; f++ )
+		{
+			int skip = N->fsr_contended[f] == 0;
+			for( int i = 0; i < n_shown && !skip; i++ )
+				skip = shown[i] == f;
+			if( !skip && (hottest < 0 ||
+						N->fsr_contended[f] > N->fsr_contended[hottest]) )
+				hottest = f;
+		}
+		if( hottest < 0 )
+			break;
+
+		printf("  %-10ld%-12ld%-12ld%.3lf\n", hottest / fai, hottest % fai,
+				N->fsr_contended[hottest],
+				N->fsr_wait[hottest] / rate * 1.0e6);
+		shown[n_shown++] = hottest;
+	}
+	free(shown);
+}
+
+#endif
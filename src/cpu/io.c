@@ -46,25 +46,82 @@ void border_print(void)
 }
 
 // Prints comma separated integers - for ease of reading
-void fancy_int( int a )
+void fancy_int( long a )
 {
-    if( a < 1000 )
-        printf("%d\n",a);
-
-    else if( a >= 1000 && a < 1000000 )
-        printf("%d,%03d\n", a / 1000, a % 1000);
-
-    else if( a >= 1000000 && a < 1000000000 )
-        printf("%d,%03d,%03d\n", a / 1000000, (a % 1000000) / 1000, a % 1000 );
-
-    else if( a >= 1000000000 )
-        printf("%d,%03d,%03d,%03d\n",
-               a / 1000000000,
-               (a % 1000000000) / 1000000,
-               (a % 1000000) / 1000,
-               a % 1000 );
-    else
-        printf("%d\n",a);
+	if( a < 0 )
+	{
+		printf("-");
+		a = -a;
+	}
+
+	// Print the leading group, then every group of three digits after it
+	long scale = 1;
+	while( a / scale >= 1000 )
+		scale *= 1000;
+
+	printf("%ld", a / scale);
+	while( scale > 1 )
+	{
+		a %= scale;
+		scale /= 1000;
+		printf(",%03ld", a / scale);
+	}
+	printf("\n");
+}
+
+// Parses a whole decimal integer argument. Anything else (including values
+// out of the range of a long) is a usage error.
+long parse_long( const char * s )
+{
+	char * end;
+	errno = 0;
+	long v = strtol(s, &end, 10);
+	if( errno != 0 || end == s || *end != '\0' )
+		print_CLI_error();
+	return v;
+}
+
+// As parse_long, for arguments stored in an int
+int parse_int( const char * s )
+{
+	long v = parse_long(s);
+	if( v < INT_MIN || v > INT_MAX )
+		print_CLI_error();
+	return (int) v;
+}
+
+// As parse_long, for real valued arguments
+double parse_double( const char * s )
+{
+	char * end;
+	errno = 0;
+	double v = strtod(s, &end);
+	if( errno != 0 || end == s || *end != '\0' || !isfinite(v) )
+		print_CLI_error();
+	return v;
+}
+
+// Parses a comma separated list of at most max fields, each as parse_int.
+// Returns the number of fields.
+int parse_int_fields( const char * s, int * vals, int max )
+{
+	char * copy = strdup(s);
+	char * field = copy;
+	int n = 0;
+	while( 1 )
+	{
+		char * comma = strchr(field, ',');
+		if( comma != NULL )
+			*comma = '\0';
+		if( n == max )
+			print_CLI_error();
+		vals[n++] = parse_int(field);
+		if( comma == NULL )
+			break;
+		field = comma + 1;
+	}
+	free(copy);
+	return n;
 }
 
 // Prints out the summary of User input
@@ -73,21 +130,108 @@ void print_input_summary(Input * I)
 	center_print("INPUT SUMMARY", 79);
 	border_print();
 	#ifdef OPENMP
+	printf("%-25s%s\n", "Threading Backend:", "OpenMP");
+	#elif defined PTHREADS
+	printf("%-25s%s\n", "Threading Backend:", "pthreads");
+	#endif
+	#ifdef MULTITHREADED
 	printf("%-25s%d\n", "Number of Threads:", I->nthreads);
 	#endif
+	const char * placement[] = { "None", "Compact", "Scatter",
+		"One per Core", "CPU List" };
+	printf("%-25s%s\n", "Thread Placement:", placement[I->affinity]);
+	print_thread_map(I);
+	if( I->scheduler == SCHED_STEAL )
+		printf("%-25s%s\n", "Scheduler:", "Work Stealing");
+	else
+		printf("%-25s%s\n", "Scheduler:", "Dynamic");
+	if( I->chunk_size == 0 )
+		printf("%-25s%s\n", "Chunk Size:", "Autotuned");
+	else
+		printf("%-25s%ld\n", "Chunk Size:", I->chunk_size);
 	printf("%-25s%d\n", "Energy Groups:", I->egroups);
+	if( I->tile_size < I->egroups )
+		printf("%-25s%d\n", "Energy Group Tile:", I->tile_size);
+	else
+		printf("%-25s%s\n", "Energy Group Tile:", "OFF");
 	printf("%-25s%d\n", "2D Source Regions:", I->source_2D_regions);
 	printf("%-25s%d\n", "Coarse Axial Intervals:", I->coarse_axial_intervals);
 	printf("%-25s%d\n", "Fine Axial Intervals:", I->fine_axial_intervals);
 	printf("%-25s%d\n", "Axial Decomposition:", I->decomp_assemblies_ax);
+	#ifdef MPI
+	printf("%-25s%d\n", "MPI Ranks (Subdomains):", I->nranks);
+	printf("%-25s%d\n", "Sweeps:", I->sweeps);
+	printf("%-25s%d\n", "Boundary Tracks/Face:", I->boundary_tracks);
+	#endif
 	printf("%-25s%d\n", "3D Source Regions:", I->source_3D_regions);
 	printf("%-25s", "Segments:"); fancy_int(I->segments);
 	printf("%-25s%.2f\n", "Memory Estimate (MB):", I->nbytes/1024.0/1024.0);
+	#ifdef COMPACT
+	printf("%-25s%s\n", "Source Layout:", "Compact (flat arrays)");
+	#ifdef MULTITHREADED
+	printf("%-25s%d\n", "Lock Stripes:", I->lock_stripes);
+	#endif
+	printf("%-25s%.2f (%.2f per region)\n", "Metadata (MB):",
+			source_metadata_bytes(I) / 1024.0 / 1024.0,
+			per_region_metadata_bytes(I) / 1024.0 / 1024.0);
+	printf("%-25s%.2f\n", "Metadata Saved (MB):",
+			(per_region_metadata_bytes(I) - source_metadata_bytes(I)) /
+			1024.0 / 1024.0);
+	#endif
+	printf("%-25s%d (%d warmup)\n", "Timed Repetitions:", I->repetitions,
+			I->warmup_runs);
+	if( I->results_file != NULL )
+		printf("%-25s%s\n", "Results File:", I->results_file);
+	if( I->ooc != NULL )
+	{
+		printf("%-25s%s\n", "Backing File:", I->backing_file);
+		printf("%-25s%.2f\n", "Backing Store (MB):",
+				I->ooc->file_bytes / 1024.0 / 1024.0);
+		printf("%-25s%d of %d regions (%d windows)\n", "Out-of-Core Window:",
+				I->ooc->window_regions, I->source_3D_regions,
+				I->ooc->n_windows);
+	}
+	if( I->checkpoint_file != NULL )
+		printf("%-25s%s (every %g s%s)\n", "Checkpoint File:",
+				I->checkpoint_file, I->checkpoint_interval,
+				I->restart ? ", resuming" : "");
+	if( I->reproducible )
+		printf("%-25s%s\n", "Tally Sum:", "Reproducible (ordered)");
+	if( I->tally_cache_lines > 0 )
+		printf("%-25s%d per thread\n", "Tally Cache Lines:",
+				I->tally_cache_lines);
+	if( I->pipeline_depth > 0 )
+		printf("%-25s%d segments, %d tallies deep\n", "Pipelined Stages:",
+				I->pipeline_depth, I->pipeline_tally_depth);
+	if( I->geometry != NULL )
+	{
+		printf("%-25s%dx%d pins, %d tracks\n", "Ray Traced Lattice:",
+				I->lattice_pins, I->lattice_pins, I->geometry->n_tracks);
+		if( I->polar_angles > 0 )
+			printf("%-25s%d polar angles, %.3lf cm apart\n", "3D Tracks:",
+					I->polar_angles, I->axial_spacing);
+		printf("%-25s%s\n", "Segment Source:", I->store_segments ?
+				"Stored" : "Traced on the fly");
+	}
+	if( I->seed >= 0 )
+		printf("%-25s%ld\n", "Random Seed:", I->seed);
+	if( I->baseline != NULL )
+		printf("%-25s%s\n", "Regression Baseline:", I->baseline->fname);
+	if( I->monitor_interval > 0 )
+		printf("%-25s%.1lf s\n", "Progress Interval:", I->monitor_interval);
 	#ifdef TABLE
 	printf("%-25s%s\n", "Exponential Table:","ON");
 	#else
 	printf("%-25s%s\n", "Exponential Table:","OFF");
 	#endif
+	#ifdef PERF
+	printf("%-25s", "Perf Counter Groups:");
+	for( int i = 0; i < I->n_perf_groups; i++ )
+		printf("%s%s", i ? "," : "", perf_group_name(I->perf_groups[i]));
+	if( I->n_perf_groups > 1 )
+		printf(" (%s)", I->perf_multiplex ? "multiplexed" : "one per run");
+	printf("\n");
+	#endif
 	#ifdef PAPI
     if( I->papi_event_set == -1)
         printf("%-25s%s\n", "PAPI event to count:", I->event_name);
@@ -99,11 +243,14 @@ void print_input_summary(Input * I)
 void read_CLI( int argc, char * argv[], Input * input )
 {
 	// defaults to max threads on the system	
-	#ifdef OPENMP
-	input->nthreads = omp_get_num_procs();
+	#ifdef MULTITHREADED
+	input->nthreads = get_num_procs();
 	#else
 	input->nthreads = 1;
 	#endif
+
+	char * baseline_file = NULL;
+	int segments_given = 0;
 	
 	// Collect Raw Input
 	for( int i = 1; i < argc; i++ )
@@ -114,7 +261,7 @@ void read_CLI( int argc, char * argv[], Input * input )
 		if( strcmp(arg, "-t") == 0 )
 		{
 			if( ++i < argc )
-				input->nthreads = atoi(argv[i]);
+				input->nthreads = parse_int(argv[i]);
 			else
 				print_CLI_error();
 		}
@@ -123,20 +270,382 @@ void read_CLI( int argc, char * argv[], Input * input )
 		else if( strcmp(arg, "-s") == 0 )
 		{
 			if( ++i < argc )
-				input->segments = atoi(argv[i]);
+			{
+				input->segments = parse_long(argv[i]);
+				segments_given = 1;
+			}
 			else
 				print_CLI_error();
 		}
 		
+		// 2D source regions (-g)
+		else if( strcmp(arg, "-g") == 0 )
+		{
+			if( ++i < argc )
+				input->source_2D_regions = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// coarse axial intervals (-z)
+		else if( strcmp(arg, "-z") == 0 )
+		{
+			if( ++i < argc )
+				input->coarse_axial_intervals = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// fine axial intervals per coarse interval (-f)
+		else if( strcmp(arg, "-f") == 0 )
+		{
+			if( ++i < argc )
+				input->fine_axial_intervals = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// axial subdomains per assembly (-A)
+		else if( strcmp(arg, "-A") == 0 )
+		{
+			if( ++i < argc )
+				input->decomp_assemblies_ax = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
 		// egroups (-e)
 		else if( strcmp(arg, "-e") == 0 )
 		{
 			if( ++i < argc )
-				input->egroups = atoi(argv[i]);
+				input->egroups = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// energy groups per cache block (-b)
+		else if( strcmp(arg, "-b") == 0 )
+		{
+			if( ++i < argc )
+				input->tile_size = parse_int(argv[i]);
+			else
+				print_CLI_error();
+
+			// -1 (pick from the L1 size) is the default, not an option
+			if( input->tile_size < 0 )
+				print_CLI_error();
+		}
+
+		// segment scheduler (-S)
+		else if( strcmp(arg, "-S") == 0 )
+		{
+			if( ++i >= argc )
+				print_CLI_error();
+			else if( strcmp(argv[i], "dynamic") == 0 )
+				input->scheduler = SCHED_DYNAMIC;
+			else if( strcmp(argv[i], "steal") == 0 )
+				input->scheduler = SCHED_STEAL;
+			else
+				print_CLI_error();
+		}
+
+		// segments per scheduling chunk (-c)
+		else if( strcmp(arg, "-c") == 0 )
+		{
+			if( ++i < argc )
+				input->chunk_size = parse_long(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// thread placement (-a)
+		else if( strcmp(arg, "-a") == 0 )
+		{
+			if( ++i >= argc )
+				print_CLI_error();
+			else if( strcmp(argv[i], "none") == 0 )
+				input->affinity = AFFINITY_NONE;
+			else if( strcmp(argv[i], "compact") == 0 )
+				input->affinity = AFFINITY_COMPACT;
+			else if( strcmp(argv[i], "scatter") == 0 )
+				input->affinity = AFFINITY_SCATTER;
+			else if( strcmp(argv[i], "core") == 0 )
+				input->affinity = AFFINITY_CORE;
+			else
+			{
+				input->affinity = AFFINITY_LIST;
+				input->n_cpu_list = parse_cpu_list(argv[i], &input->cpu_list);
+				if( input->n_cpu_list == 0 )
+					print_CLI_error();
+			}
+		}
+
+		// untimed warmup runs (-w)
+		else if( strcmp(arg, "-w") == 0 )
+		{
+			if( ++i < argc )
+				input->warmup_runs = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// timed repetitions (-r)
+		else if( strcmp(arg, "-r") == 0 )
+		{
+			if( ++i < argc )
+				input->repetitions = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// results file (-o)
+		else if( strcmp(arg, "-o") == 0 )
+		{
+			if( ++i < argc )
+				input->results_file = argv[i];
 			else
 				print_CLI_error();
 		}
 
+		// progress monitor interval in seconds (-m)
+		else if( strcmp(arg, "-m") == 0 )
+		{
+			if( ++i < argc )
+				input->monitor_interval = parse_double(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// progress monitor log (-l)
+		else if( strcmp(arg, "-l") == 0 )
+		{
+			if( ++i < argc )
+				input->monitor_file = argv[i];
+			else
+				print_CLI_error();
+		}
+
+		// fixed random seed (-d)
+		else if( strcmp(arg, "-d") == 0 )
+		{
+			if( ++i < argc )
+				input->seed = parse_long(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// baseline results to check for a regression (-C)
+		else if( strcmp(arg, "-C") == 0 )
+		{
+			if( ++i < argc )
+				baseline_file = argv[i];
+			else
+				print_CLI_error();
+		}
+
+		// regression threshold in percent (-X)
+		else if( strcmp(arg, "-X") == 0 )
+		{
+			if( ++i < argc )
+				input->threshold = parse_double(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// bandwidth and compute roof probes (-B)
+		else if( strcmp(arg, "-B") == 0 )
+			input->probe = 1;
+
+		// scaling study lists (-T threads, -E groups, -N segments,
+		// -R 2D source regions)
+		else if( strcmp(arg, "-T") == 0 || strcmp(arg, "-E") == 0 ||
+				strcmp(arg, "-N") == 0 || strcmp(arg, "-R") == 0 )
+		{
+			if( ++i >= argc )
+				print_CLI_error();
+			if( input->scaling == NULL )
+				input->scaling = (Scaling *) calloc(1, sizeof(Scaling));
+
+			Scaling * C = input->scaling;
+			long * list;
+			int n = parse_range_list(argv[i], &list);
+			if( n == 0 )
+				print_CLI_error();
+			// Only segment counts may go past the range of an int
+			for( int j = 0; j < n; j++ )
+				if( list[j] < 1 || (arg[1] != 'N' && list[j] > INT_MAX) )
+					print_CLI_error();
+
+			if( arg[1] == 'T' ) { C->threads = list; C->n_threads = n; }
+			if( arg[1] == 'E' ) { C->egroups = list; C->n_egroups = n; }
+			if( arg[1] == 'N' ) { C->segments = list; C->n_segments = n; }
+			if( arg[1] == 'R' ) { C->regions = list; C->n_regions = n; }
+		}
+
+		#ifdef MPI
+		// sweeps (-n)
+		else if( strcmp(arg, "-n") == 0 )
+		{
+			if( ++i < argc )
+				input->sweeps = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// boundary tracks per axial face (-x)
+		else if( strcmp(arg, "-x") == 0 )
+		{
+			if( ++i < argc )
+				input->boundary_tracks = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+		#endif
+
+		// out-of-core backing file (-F)
+		else if( strcmp(arg, "-F") == 0 )
+		{
+			if( ++i < argc )
+				input->backing_file = argv[i];
+			else
+				print_CLI_error();
+		}
+
+		// regions per out-of-core window (-W)
+		else if( strcmp(arg, "-W") == 0 )
+		{
+			if( ++i < argc )
+				input->window_regions = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// checkpoint file (-k)
+		else if( strcmp(arg, "-k") == 0 )
+		{
+			if( ++i < argc )
+				input->checkpoint_file = argv[i];
+			else
+				print_CLI_error();
+		}
+
+		// checkpoint interval (-i)
+		else if( strcmp(arg, "-i") == 0 )
+		{
+			if( ++i < argc )
+				input->checkpoint_interval = parse_double(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// restart from the checkpoint (-y)
+		else if( strcmp(arg, "-y") == 0 )
+			input->restart = 1;
+
+		// reproducible sum (-D)
+		else if( strcmp(arg, "-D") == 0 )
+			input->reproducible = 1;
+
+		// pipelined mode ring depths, segments[,tallies] (-Q)
+		else if( strcmp(arg, "-Q") == 0 )
+		{
+			if( ++i >= argc )
+				print_CLI_error();
+			int depths[2] = { 0, 0 };
+			parse_int_fields(argv[i], depths, 2);
+			input->pipeline_depth = depths[0];
+			input->pipeline_tally_depth = depths[1];
+		}
+
+		// ray traced lattice, pins per side[,rings,sectors] (-G)
+		else if( strcmp(arg, "-G") == 0 )
+		{
+			if( ++i >= argc )
+				print_CLI_error();
+			int fields[3] = { 0, input->lattice_rings,
+				input->lattice_sectors };
+			parse_int_fields(argv[i], fields, 3);
+			input->lattice_pins = fields[0];
+			input->lattice_rings = fields[1];
+			input->lattice_sectors = fields[2];
+		}
+
+		// azimuthal angles of the ray traced tracks (-H)
+		else if( strcmp(arg, "-H") == 0 )
+		{
+			if( ++i < argc )
+				input->azimuthal_angles = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// track spacing in cm (-j)
+		else if( strcmp(arg, "-j") == 0 )
+		{
+			if( ++i < argc )
+				input->track_spacing = parse_double(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// store the ray traced segments instead of tracing every sweep (-Y)
+		else if( strcmp(arg, "-Y") == 0 )
+			input->store_segments = 1;
+
+		// polar angles of 3D tracks stacked on the 2D tracks (-V)
+		else if( strcmp(arg, "-V") == 0 )
+		{
+			if( ++i < argc )
+				input->polar_angles = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// axial spacing of the 3D tracks in cm (-Z)
+		else if( strcmp(arg, "-Z") == 0 )
+		{
+			if( ++i < argc )
+				input->axial_spacing = parse_double(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		// tally cache lines per thread (-K)
+		else if( strcmp(arg, "-K") == 0 )
+		{
+			if( ++i < argc )
+				input->tally_cache_lines = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+
+		#if defined COMPACT && defined MULTITHREADED
+		// lock stripes of the compact layout (-L)
+		else if( strcmp(arg, "-L") == 0 )
+		{
+			if( ++i < argc )
+				input->lock_stripes = parse_int(argv[i]);
+			else
+				print_CLI_error();
+		}
+		#endif
+
+		#ifdef PERF
+		// perf_event_open counter groups (-P)
+		else if( strcmp(arg, "-P") == 0 )
+		{
+			if( ++i < argc )
+				input->n_perf_groups = parse_perf_groups(argv[i],
+						input->perf_groups);
+			if( i >= argc || input->n_perf_groups == 0 )
+				print_CLI_error();
+		}
+
+		// count all perf groups at once (-M)
+		else if( strcmp(arg, "-M") == 0 )
+			input->perf_multiplex = 1;
+		#endif
+
         #ifdef PAPI
         // Add single PAPI event
         else if( strcmp(arg, "-p") == 0 )
@@ -154,9 +663,190 @@ void read_CLI( int argc, char * argv[], Input * input )
 	}
 
 
+	// Rerun the configuration of the baseline
+	if( baseline_file != NULL )
+	{
+		if( input->scaling != NULL )
+			print_CLI_error();
+		input->baseline = load_baseline(input, baseline_file);
+	}
+
 	// Validate nthreads
 	if( input->nthreads < 1 )
 		print_CLI_error();
+
+	// Validate problem size. The source fit reads the neighbors of a fine
+	// axial interval, so there must be at least two.
+	if( input->segments < 1 || input->egroups < 1 ||
+			input->source_2D_regions < 1 ||
+			input->coarse_axial_intervals < 1 ||
+			input->fine_axial_intervals < 2 ||
+			input->decomp_assemblies_ax < 1 )
+		print_CLI_error();
+
+	// Offsets within a region are ints in the kernel
+	if( (long) input->fine_axial_intervals * input->egroups > INT_MAX )
+		print_CLI_error();
+
+	// Validate chunk size
+	if( input->chunk_size < 0 )
+		print_CLI_error();
+
+	// Validate benchmark repetitions
+	if( input->warmup_runs < 0 || input->repetitions < 1 )
+		print_CLI_error();
+
+	// Validate lock stripes (a power of two, for the stripe hash)
+	#ifdef COMPACT
+	if( input->lock_stripes < 1 ||
+			(input->lock_stripes & (input->lock_stripes - 1)) != 0 )
+		print_CLI_error();
+	#endif
+
+	// Validate tally cache lines (0, or a power of two)
+	if( input->tally_cache_lines < 0 || (input->tally_cache_lines &
+				(input->tally_cache_lines - 1)) != 0 )
+		print_CLI_error();
+
+	// Validate the pipeline depths (0, or powers of two - the tally ring as
+	// deep as the segment ring unless given). The reproducible sum orders
+	// its tallies itself.
+	if( input->pipeline_tally_depth == 0 )
+		input->pipeline_tally_depth = input->pipeline_depth;
+	if( input->pipeline_depth < 0 ||
+			(input->pipeline_depth & (input->pipeline_depth - 1)) != 0 ||
+			input->pipeline_tally_depth < 0 ||
+			(input->pipeline_tally_depth &
+			 (input->pipeline_tally_depth - 1)) != 0 ||
+			(input->pipeline_depth == 0 && input->pipeline_tally_depth > 0) ||
+			(input->pipeline_depth > 0 && input->reproducible) )
+		print_CLI_error();
+
+	// Validate the lattice. Its pins' rings and sectors are the 2D source
+	// regions. Tracks are swept whole, once per repetition, so don't mix
+	// with anything that cuts the sweep up or numbers its segments.
+	if( input->lattice_pins < 0 || input->lattice_rings < 1 ||
+			input->lattice_sectors < 1 || input->azimuthal_angles < 4 ||
+			input->azimuthal_angles % 4 != 0 || !(input->track_spacing > 0) ||
+			(input->store_segments && input->lattice_pins == 0) )
+		print_CLI_error();
+
+	// Validate the 3D tracks (polar angles in up and down pairs)
+	if( input->polar_angles < 0 || input->polar_angles % 2 != 0 ||
+			!(input->axial_spacing > 0) ||
+			(input->polar_angles > 0 && input->lattice_pins == 0) )
+		print_CLI_error();
+
+	// Ray tracing sets the segment count from the tracks
+	if( input->lattice_pins > 0 )
+	{
+		if( segments_given || input->reproducible ||
+				input->pipeline_depth > 0 ||
+				input->backing_file != NULL || input->checkpoint_file != NULL ||
+				input->scaling != NULL || input->chunk_size == 0 )
+			print_CLI_error();
+		#ifdef MPI
+		print_CLI_error();
+		#endif
+		double regions = (double) input->lattice_pins * input->lattice_pins *
+			(input->lattice_rings + 1.0) * input->lattice_sectors;
+		if( regions > INT_MAX )
+		{
+			fprintf(stderr, "A %d x %d lattice of %d ring, %d sector pins has "
+					"%.0lf 2D regions, more than the %d supported\n",
+					input->lattice_pins, input->lattice_pins,
+					input->lattice_rings, input->lattice_sectors, regions,
+					INT_MAX);
+			exit(1);
+		}
+		input->source_2D_regions = (int) regions;
+	}
+
+	// The reproducible sum needs fixed chunks and a fixed seed, and stages
+	// its own tallies
+	if( input->reproducible )
+	{
+		if( input->chunk_size == 0 || input->tally_cache_lines > 0 )
+			print_CLI_error();
+		if( input->seed < 0 )
+			input->seed = time(NULL);
+	}
+
+	// Out-of-core windows hold only some regions, which the boundary tracks
+	// and the reproducible sum (random regions, whole flux checksum) can't
+	// work with
+	if( input->window_regions < 0 )
+		print_CLI_error();
+	if( input->backing_file != NULL && input->reproducible )
+		print_CLI_error();
+	#ifdef MPI
+	if( input->backing_file != NULL )
+		print_CLI_error();
+	#endif
+
+	// Checkpoints hold one rank's in-memory fine flux, and cut the runs into
+	// blocks, which the reproducible sum's segment numbering can't span
+	if( input->checkpoint_interval < 0 ||
+			(input->restart && input->checkpoint_file == NULL) )
+		print_CLI_error();
+	if( input->checkpoint_file != NULL && (input->backing_file != NULL ||
+				input->reproducible || input->scaling != NULL) )
+		print_CLI_error();
+	#ifdef MPI
+	if( input->checkpoint_file != NULL )
+		print_CLI_error();
+	#endif
+
+	// Validate seed and regression threshold
+	if( input->seed < -1 || input->threshold < 0 )
+		print_CLI_error();
+
+	// Validate progress monitor interval
+	if( input->monitor_interval < 0 ||
+			(input->monitor_file != NULL && input->monitor_interval == 0) )
+		print_CLI_error();
+
+	// Scaling study - values not swept over are held at their usual setting
+	if( input->scaling != NULL )
+	{
+		Scaling * C = input->scaling;
+		if( C->n_threads == 0 )
+		{
+			C->threads = (long *) malloc(sizeof(long));
+			C->threads[0] = input->nthreads;
+			C->n_threads = 1;
+		}
+		if( C->n_egroups == 0 )
+		{
+			C->egroups = (long *) malloc(sizeof(long));
+			C->egroups[0] = input->egroups;
+			C->n_egroups = 1;
+		}
+		if( C->n_segments == 0 )
+		{
+			C->segments = (long *) malloc(sizeof(long));
+			C->segments[0] = input->segments;
+			C->n_segments = 1;
+		}
+		if( C->n_regions == 0 )
+		{
+			C->regions = (long *) malloc(sizeof(long));
+			C->regions[0] = input->source_2D_regions;
+			C->n_regions = 1;
+		}
+	}
+
+	// Validate sweeps and boundary tracks (a face's fluxes are sent as one
+	// message, whose count is an int)
+	if( input->sweeps < 1 || input->boundary_tracks < 0 ||
+			(long) input->boundary_tracks * input->egroups > INT_MAX )
+		print_CLI_error();
+
+	// Taking turns needs a timed run per perf group
+	#ifdef PERF
+	if( !input->perf_multiplex && input->repetitions < input->n_perf_groups )
+		input->repetitions = input->n_perf_groups;
+	#endif
 }
 
 // print error to screen, inform program options
@@ -167,6 +857,62 @@ void print_CLI_error(void)
 	printf("  -t <threads>        Number of OpenMP threads to run\n");
 	printf("  -s <segments>       Number of segments to process\n");
 	printf("  -e <energy groups>  Number of energy groups\n");
+	printf("  -g <regions>        Number of 2D source regions\n");
+	printf("  -z <intervals>      Number of coarse axial intervals\n");
+	printf("  -f <intervals>      Fine axial intervals per coarse interval\n");
+	printf("  -A <subdomains>     Axial subdomains per assembly\n");
+	printf("  -b <groups>         Energy groups per cache block (0 = off)\n");
+	printf("  -S <scheduler>      Segment scheduler (dynamic, steal)\n");
+	printf("  -c <chunk>          Segments per scheduling chunk (0 = autotune)\n");
+	printf("  -a <placement>      Thread placement (none, compact, scatter, core,\n");
+	printf("                      or a CPU list such as 0,2,4-7)\n");
+	printf("  -w <runs>           Untimed warmup runs\n");
+	printf("  -r <runs>           Timed repetitions\n");
+	printf("  -o <file>           Write results record (.csv for CSV, else JSON)\n");
+	printf("  -m <seconds>        Print progress and throughput at this interval\n");
+	printf("  -l <file>           Log the progress samples to a CSV file\n");
+	printf("  -d <seed>           Fixed random seed, for reproducible runs\n");
+	printf("  -C <baseline.json>  Rerun a JSON results record and check for a slowdown\n");
+	printf("  -X <percent>        Slowdown that fails the check (default 5)\n");
+	printf("  -B                  Probe memory bandwidth and compute roofs\n");
+	printf("  -T <list>           Scaling study: thread counts\n");
+	printf("  -E <list>           Scaling study: energy group counts\n");
+	printf("  -N <list>           Scaling study: segment counts (per thread if weak)\n");
+	printf("  -R <list>           Scaling study: 2D source region counts\n");
+	printf("                      Lists look like 1,2,4 or 1-8 or 1-8:2 or 1-64:x2\n");
+	#ifdef MPI
+	printf("  -n <sweeps>         Sweeps with boundary flux exchange\n");
+	printf("  -x <tracks>         Boundary tracks per axial face\n");
+	#endif
+	#ifndef MPI
+	printf("  -F <file>           Keep the source data in this file (out of core)\n");
+	printf("  -W <regions>        Regions per out-of-core window (default 1/16th)\n");
+	printf("  -k <file>           Checkpoint the timed runs to this file\n");
+	printf("  -i <seconds>        Seconds between checkpoints (default 10)\n");
+	printf("  -y                  Resume from the checkpoint file\n");
+	#endif
+	printf("  -D                  Reproducible (ordered) tally sum\n");
+	printf("  -K <lines>          Tally cache lines per thread, a power of two (0 = off)\n");
+	printf("  -Q <d[,t]>          Pipelined stages, segment and tally ring depths, powers\n");
+	printf("                      of two (tallies default to d; 0 = off)\n");
+	#ifndef MPI
+	printf("  -G <pins[,r,s]>     Ray trace a lattice of pins per side, each with r\n");
+	printf("                      fuel rings and s sectors (default 3,8; replaces -g)\n");
+	printf("  -H <angles>         Azimuthal angles of the tracks, a multiple of 4\n");
+	printf("  -j <cm>             Track spacing (default 0.1)\n");
+	printf("  -Y                  Store the traced segments instead of tracing each sweep\n");
+	printf("  -V <angles>         Polar angles of 3D tracks made from the 2D tracks\n");
+	printf("                      (even; 0 = sweep the 2D tracks in every plane)\n");
+	printf("  -Z <cm>             Axial spacing of the 3D tracks (default 0.5)\n");
+	#endif
+	#if defined COMPACT && defined MULTITHREADED
+	printf("  -L <stripes>        Lock stripes, a power of two (default 4096)\n");
+	#endif
+	#ifdef PERF
+	printf("  -P <groups>         perf counter groups, e.g. flops,tlb or all (flops,\n");
+	printf("                      bandwidth, stalls, branch, tlb, os)\n");
+	printf("  -M                  Multiplex the perf groups instead of taking turns\n");
+	#endif
     printf("  -p <PAPI event>     PAPI event name to count (1 only) \n");
 	printf("See readme for full description of default run values\n");
 	exit(1);
@@ -1,50 +1,196 @@
 #include "SimpleMOC-kernel_header.h"
 
+// Some placeholder constants - In the full app some of these are
+// calculated based off position in geometry. This treatment
+// shaves off a few FLOPS, but is not significant compared to the
+// rest of the function.
+static const float dz = 0.1f;
+static const float zin = 0.3f; 
+static const float weight = 0.5f;
+static const float default_mu = 0.9f;
+static const float default_mu2 = 0.3f;
+static const float default_ds = 0.7f;
+
+// Gives the SIMD vectors the placeholder segment length and polar angle.
+// Callers of the library set their own per segment.
+void default_segment_geometry( SIMD_Vectors * simd_vecs )
+{
+	simd_vecs->ds = default_ds;
+	simd_vecs->mu = default_mu;
+	simd_vecs->mu2 = default_mu2;
+}
+
 void run_kernel( Input * I, Source * S, Table * table)
 {
+	// Timed runs are checkpointed between blocks of segments (if asked)
+	if( I->checkpoint != NULL && !I->warmup )
+		run_checkpointed(I, S, table);
+	else
+		run_sweep(I, S, table, I->segments);
+}
+
+// Attenuates the given number of random segments across all threads
+void run_sweep( Input * I, Source * S, Table * table, long segments )
+{
+	// Sweep the ray traced tracks (if given a lattice)
+	if( I->geometry != NULL )
+		run_geometry_sweep(I, S, table);
+	// Stream the source data through memory a window at a time
+	else if( I->ooc != NULL )
+		run_out_of_core_sweep(I, S, table, segments);
+	else
+		run_window(I, S, table, segments, 0, I->source_3D_regions);
+}
+
+// Attenuates segments crossing random regions of [first_region,
+// first_region + regions)
+void run_window( Input * I, Source * S, Table * table, long segments,
+		int first_region, int regions )
+{
+	Kernel_Args args;
+	args.I = I;
+	args.S = S;
+	args.table = table;
+	args.segments = segments;
+	args.committed = 0;
+	args.first_region = first_region;
+	args.regions = regions;
+
+	// Build Segment Scheduler (per-thread deques if work stealing). The
+	// reproducible mode commits chunks in order, so takes them in order.
+	args.W = init_scheduler( I->reproducible ? SCHED_DYNAMIC : I->scheduler,
+			segments, I->nthreads, I->chunk_size );
+
 	// Enter Parallel Region
-	#pragma omp parallel default(none) shared(I, S, table)
+	parallel_region( kernel_thread, &args );
+
+	I->steals = total_steals(args.W);
+	free_scheduler(args.W);
+}
+
+// Body of the kernel parallel region, run by every thread
+void kernel_thread( void * args )
+{
+	Input * I = ((Kernel_Args *) args)->I;
+	Source * S = ((Kernel_Args *) args)->S;
+	Table * table = ((Kernel_Args *) args)->table;
+	Scheduler * W = ((Kernel_Args *) args)->W;
+	long segments = ((Kernel_Args *) args)->segments;
+	int first_region = ((Kernel_Args *) args)->first_region;
+	int regions = ((Kernel_Args *) args)->regions;
+
+	int thread = get_thread_num();
+
+	// Pin Thread to its CPU (if a placement policy was given)
+	pin_thread(I, thread);
+
+	// Start Timing the Thread (if instrumented)
+	#ifdef INSTRUMENT
+	instrument_thread_begin(I, thread);
+	#endif
+
+	// Progress Counter of this Thread (if monitoring)
+	long * progress = monitor_counter(I, thread);
+
+	// Create Thread Local Random Seed
+	unsigned int seed = thread_seed(I, thread, SWEEP_KERNEL);
+
+	double setup_start = get_time();
+
+	// Allocate Thread Local SIMD Vectors (align if using intel compiler)
+	#ifdef INTEL
+	SIMD_Vectors simd_vecs = aligned_allocate_simd_vectors(I);
+	float * state_flux = (float *) _mm_malloc(
+			I->egroups * sizeof(float), 64);
+	#else
+	SIMD_Vectors simd_vecs = allocate_simd_vectors(I);
+	float * state_flux = (float *) malloc(
+			I->egroups * sizeof(float));
+	#endif
+
+	// Allocate Thread Local Flux Vector
+	for( int i = 0; i < I->egroups; i++ )
+		state_flux[i] = (float) rand_r(&seed) / RAND_MAX;
+
+	// Pick Up Where the Last Block Left Off (if checkpointing)
+	Thread_State * resume = thread_state(I, thread);
+	if( resume != NULL && resume->valid )
 	{
-		#ifdef OPENMP
-		int thread = omp_get_thread_num();
-		#else
-		int thread = 0;
-		#endif
+		seed = resume->seed;
+		memcpy(state_flux, resume->state_flux, I->egroups * sizeof(float));
+	}
 
-		// Create Thread Local Random Seed
-		unsigned int seed = time(NULL) * (thread+1);
+	// Allocate Thread Local Tally Cache (if enabled)
+	tally_cache_begin(I);
 
-		// Allocate Thread Local SIMD Vectors (align if using intel compiler)
-		#ifdef INTEL
-		SIMD_Vectors simd_vecs = aligned_allocate_simd_vectors(I);
-		float * state_flux = (float *) _mm_malloc(
-				I->egroups * sizeof(float), 64);
-		#else
-		SIMD_Vectors simd_vecs = allocate_simd_vectors(I);
-		float * state_flux = (float *) malloc(
-				I->egroups * sizeof(float));
-		#endif
+	// Allocate Thread Local Tally Stage (if reproducible)
+	tally_stage_begin(I, I->chunk_size);
+
+	// Allocate Thread Local Pipeline Rings (if pipelined)
+	pipeline_begin(I);
 
-		// Allocate Thread Local Flux Vector
-		for( int i = 0; i < I->egroups; i++ )
-			state_flux[i] = (float) rand_r(&seed) / RAND_MAX;
+	phase_thread_setup(I, thread, get_time() - setup_start);
 
-		// Initialize PAPI Counters (if enabled)
-		#ifdef PAPI
-		int eventset = PAPI_NULL;
-		int num_papi_events;
+	// Initialize PAPI Counters (if enabled)
+	#ifdef PAPI
+	int eventset = PAPI_NULL;
+	int num_papi_events;
+	if( !I->warmup )
+	{
 		#pragma omp critical
 		{
 			counter_init(&eventset, &num_papi_events, I);
 		}
-		#endif
+	}
+	#endif
+
+	// Start perf_event Counters (if enabled)
+	#ifdef PERF
+	Perf_Thread perf_threads[N_PERF_GROUPS];
+	if( !I->warmup )
+		perf_start(I, perf_threads);
+	#endif
+
+	if( I->reproducible )
+	{
+		// Attenuate Fixed Chunks and Commit their Tallies in Order
+		long * committed = &((Kernel_Args *) args)->committed;
+		long begin, end;
+		while( next_dynamic_chunk(W, &begin, &end) )
+		{
+			attenuate_chunk( I, S, table, begin, end, state_flux,
+					&simd_vecs );
+			tally_stage_commit( I, S, tally_stage, committed,
+					begin / W->chunk );
+
+			if( progress != NULL )
+				monitor_add(progress, end - begin);
+		}
+	}
+	else if( pipeline != NULL )
+	{
+		// Generate, Attenuate and Tally in Separate Stages, over Batches
+		run_pipeline( I, S, table, W, thread, &seed, first_region, regions,
+				state_flux, &simd_vecs, progress );
+	}
+	else if( I->geometry != NULL )
+	{
+		// Trace Whole Tracks and Sweep them through Every Plane
+		run_tracks( I, S, table, W, thread, &seed, state_flux, &simd_vecs,
+				progress );
+	}
+	#ifdef OPENMP
+	else if( I->scheduler == SCHED_DYNAMIC )
+	{
+		long chunk = I->chunk_size;
+		long done = 0;
 
 		// Enter OMP For Loop over Segments
-		#pragma omp for schedule(dynamic,100)
-		for( long i = 0; i < I->segments; i++ )
+		#pragma omp for schedule(dynamic,chunk)
+		for( long i = 0; i < segments; i++ )
 		{
 			// Pick Random QSR
-			int QSR_id = rand_r(&seed) % I->source_3D_regions;
+			int QSR_id = first_region + rand_r(&seed) % regions;
 
 			// Pick Random Fine Axial Interval
 			int FAI_id = rand_r(&seed) % I->fine_axial_intervals;
@@ -52,10 +198,69 @@ void run_kernel( Input * I, Source * S, Table * table)
 			// Attenuate Segment
 			attenuate_segment( I, S, QSR_id, FAI_id, state_flux,
 					&simd_vecs, table);
+
+			// Report Progress Every 256 Segments
+			if( progress != NULL && ++done % 256 == 0 )
+				monitor_add(progress, 256);
+		}
+		if( progress != NULL )
+			monitor_add(progress, done % 256);
+	}
+	else
+	#endif
+	{
+		// Work Through Chunks Handed Out by the Scheduler
+		long begin, end;
+		while( next_chunk(W, thread, &seed, &begin, &end) )
+		{
+			for( long i = begin; i < end; i++ )
+			{
+				// Pick Random QSR
+				int QSR_id = first_region + rand_r(&seed) % regions;
+
+				// Pick Random Fine Axial Interval
+				int FAI_id = rand_r(&seed) % I->fine_axial_intervals;
+
+				// Attenuate Segment
+				attenuate_segment( I, S, QSR_id, FAI_id, state_flux,
+						&simd_vecs, table);
+			}
+
+			// Report Progress Once per Chunk
+			if( progress != NULL )
+				monitor_add(progress, end - begin);
 		}
+	}
+
+	// Write Back the Tally Cache
+	tally_cache_end(I, S);
+	tally_stage_end();
+	pipeline_end(I);
+
+	// Save the State for the Next Block (if checkpointing)
+	if( resume != NULL )
+	{
+		resume->seed = seed;
+		memcpy(resume->state_flux, state_flux, I->egroups * sizeof(float));
+		resume->valid = 1;
+	}
 
-		// Stop PAPI Counters
-		#ifdef PAPI
+	// Stop Timing the Thread, Once All Threads are Done
+	#ifdef INSTRUMENT
+	thread_barrier();
+	instrument_thread_end();
+	#endif
+
+	// Stop perf_event Counters
+	#ifdef PERF
+	if( !I->warmup )
+		perf_stop(I, perf_threads, thread);
+	#endif
+
+	// Stop PAPI Counters
+	#ifdef PAPI
+	if( !I->warmup )
+	{
 		if( thread == 0 )
 		{
 			printf("\n");
@@ -64,61 +269,92 @@ void run_kernel( Input * I, Source * S, Table * table)
 			border_print();
 			printf("Count          \tSmybol      \tDescription\n");
 		}
-		{
-			#pragma omp barrier
-		}
+		thread_barrier();
 		counter_stop(&eventset, num_papi_events, I);
-		#endif
 	}
+	#endif
+
+	// Free Thread Local Vectors
+	free_simd_vectors(&simd_vecs);
+	#ifdef INTEL
+	_mm_free(state_flux);
+	#else
+	free(state_flux);
+	#endif
 }
 
 void attenuate_segment( Input * restrict I, Source * restrict S,
 		int QSR_id, int FAI_id, float * restrict state_flux,
 		SIMD_Vectors * restrict simd_vecs, Table * restrict table) 
 {
-	// Unload local vector vectors
-	float * restrict q0 =            simd_vecs->q0;
-	float * restrict q1 =            simd_vecs->q1;
-	float * restrict q2 =            simd_vecs->q2;
-	float * restrict sigT =          simd_vecs->sigT;
-	float * restrict tau =           simd_vecs->tau;
-	float * restrict sigT2 =         simd_vecs->sigT2;
-	float * restrict expVal =        simd_vecs->expVal;
-	float * restrict reuse =         simd_vecs->reuse;
-	float * restrict flux_integral = simd_vecs->flux_integral;
-	float * restrict tally =         simd_vecs->tally;
-	float * restrict t1 =            simd_vecs->t1;
-	float * restrict t2 =            simd_vecs->t2;
-	float * restrict t3 =            simd_vecs->t3;
-	float * restrict t4 =            simd_vecs->t4;
-
-	// Some placeholder constants - In the full app some of these are
-	// calculated based off position in geometry. This treatment
-	// shaves off a few FLOPS, but is not significant compared to the
-	// rest of the function.
-	const float dz = 0.1f;
-	const float zin = 0.3f; 
-	const float weight = 0.5f;
-	const float mu = 0.9f;
-	const float mu2 = 0.3f;
-	const float ds = 0.7f;
-
 	const int egroups = I->egroups;
+	const int tile = I->tile_size;
 
-	// load fine source region flux vector
-	float * FSR_flux = &S[QSR_id].fine_flux[FAI_id * egroups];
+	#ifdef INSTRUMENT
+	unsigned long long start = read_ticks();
+	#endif
+
+	// Run every stage over one L1-sized block of energy groups before
+	// moving on to the next, so the scratch vectors never leave L1
+	for( int g0 = 0; g0 < egroups; g0 += tile )
+	{
+		int ng = egroups - g0;
+		if( ng > tile )
+			ng = tile;
+
+		attenuate_tile( I, S, QSR_id, FAI_id, g0, ng, state_flux + g0,
+				simd_vecs, table );
+	}
+
+	#ifdef INSTRUMENT
+	instrument_segment(start);
+	#endif
+}
+
+/* Attenuates energy groups [g0, g0 + ng) of a segment. The SIMD vectors
+ * are indexed from 0 within the tile, while source data and state_flux
+ * are offset to the start of the tile. */
+void attenuate_tile( Input * restrict I, Source * restrict S,
+		int QSR_id, int FAI_id, int g0, int ng,
+		float * restrict state_flux, SIMD_Vectors * restrict simd_vecs,
+		Table * restrict table )
+{
+	fit_source( I, S, QSR_id, FAI_id, g0, ng, simd_vecs );
+	load_cross_sections( I, S, QSR_id, g0, ng, simd_vecs );
+	#ifdef TABLE
+	exponential_table( ng, simd_vecs, table );
+	#else
+	exponential_expf( ng, simd_vecs );
+	#endif
+	compute_flux_integral( ng, state_flux, simd_vecs );
+	tally_flux( I, S, QSR_id, FAI_id, g0, ng, simd_vecs );
+	compute_outgoing_flux( ng, state_flux, simd_vecs );
+}
+
+// Fits the fine axial sources around the segment (linear at the ends of
+// the region, quadratic elsewhere) to get q0, q1 and q2
+void fit_source( Input * restrict I, Source * restrict S,
+		int QSR_id, int FAI_id, int g0, int ng,
+		SIMD_Vectors * restrict simd_vecs )
+{
+	float * restrict q0 = simd_vecs->q0;
+	float * restrict q1 = simd_vecs->q1;
+	float * restrict q2 = simd_vecs->q2;
+
+	const int egroups = I->egroups;
+	float * fine_source = region_fine_source(I, S, QSR_id);
 
 	if( FAI_id == 0 )
 	{
-		float * f2 = &S[QSR_id].fine_source[FAI_id*egroups]; 
-		float * f3 = &S[QSR_id].fine_source[(FAI_id+1)*egroups]; 
+		float * f2 = &fine_source[FAI_id*egroups + g0]; 
+		float * f3 = &fine_source[(FAI_id+1)*egroups + g0]; 
 		// cycle over energy groups
 		#ifdef INTEL
 		#pragma vector
 		#elif defined IBM
 		#pragma vector_level(10)
 		#endif
-		for( int g = 0; g < egroups; g++)
+		for( int g = 0; g < ng; g++)
 		{
 			// load neighboring sources
 			const float y2 = f2[g];
@@ -136,15 +372,15 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	}
 	else if ( FAI_id == I->fine_axial_intervals - 1 )
 	{
-		float * f1 = &S[QSR_id].fine_source[(FAI_id-1)*egroups]; 
-		float * f2 = &S[QSR_id].fine_source[FAI_id*egroups]; 
+		float * f1 = &fine_source[(FAI_id-1)*egroups + g0]; 
+		float * f2 = &fine_source[FAI_id*egroups + g0]; 
 		// cycle over energy groups
 		#ifdef INTEL
 		#pragma vector
 		#elif defined IBM
 		#pragma vector_level(10)
 		#endif
-		for( int g = 0; g < egroups; g++)
+		for( int g = 0; g < ng; g++)
 		{
 			// load neighboring sources
 			const float y1 = f1[g];
@@ -162,16 +398,16 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	}
 	else
 	{
-		float * f1 = &S[QSR_id].fine_source[(FAI_id-1)*egroups]; 
-		float * f2 = &S[QSR_id].fine_source[FAI_id*egroups]; 
-		float * f3 = &S[QSR_id].fine_source[(FAI_id+1)*egroups]; 
+		float * f1 = &fine_source[(FAI_id-1)*egroups + g0]; 
+		float * f2 = &fine_source[FAI_id*egroups + g0]; 
+		float * f3 = &fine_source[(FAI_id+1)*egroups + g0]; 
 		// cycle over energy groups
 		#ifdef INTEL
 		#pragma vector
 		#elif defined IBM
 		#pragma vector_level(10)
 		#endif
-		for( int g = 0; g < egroups; g++)
+		for( int g = 0; g < ng; g++)
 		{
 			// load neighboring sources
 			const float y1 = f1[g]; 
@@ -189,7 +425,19 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 			q2[g] = c2;
 		}
 	}
+}
 
+// Loads the total cross sections and the optical length of the segment
+void load_cross_sections( Input * restrict I, Source * restrict S,
+		int QSR_id, int g0, int ng, SIMD_Vectors * restrict simd_vecs )
+{
+	float * restrict sigT =  simd_vecs->sigT;
+	float * restrict tau =   simd_vecs->tau;
+	float * restrict sigT2 = simd_vecs->sigT2;
+	const float ds = simd_vecs->ds;
+
+	// load total cross section vector
+	float * sigT_src = region_sigT(I, S, QSR_id) + g0;
 
 	// cycle over energy groups
 	#ifdef INTEL
@@ -197,15 +445,22 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		// load total cross section
-		sigT[g] = S[QSR_id].sigT[g];
+		sigT[g] = sigT_src[g];
 
 		// calculate common values for efficiency
 		tau[g] = sigT[g] * ds;
 		sigT2[g] = sigT[g] * sigT[g];
 	}
+}
+
+// Computes 1 - exp(-tau) with the math library
+void exponential_expf( int ng, SIMD_Vectors * restrict simd_vecs )
+{
+	float * restrict tau =    simd_vecs->tau;
+	float * restrict expVal = simd_vecs->expVal;
 
 	// cycle over energy groups
 	#ifdef INTEL
@@ -213,14 +468,47 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
-		#ifdef TABLE
-		expVal[g] = interpolateTable( table, tau[g] );  
-		#else
 		expVal[g] = 1.f - expf( -tau[g] ); // exp is faster on many architectures
-		#endif
 	}
+}
+
+// Computes 1 - exp(-tau) by interpolating the exponential table
+void exponential_table( int ng, SIMD_Vectors * restrict simd_vecs,
+		Table * restrict table )
+{
+	float * restrict tau =    simd_vecs->tau;
+	float * restrict expVal = simd_vecs->expVal;
+
+	// cycle over energy groups
+	#ifdef INTEL
+	#pragma vector aligned
+	#elif defined IBM
+	#pragma vector_level(10)
+	#endif
+	for( int g = 0; g < ng; g++)
+	{
+		expVal[g] = interpolateTable( table, tau[g] );  
+	}
+}
+
+// Integrates the angular flux over the segment and prepares the tally
+void compute_flux_integral( int ng, float * restrict state_flux,
+		SIMD_Vectors * restrict simd_vecs )
+{
+	float * restrict q0 =            simd_vecs->q0;
+	float * restrict q1 =            simd_vecs->q1;
+	float * restrict q2 =            simd_vecs->q2;
+	float * restrict sigT =          simd_vecs->sigT;
+	float * restrict tau =           simd_vecs->tau;
+	float * restrict sigT2 =         simd_vecs->sigT2;
+	float * restrict expVal =        simd_vecs->expVal;
+	float * restrict reuse =         simd_vecs->reuse;
+	float * restrict flux_integral = simd_vecs->flux_integral;
+	float * restrict tally =         simd_vecs->tally;
+	const float mu =                 simd_vecs->mu;
+	const float mu2 =                simd_vecs->mu2;
 
 	// Flux Integral
 
@@ -230,7 +518,7 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		reuse[g] = tau[g] * (tau[g] - 2.f) + 2.f * expVal[g] 
 			/ (sigT[g] * sigT2[g]); 
@@ -242,7 +530,7 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		// add contribution to new source flux
 		flux_integral[g] = (q0[g] * tau[g] + (sigT[g] * state_flux[g] - q0[g])
@@ -256,14 +544,62 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		// Prepare tally
 		tally[g] = weight * flux_integral[g];
 	}
+}
 
-	#ifdef OPENMP
-	omp_set_lock(S[QSR_id].locks + FAI_id);
+// Adds the tally into the fine source region flux, under the region's lock
+void tally_flux( Input * restrict I, Source * restrict S,
+		int QSR_id, int FAI_id, int g0, int ng,
+		SIMD_Vectors * restrict simd_vecs )
+{
+	float * restrict tally = simd_vecs->tally;
+
+	// Queue the tally for the tally stage, if pipelined
+	if( pipeline != NULL )
+	{
+		pipeline_add_tally(pipeline,
+				(long) QSR_id * I->fine_axial_intervals + FAI_id, g0, ng,
+				tally);
+		return;
+	}
+
+	// Stage the tally for an ordered commit, if reproducible
+	if( tally_stage != NULL )
+	{
+		tally_stage_add(tally_stage,
+				(long) QSR_id * I->fine_axial_intervals + FAI_id, g0, ng,
+				tally);
+		return;
+	}
+
+	// Accumulate into the thread's tally cache instead, if there is one
+	if( tally_cache != NULL )
+	{
+		float * restrict line = tally_cache_line(I, S, tally_cache,
+				QSR_id, FAI_id, g0) + g0;
+		for( int g = 0; g < ng; g++)
+			line[g] += tally[g];
+		tally_cache->updates++;
+		return;
+	}
+
+	// load fine source region flux vector
+	float * FSR_flux = region_fine_flux(I, S, QSR_id) +
+		FAI_id * I->egroups + g0;
+
+	#ifdef MULTITHREADED
+	Lock * lock = fsr_lock(I, S, QSR_id, FAI_id);
+	#endif
+
+	#if defined MULTITHREADED && defined INSTRUMENT
+	instrumented_set_lock(I, lock,
+			(long) QSR_id * I->fine_axial_intervals + FAI_id);
+	#elif defined MULTITHREADED
+	set_lock(lock);
 	#endif
 
 	#ifdef INTEL
@@ -271,14 +607,34 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		FSR_flux[g] += tally[g];
 	}
 
-	#ifdef OPENMP
-	omp_unset_lock(S[QSR_id].locks + FAI_id);
+	#ifdef MULTITHREADED
+	unset_lock(lock);
 	#endif
+}
+
+// Computes the angular flux leaving the segment
+void compute_outgoing_flux( int ng, float * restrict state_flux,
+		SIMD_Vectors * restrict simd_vecs )
+{
+	float * restrict q0 =     simd_vecs->q0;
+	float * restrict q1 =     simd_vecs->q1;
+	float * restrict q2 =     simd_vecs->q2;
+	float * restrict sigT =   simd_vecs->sigT;
+	float * restrict tau =    simd_vecs->tau;
+	float * restrict sigT2 =  simd_vecs->sigT2;
+	float * restrict expVal = simd_vecs->expVal;
+	float * restrict reuse =  simd_vecs->reuse;
+	float * restrict t1 =     simd_vecs->t1;
+	float * restrict t2 =     simd_vecs->t2;
+	float * restrict t3 =     simd_vecs->t3;
+	float * restrict t4 =     simd_vecs->t4;
+	const float mu =          simd_vecs->mu;
+	const float mu2 =         simd_vecs->mu2;
 
 	// Term 1
 	#ifdef INTEL
@@ -286,7 +642,7 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		t1[g] = q0[g] * expVal[g] / sigT[g];  
 	}
@@ -296,7 +652,7 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		t2[g] = q1[g] * mu * (tau[g] - expVal[g]) / sigT2[g]; 
 	}
@@ -306,7 +662,7 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		t3[g] =	q2[g] * mu2 * reuse[g];
 	}
@@ -316,7 +672,7 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		t4[g] = state_flux[g] * (1.f - expVal[g]);
 	}
@@ -326,11 +682,89 @@ void attenuate_segment( Input * restrict I, Source * restrict S,
 	#elif defined IBM
 	#pragma vector_level(10)
 	#endif
-	for( int g = 0; g < egroups; g++)
+	for( int g = 0; g < ng; g++)
 	{
 		state_flux[g] = t1[g] + t2[g] + t3[g] + t4[g];
 	}
-}	
+}
+
+// Floating point operations per energy group of each stage. Divides count
+// as one operation, as does each exp() or table lookup. The source fit
+// averages the linear fits at the ends of the region with the quadratic
+// fits in between.
+double stage_flops( Input * I, int stage )
+{
+	double fai = I->fine_axial_intervals;
+
+	switch( stage )
+	{
+		case STAGE_SOURCE_FIT:
+			if( fai < 3 )
+				return 4;
+			return (2 * 4 + (fai - 2) * 12) / fai;
+		case STAGE_CROSS_SECTIONS: return 2;
+		case STAGE_EXPONENTIAL:
+			#ifdef TABLE
+			return 5;
+			#else
+			return 2;
+			#endif
+		case STAGE_FLUX_INTEGRAL:  return 29;
+		case STAGE_TALLY:          return 1;
+		case STAGE_OUTGOING_FLUX:  return 13;
+	}
+
+	return 0;
+}
+
+// Bytes of source data each stage moves per energy group. The SIMD vectors
+// and state_flux stay in L1 and aren't counted, while table builds also
+// load a slope and intercept per group. Each tile of a segment also loads
+// its source metadata, amortized over the groups of the tile: the
+// per-region layout loads the region's pointer to each array (and to its
+// locks), while the compact layout works out offsets from one Source that
+// stays in cache. Threaded builds read and write a lock per tile - a
+// region's own lock, or the lock stripe it hashes onto.
+double stage_bytes( Input * I, int stage )
+{
+	double fai = I->fine_axial_intervals;
+	int tile = I->tile_size < 1 ? I->egroups : I->tile_size;
+	double tiles = (double) ((I->egroups + tile - 1) / tile) / I->egroups;
+
+	#ifdef COMPACT
+	double pointer = 0;
+	#else
+	double pointer = sizeof(float *) * tiles;
+	#endif
+
+	#ifdef MULTITHREADED
+	double lock = 2 * sizeof(Lock) * tiles;
+	#ifndef COMPACT
+	lock += sizeof(Lock *) * tiles;
+	#endif
+	#else
+	double lock = 0;
+	#endif
+
+	switch( stage )
+	{
+		case STAGE_SOURCE_FIT:
+			if( fai < 3 )
+				return 2 * sizeof(float) + pointer;
+			return (2 * 2 + (fai - 2) * 3) / fai * sizeof(float) + pointer;
+		case STAGE_CROSS_SECTIONS: return sizeof(float) + pointer;
+		case STAGE_EXPONENTIAL:
+			#ifdef TABLE
+			return 2 * sizeof(float);
+			#else
+			return 0;
+			#endif
+		case STAGE_TALLY: // read + write
+			return 2 * sizeof(float) + pointer + lock;
+	}
+
+	return 0;
+}
 
 /* Interpolates a formed exponential table to compute ( 1- exp(-x) )
  *  at the desired x value */
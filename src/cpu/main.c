@@ -3,60 +3,343 @@
 int main( int argc, char * argv[] )
 {
 	int version = 4;
+	int status = 0;
+
+	#ifdef MPI
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	#endif
 
 	#ifdef PAPI
 	papi_serial_init();
 	#endif
 
-	srand(time(NULL));
-
 	// Get Inputs
 	Input * I = set_default_input();
+	phase_begin(I, PHASE_CLI);
 	read_CLI( argc, argv, I );
+	init_phase_threads(I);
+
+	#ifdef MPI
+	MPI_Comm_rank(MPI_COMM_WORLD, &I->rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &I->nranks);
+	#endif
+
+	srand(run_seed(I) + I->rank);
 	
 	// Calculate Number of 3D Source Regions
-	I->source_3D_regions = (int) ceil((double)I->source_2D_regions *
-		I->coarse_axial_intervals / I->decomp_assemblies_ax);
+	I->source_3D_regions = count_3D_regions(I);
 
-	logo(version);
+	// Size Energy Group Tiles to Fit in L1
+	I->tile_size = select_tile_size(I);
+	phase_end(I, PHASE_CLI);
 
-	#ifdef OPENMP
-	omp_set_num_threads(I->nthreads); 
-	#endif
+	if( I->rank == 0 )
+		logo(version);
+
+	phase_begin(I, PHASE_THREADS);
+	set_num_threads(I->nthreads); 
+
+	// Decide Thread Placement
+	map_threads_to_cpus(I);
+	phase_end(I, PHASE_THREADS);
 	
+	// Scaling Study (if any lists were given)
+	if( I->scaling != NULL )
+	{
+		Table * table;
+		#ifdef TABLE
+		table = buildExponentialTable( 0.01, 10.0, I );
+		#endif
+
+		run_scaling_study(I, table);
+
+		#ifdef MPI
+		MPI_Finalize();
+		#endif
+		return 0;
+	}
+
 	// Build Source Data
 	Source * S = initialize_sources(I); 
+
+	// Lay Down and Trace the Tracks (if given a lattice)
+	if( I->lattice_pins > 0 )
+	{
+		phase_begin(I, PHASE_TRACKS);
+		I->geometry = init_geometry(I);
+		phase_end(I, PHASE_TRACKS);
+	}
 	
 	// Build Exponential Table
 	Table * table;
 	#ifdef TABLE
+	phase_begin(I, PHASE_TABLE);
 	table = buildExponentialTable( 0.01, 10.0, I );
+	phase_end(I, PHASE_TABLE);
 	#endif
 	
-	print_input_summary(I);
+	// Build Axial Boundary Flux Buffers
+	#ifdef MPI
+	phase_begin(I, PHASE_DOMAIN);
+	Domain * D = init_domain(I);
+	phase_end(I, PHASE_DOMAIN);
+	#endif
+
+	if( I->rank == 0 )
+	{
+		print_input_summary(I);
 
-	center_print("SIMULATION", 79);
-	border_print();
-	printf("Attentuating fluxes across segments...\n");
+		center_print("SIMULATION", 79);
+		border_print();
+	}
 
-	double start, stop;
+	// Measure Bandwidth and Compute Roofs (if requested)
+	if( I->probe )
+	{
+		if( I->rank == 0 )
+			printf("Probing memory bandwidth and compute roofs...\n");
+		phase_begin(I, PHASE_PROBE);
+		I->peak_bandwidth = probe_bandwidth(I);
+		I->peak_gflops = probe_compute(I);
+		phase_end(I, PHASE_PROBE);
+	}
+
+	// Pick Chunk Size from Warmup Sweeps (if requested)
+	if( I->chunk_size == 0 )
+	{
+		if( I->rank == 0 )
+			printf("Autotuning chunk size...\n");
+		phase_begin(I, PHASE_AUTOTUNE);
+		I->chunk_size = autotune_chunk_size(I, S, table);
+		phase_end(I, PHASE_AUTOTUNE);
+	}
+
+	// Untimed Warmup Runs
+	phase_begin(I, PHASE_WARMUP);
+	I->warmup = 1;
+	for( int w = 0; w < I->warmup_runs; w++ )
+	{
+		if( I->rank == 0 )
+			printf("Warmup run %d of %d...\n", w+1, I->warmup_runs);
+		run_kernel(I, S, table);
+	}
+	I->warmup = 0;
+	phase_end(I, PHASE_WARMUP);
+
+	if( I->rank == 0 )
+		printf("Attentuating fluxes across segments...\n");
+
+	// Segments attenuated by this process
+	long segments = I->segments;
+	#ifdef MPI
+	segments += 2L * I->sweeps * I->boundary_tracks * I->fine_axial_intervals;
+	#endif
+
+	Results * R = init_results( I->repetitions, segments, I->egroups );
+
+	// Instrument the Timed Runs
+	#ifdef INSTRUMENT
+	I->stats = init_instrumentation(I);
+	#endif
+
+	// Count Hardware Events over the Timed Runs
+	#ifdef PERF
+	I->perf = perf_init(I);
+	#endif
+
+	// Checkpoint the Timed Runs (if asked for), and Resume from the Last
+	// Checkpoint (if restarting)
+	int first_run = 0;
+	if( I->checkpoint_file != NULL )
+	{
+		I->checkpoint = init_checkpoint(I);
+		I->checkpoint->results = R->runtimes;
+		if( I->restart )
+			first_run = restore_checkpoint(I, S, R);
+	}
+
+	// Watch Progress Live (if asked for)
+	if( I->monitor_interval > 0 && I->rank == 0 )
+		I->monitor = start_monitor(I, segments);
 
 	// Run Simulation Kernel Loop
-	start = get_time();
-	run_kernel(I, S, table);
-	stop = get_time();
+	phase_begin(I, PHASE_KERNEL);
+	for( int r = first_run; r < I->repetitions; r++ )
+	{
+		double start, stop;
+
+		if( I->checkpoint != NULL )
+			I->checkpoint->repetition = r;
+
+		// perf Groups Take Turns Counting (unless multiplexed)
+		#ifdef PERF
+		I->perf_active = r % I->n_perf_groups;
+		#endif
+
+		#ifdef MPI
+		MPI_Barrier(MPI_COMM_WORLD);
+		start = get_time();
+		run_decomposed(I, S, table, D);
+		stop = get_time();
+		#else
+		start = get_time();
+		run_kernel(I, S, table);
+		stop = get_time();
+		#endif
 
-	printf("Simulation Complete.\n");
+		R->runtimes[r] = stop - start;
+		if( I->checkpoint != NULL )
+			R->runtimes[r] += checkpoint_resumed_time(I->checkpoint);
 
-	border_print();
-	center_print("RESULTS SUMMARY", 79);
-	border_print();
+		#ifdef PERF
+		perf_add_run(I, R->runtimes[r]);
+		#endif
+	}
 
-	double tpi = ((double) (stop - start) /
-			(double)I->segments / (double) I->egroups) * 1.0e9;
-	printf("%-25s%.3lf seconds\n", "Runtime:", stop-start);
-	printf("%-25s%.3lf ns\n", "Time per Intersection:", tpi);
-	border_print();
+	phase_end(I, PHASE_KERNEL);
+
+	// The Runs are Done, so the Checkpoint Can Go
+	if( I->checkpoint != NULL )
+		finish_checkpoint(I->checkpoint, 1);
+
+	if( I->monitor != NULL )
+	{
+		stop_monitor(I->monitor);
+		I->monitor = NULL;
+	}
+
+	compute_statistics(R);
+
+	// Checksum the Fine Flux, then Time the Locked Tally to Compare (these
+	// runs count as warmups, so no counters or progress see them)
+	if( I->reproducible )
+	{
+		phase_begin(I, PHASE_REFERENCE);
+		I->flux_checksum = flux_checksum(I, S);
+		if( I->rank == 0 )
+			printf("Timing the locked tally for comparison...\n");
+
+		Results * L = init_results( I->repetitions, segments, I->egroups );
+		I->reproducible = 0;
+		I->warmup = 1;
+		for( int r = 0; r < I->repetitions; r++ )
+		{
+			double start, stop;
+
+			#ifdef MPI
+			MPI_Barrier(MPI_COMM_WORLD);
+			start = get_time();
+			run_decomposed(I, S, table, D);
+			stop = get_time();
+			#else
+			start = get_time();
+			run_kernel(I, S, table);
+			stop = get_time();
+			#endif
+
+			L->runtimes[r] = stop - start;
+		}
+		I->warmup = 0;
+		I->reproducible = 1;
+
+		compute_statistics(L);
+		I->locked_runtime = L->median;
+		free(L->runtimes);
+		free(L);
+		phase_end(I, PHASE_REFERENCE);
+	}
+
+	// Time Tracing Alone, and Sweeps of Traced and Stored Segments (these
+	// runs count as warmups too)
+	if( I->geometry != NULL )
+	{
+		phase_begin(I, PHASE_TRACKING);
+		if( I->rank == 0 )
+			printf("Comparing on-the-fly and stored segments...\n");
+		compare_tracking(I, S, table);
+		phase_end(I, PHASE_TRACKING);
+	}
+
+	// Free the Source Data and Table
+	phase_begin(I, PHASE_TEARDOWN);
+	free_sources(I, S);
+	#ifdef TABLE
+	free_table(table);
+	#endif
+	phase_end(I, PHASE_TEARDOWN);
+
+	if( I->rank == 0 )
+	{
+		printf("Simulation Complete.\n");
+
+		border_print();
+		center_print("RESULTS SUMMARY", 79);
+		border_print();
+
+		print_results(R);
+		printf("%-25s%ld\n", "Chunk Size:", I->chunk_size);
+		if( I->scheduler == SCHED_STEAL )
+			printf("%-25s%ld\n", "Steals:", I->steals);
+		if( I->tally_cache_lines > 0 )
+			print_tally_cache(I);
+		if( I->pipeline_depth > 0 )
+			print_pipeline(I);
+		if( I->reproducible )
+			print_reproducible(I, R);
+		if( I->ooc != NULL )
+			print_out_of_core(I);
+		if( I->checkpoint != NULL )
+			print_checkpoint(I);
+
+		if( I->geometry != NULL )
+		{
+			border_print();
+			center_print("TRACKING", 79);
+			border_print();
+			print_tracking(I);
+		}
+
+		border_print();
+		center_print("ROOFLINE", 79);
+		border_print();
+		print_roofline(I, R);
+
+		border_print();
+		center_print("PHASE TIMING", 79);
+		border_print();
+		print_phases(I);
+
+		#ifdef INSTRUMENT
+		print_instrumentation(I);
+		#endif
+
+		#ifdef PERF
+		print_perf_counters(I, R);
+		#endif
+
+		if( I->results_file != NULL )
+			write_results(I, R, I->results_file);
+
+		if( I->baseline != NULL )
+			status = check_regression(I, R) ? 2 : 0;
+	}
+
+	// Every rank exits with the verdict of the regression check
+	#ifdef MPI
+	MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	#endif
+
+	#ifdef MPI
+	print_domain_summary(I, D);
+	#endif
+
+	if( I->rank == 0 )
+		border_print();
+
+	#ifdef MPI
+	MPI_Finalize();
+	#endif
 
-	return 0;
+	return status;
 }
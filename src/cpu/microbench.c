@@ -0,0 +1,364 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Per-stage microbenchmarks of the attenuation pipeline. Every stage of
+// attenuate_segment is timed on its own, single threaded, over random
+// segments of source data sized to sit in L1, in L2 or in DRAM.
+
+#define MB_SOURCE_FIT 0
+#define MB_CROSS_SECTIONS 1
+#define MB_EXP_EXPF 2
+#define MB_EXP_TABLE 3
+#define MB_FLUX_INTEGRAL 4
+#define MB_TALLY 5
+#define MB_OUTGOING_FLUX 6
+#define MB_SEGMENT 7
+#define MB_STAGES 8
+
+static const char * mb_stage_names[MB_STAGES] = { "Source Fit",
+	"Cross Sections", "Exponential (expf)", "Exponential (table)",
+	"Flux Integral", "Tally (locked)", "Outgoing Flux", "Full Segment" };
+
+static const char * mb_set_names[3] = { "L1", "L2", "DRAM" };
+
+int main( int argc, char * argv[] )
+{
+	#ifdef MPI
+	MPI_Init(&argc, &argv);
+	#endif
+
+	Input * I = set_default_input();
+	Microbench M = read_microbench_CLI( argc, argv );
+
+	logo(4);
+	center_print("ATTENUATION STAGE MICROBENCHMARKS", 79);
+	border_print();
+
+	// Working sets - half of L1 and L2, and well past the last level cache
+	long L1 = detect_cache_size(1);
+	long L2 = detect_cache_size(2);
+	long L3 = detect_cache_size(3);
+	long sets[3] = { L1 / 2, L2 / 2, M.dram_bytes };
+	if( sets[2] == 0 )
+	{
+		sets[2] = 4 * L3;
+		if( sets[2] < 256L * 1024 * 1024 )
+			sets[2] = 256L * 1024 * 1024;
+	}
+
+	printf("%-25s%ld KB / %ld KB / %ld KB\n", "L1 / L2 / L3 Cache:",
+			L1 / 1024, L2 / 1024, L3 / 1024);
+	printf("%-25s%d\n", "Fine Axial Intervals:", I->fine_axial_intervals);
+	printf("%-25s%ld\n", "Groups per Measurement:", M.work);
+	printf("%-25s%d\n", "Repetitions (best of):", M.repetitions);
+	#ifdef MULTITHREADED
+	printf("%-25s%s\n", "Tally Locks:", "yes (uncontended)");
+	#else
+	printf("%-25s%s\n", "Tally Locks:", "no (serial build)");
+	#endif
+	border_print();
+
+	FILE * fp = NULL;
+	if( M.results_file != NULL )
+	{
+		fp = fopen(M.results_file, "w");
+		if( fp == NULL )
+			fprintf(stderr, "Unable to open results file %s\n",
+					M.results_file);
+		else
+			fprintf(fp, "egroups,tile_size,working_set,working_set_bytes,"
+					"source_3D_regions,stage,ns_per_group,gflops\n");
+	}
+
+	for( int e = 0; e < M.n_egroups; e++ )
+	{
+		I->egroups = (int) M.egroups[e];
+		I->tile_size = -1;
+		I->tile_size = select_tile_size(I);
+
+		Table * table = buildExponentialTable( 0.01, 10.0, I );
+		#ifdef INTEL
+		SIMD_Vectors simd_vecs = aligned_allocate_simd_vectors(I);
+		float * state_flux = (float *) _mm_malloc(
+				I->egroups * sizeof(float), 64);
+		#else
+		SIMD_Vectors simd_vecs = allocate_simd_vectors(I);
+		float * state_flux = (float *) malloc( I->egroups * sizeof(float));
+		#endif
+		for( int g = 0; g < I->egroups; g++ )
+			state_flux[g] = (float) rand() / RAND_MAX;
+
+		double ns[3][MB_STAGES];
+		int regions[3];
+		long bytes[3];
+
+		for( int w = 0; w < 3; w++ )
+		{
+			Source * S = build_working_set(I, sets[w]);
+			regions[w] = I->source_3D_regions;
+			bytes[w] = working_set_bytes(I);
+
+			long segments = M.work / I->egroups;
+			if( segments < 1000 )
+				segments = 1000;
+
+			for( int s = 0; s < MB_STAGES; s++ )
+			{
+				// Fill the SIMD vectors, so every stage sees real inputs
+				attenuate_segment( I, S, 0, 0, state_flux, &simd_vecs,
+						table );
+
+				double best = 0;
+				for( int r = 0; r <= M.repetitions; r++ )
+				{
+					double t = time_stage(I, S, table, &simd_vecs,
+							state_flux, s, segments);
+
+					// The first pass only warms up the working set
+					if( r == 1 || (r > 1 && t < best) )
+						best = t;
+				}
+				ns[w][s] = best / segments / I->egroups * 1.0e9;
+			}
+
+			free_sources(I, S);
+		}
+
+		printf("Energy Groups: %d   Tile: %d   Regions: %d / %d / %d\n",
+				I->egroups, I->tile_size, regions[0], regions[1], regions[2]);
+		printf("%-22s", "");
+		for( int w = 0; w < 3; w++ )
+		{
+			char label[64];
+			if( bytes[w] >= 10L * 1024 * 1024 )
+				sprintf(label, "%s (%ld MB)", mb_set_names[w],
+						bytes[w] / 1024 / 1024);
+			else
+				sprintf(label, "%s (%ld KB)", mb_set_names[w], bytes[w] / 1024);
+			printf("%-19s", label);
+		}
+		printf("\n%-22s", "Stage");
+		for( int w = 0; w < 3; w++ )
+			printf("%-9s%-10s", "ns/grp", "GFLOP/s");
+		printf("\n");
+
+		for( int s = 0; s < MB_STAGES; s++ )
+		{
+			double flops = microbench_flops(I, s);
+			printf("%-22s", mb_stage_names[s]);
+			for( int w = 0; w < 3; w++ )
+				printf("%-9.3lf%-10.3lf", ns[w][s], flops / ns[w][s]);
+			printf("\n");
+
+			if( fp != NULL )
+				for( int w = 0; w < 3; w++ )
+					fprintf(fp, "%d,%d,%s,%ld,%d,%s,%.6lf,%.6lf\n",
+							I->egroups, I->tile_size, mb_set_names[w],
+							bytes[w], regions[w], mb_stage_names[s],
+							ns[w][s], flops / ns[w][s]);
+		}
+		border_print();
+
+		free_simd_vectors(&simd_vecs);
+		#ifdef INTEL
+		_mm_free(state_flux);
+		#else
+		free(state_flux);
+		#endif
+		free_table(table);
+	}
+
+	if( fp != NULL )
+		fclose(fp);
+
+	#ifdef MPI
+	MPI_Finalize();
+	#endif
+
+	return 0;
+}
+
+Microbench read_microbench_CLI( int argc, char * argv[] )
+{
+	Microbench M;
+	M.n_egroups = parse_range_list("16-1024:x4", &M.egroups);
+	M.repetitions = 3;
+	M.work = 1L << 24;
+	M.dram_bytes = 0;
+	M.results_file = NULL;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		char * arg = argv[i];
+
+		// List of group counts (-e)
+		if( strcmp(arg, "-e") == 0 )
+		{
+			if( ++i < argc )
+			{
+				free(M.egroups);
+				M.n_egroups = parse_range_list(argv[i], &M.egroups);
+				if( M.n_egroups == 0 )
+					print_microbench_CLI_error();
+				for( int e = 0; e < M.n_egroups; e++ )
+					if( M.egroups[e] < 1 )
+						print_microbench_CLI_error();
+			}
+			else
+				print_microbench_CLI_error();
+		}
+		// Repetitions (-r)
+		else if( strcmp(arg, "-r") == 0 )
+		{
+			if( ++i < argc )
+				M.repetitions = atoi(argv[i]);
+			else
+				print_microbench_CLI_error();
+		}
+		// Energy groups per measurement (-n)
+		else if( strcmp(arg, "-n") == 0 )
+		{
+			if( ++i < argc )
+				M.work = atol(argv[i]);
+			else
+				print_microbench_CLI_error();
+		}
+		// DRAM working set in MB (-m)
+		else if( strcmp(arg, "-m") == 0 )
+		{
+			if( ++i < argc )
+				M.dram_bytes = atol(argv[i]) * 1024 * 1024;
+			else
+				print_microbench_CLI_error();
+		}
+		// CSV results file (-o)
+		else if( strcmp(arg, "-o") == 0 )
+		{
+			if( ++i < argc )
+				M.results_file = argv[i];
+			else
+				print_microbench_CLI_error();
+		}
+		else
+			print_microbench_CLI_error();
+	}
+
+	if( M.repetitions < 1 || M.work < 1 || M.dram_bytes < 0 )
+		print_microbench_CLI_error();
+
+	return M;
+}
+
+void print_microbench_CLI_error(void)
+{
+	printf("Usage: ./SimpleMOC-microbench <options>\n");
+	printf("Options include:\n");
+	printf("  -e <groups>               Energy group counts, e.g. 16,64 or 16-1024:x4\n");
+	printf("  -r <repetitions>          Timed repetitions (best is kept)\n");
+	printf("  -n <groups>               Energy groups attenuated per measurement\n");
+	printf("  -m <MB>                   DRAM working set (default 4x L3)\n");
+	printf("  -o <file.csv>             Write the results to a CSV file\n");
+	exit(1);
+}
+
+// Bytes of source data (fine sources, fine fluxes and sigT) in the working
+// set
+long working_set_bytes( Input * I )
+{
+	return (long) I->source_3D_regions * (2 * I->fine_axial_intervals + 1) *
+		I->egroups * sizeof(float);
+}
+
+// Builds source data of about the given size (at least one region)
+Source * build_working_set( Input * I, long bytes )
+{
+	I->source_3D_regions = 1;
+	long per_region = working_set_bytes(I);
+
+	I->source_3D_regions = (int) (bytes / per_region);
+	if( I->source_3D_regions < 1 )
+		I->source_3D_regions = 1;
+
+	return initialize_sources(I);
+}
+
+// Times one stage over the given number of random segments. Segments are
+// picked with an inline xorshift generator, so picking them costs next to
+// nothing compared to the stages.
+double time_stage( Input * I, Source * S, Table * table,
+		SIMD_Vectors * simd_vecs, float * state_flux, int stage,
+		long segments )
+{
+	unsigned int x = 2463534242u;
+	const int egroups = I->egroups;
+	const int tile = I->tile_size;
+	const unsigned long regions = I->source_3D_regions;
+	const unsigned long fai = I->fine_axial_intervals;
+
+	double start = get_time();
+
+	for( long i = 0; i < segments; i++ )
+	{
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		int QSR_id = (int) (((unsigned long) x * regions) >> 32);
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		int FAI_id = (int) (((unsigned long) x * fai) >> 32);
+
+		if( stage == MB_SEGMENT )
+		{
+			attenuate_segment( I, S, QSR_id, FAI_id, state_flux,
+					simd_vecs, table );
+			continue;
+		}
+
+		for( int g0 = 0; g0 < egroups; g0 += tile )
+		{
+			int ng = egroups - g0;
+			if( ng > tile )
+				ng = tile;
+
+			switch( stage )
+			{
+				case MB_SOURCE_FIT:
+					fit_source( I, S, QSR_id, FAI_id, g0, ng, simd_vecs );
+					break;
+				case MB_CROSS_SECTIONS:
+					load_cross_sections( I, S, QSR_id, g0, ng, simd_vecs );
+					break;
+				case MB_EXP_EXPF:
+					exponential_expf( ng, simd_vecs );
+					break;
+				case MB_EXP_TABLE:
+					exponential_table( ng, simd_vecs, table );
+					break;
+				case MB_FLUX_INTEGRAL:
+					compute_flux_integral( ng, state_flux + g0, simd_vecs );
+					break;
+				case MB_TALLY:
+					tally_flux( I, S, QSR_id, FAI_id, g0, ng, simd_vecs );
+					break;
+				case MB_OUTGOING_FLUX:
+					compute_outgoing_flux( ng, state_flux + g0, simd_vecs );
+					break;
+			}
+		}
+	}
+
+	return get_time() - start;
+}
+
+// Floating point operations per energy group of a microbenchmark
+double microbench_flops( Input * I, int stage )
+{
+	switch( stage )
+	{
+		case MB_SOURCE_FIT:    return stage_flops(I, STAGE_SOURCE_FIT);
+		case MB_CROSS_SECTIONS: return stage_flops(I, STAGE_CROSS_SECTIONS);
+		case MB_EXP_EXPF:      return 2;
+		case MB_EXP_TABLE:     return 5;
+		case MB_FLUX_INTEGRAL: return stage_flops(I, STAGE_FLUX_INTEGRAL);
+		case MB_TALLY:         return stage_flops(I, STAGE_TALLY);
+		case MB_OUTGOING_FLUX: return stage_flops(I, STAGE_OUTGOING_FLUX);
+	}
+
+	return flops_per_intersection(I);
+}
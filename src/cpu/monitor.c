@@ -0,0 +1,144 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Live progress monitor. Every kernel thread counts the segments it has
+// finished in its own cache line, with plain (relaxed) stores once per
+// chunk. A separate pthread wakes up at a fixed interval, sums the
+// counters and reports the throughput of the last interval, so drops
+// (throttling, noisy neighbors) show up while the run is going.
+
+Monitor * start_monitor( Input * I, long segments )
+{
+	Monitor * M = (Monitor *) calloc(1, sizeof(Monitor));
+	M->nthreads = I->nthreads;
+	M->total = segments * I->repetitions;
+	M->egroups = I->egroups;
+	M->interval = I->monitor_interval;
+
+	// Cache line aligned, so no two threads share a counter's line
+	if( posix_memalign((void **) &M->threads, 64,
+				M->nthreads * sizeof(Thread_Progress)) != 0 )
+	{
+		fprintf(stderr, "Unable to allocate progress counters\n");
+		exit(1);
+	}
+	memset(M->threads, 0, M->nthreads * sizeof(Thread_Progress));
+
+	if( I->monitor_file != NULL )
+	{
+		M->fp = fopen(I->monitor_file, "w");
+		if( M->fp == NULL )
+			fprintf(stderr, "Unable to open monitor file %s\n",
+					I->monitor_file);
+		else
+			fprintf(M->fp, "time,segments,fraction,segments_per_s,"
+					"intersections_per_s,eta\n");
+	}
+
+	pthread_mutex_init(&M->mutex, NULL);
+	pthread_cond_init(&M->wake, NULL);
+	M->start = get_time();
+	M->last_time = M->start;
+
+	if( pthread_create(&M->thread, NULL, monitor_thread, M) != 0 )
+	{
+		fprintf(stderr, "Unable to start the progress monitor\n");
+		exit(1);
+	}
+
+	return M;
+}
+
+// Stops the monitor thread, after it prints a final sample
+void stop_monitor( Monitor * M )
+{
+	pthread_mutex_lock(&M->mutex);
+	M->stop = 1;
+	pthread_cond_signal(&M->wake);
+	pthread_mutex_unlock(&M->mutex);
+	pthread_join(M->thread, NULL);
+
+	if( M->fp != NULL )
+		fclose(M->fp);
+	pthread_mutex_destroy(&M->mutex);
+	pthread_cond_destroy(&M->wake);
+	free(M->threads);
+	free(M);
+}
+
+// Counter of the given kernel thread (NULL if not monitoring this run)
+long * monitor_counter( Input * I, int thread )
+{
+	if( I->monitor == NULL || I->warmup )
+		return NULL;
+
+	return &I->monitor->threads[thread].segments;
+}
+
+// Body of the monitor thread - sleeps one interval at a time (or until
+// stopped), then samples the counters
+void * monitor_thread( void * arg )
+{
+	Monitor * M = (Monitor *) arg;
+
+	pthread_mutex_lock(&M->mutex);
+	while( !M->stop )
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		long ns = (long) (M->interval * 1.0e9);
+		deadline.tv_sec += ns / 1000000000L;
+		deadline.tv_nsec += ns % 1000000000L;
+		if( deadline.tv_nsec >= 1000000000L )
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		while( !M->stop && pthread_cond_timedwait(&M->wake, &M->mutex,
+					&deadline) == 0 )
+			;
+
+		pthread_mutex_unlock(&M->mutex);
+		monitor_sample(M);
+		pthread_mutex_lock(&M->mutex);
+	}
+	pthread_mutex_unlock(&M->mutex);
+
+	return NULL;
+}
+
+// Prints (and logs) one sample - progress, the throughput since the last
+// sample, and the time left at that throughput
+void monitor_sample( Monitor * M )
+{
+	long done = 0;
+	for( int t = 0; t < M->nthreads; t++ )
+		done += __atomic_load_n(&M->threads[t].segments, __ATOMIC_RELAXED);
+
+	double now = get_time();
+	double dt = now - M->last_time;
+	if( dt <= 0 )
+		return;
+
+	double rate = (done - M->last_done) / dt;
+	double fraction = (double) done / M->total;
+	double eta = rate > 0 ? (M->total - done) / rate : 0;
+	if( rate > M->peak_rate )
+		M->peak_rate = rate;
+
+	printf("  [%8.1lf s] %5.1lf%%  %.3le seg/s  %.3le int/s  %3.0lf%% of peak"
+			"  ETA %.1lf s\n", now - M->start, fraction * 100., rate,
+			rate * M->egroups, M->peak_rate > 0 ? rate / M->peak_rate * 100. :
+			100., eta);
+	fflush(stdout);
+
+	if( M->fp != NULL )
+	{
+		fprintf(M->fp, "%.3lf,%ld,%.6lf,%.6le,%.6le,%.3lf\n", now - M->start,
+				done, fraction, rate, rate * M->egroups, eta);
+		fflush(M->fp);
+	}
+
+	M->last_done = done;
+	M->last_time = now;
+}
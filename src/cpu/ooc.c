@@ -0,0 +1,363 @@
+#include "SimpleMOC-kernel_header.h"
+#include<fcntl.h>
+
+// Out-of-core sources (-F). The fine sources, fine fluxes and cross
+// sections of all regions live in a backing file, and only two windows of
+// consecutive regions are held in memory. A sweep attenuates the windows
+// in region order, giving each its share of the segments. While one window
+// is attenuated, an I/O thread reads the next one into the other slot, and
+// the fine fluxes of the window just finished are written back behind it.
+// The I/O thread serves requests in order, so a slot's write-back always
+// completes before the read-ahead that reuses it.
+
+// Sets up the backing file, the window slots and the I/O thread
+Out_Of_Core * open_out_of_core( Input * I )
+{
+	Out_Of_Core * O = (Out_Of_Core *) calloc(1, sizeof(Out_Of_Core));
+	O->fname = I->backing_file;
+	O->regions = I->source_3D_regions;
+	O->window_regions = I->window_regions;
+	if( O->window_regions == 0 )
+		O->window_regions = (O->regions + 15) / 16;
+	if( O->window_regions > O->regions )
+		O->window_regions = O->regions;
+	O->n_windows = (O->regions + O->window_regions - 1) / O->window_regions;
+	O->region_flux = (long) I->fine_axial_intervals * I->egroups;
+	O->egroups = I->egroups;
+
+	O->fd = open(O->fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if( O->fd < 0 )
+	{
+		fprintf(stderr, "Unable to open backing file %s: %s\n", O->fname,
+				strerror(errno));
+		exit(1);
+	}
+
+	// Sections of fine sources, fine fluxes and cross sections
+	O->flux_offset = array_bytes("backing file", O->regions, O->region_flux,
+			1, sizeof(float));
+	O->sigT_offset = 2 * O->flux_offset;
+	O->file_bytes = O->sigT_offset + array_bytes("backing file", O->regions,
+			O->egroups, 1, sizeof(float));
+
+	size_t flux_bytes = array_bytes("window", O->window_regions,
+			O->region_flux, 1, sizeof(float));
+	size_t sigT_bytes = array_bytes("window", O->window_regions, O->egroups,
+			1, sizeof(float));
+	for( int s = 0; s < 2; s++ )
+	{
+		O->fine_source[s] = (float *) checked_malloc( flux_bytes,
+				"window fine sources");
+		O->fine_flux[s] = (float *) checked_malloc( flux_bytes,
+				"window fine fluxes");
+		O->sigT[s] = (float *) checked_malloc( sigT_bytes,
+				"window cross sections");
+	}
+	I->nbytes += 2 * (2 * flux_bytes + sigT_bytes);
+
+	pthread_mutex_init(&O->mutex, NULL);
+	pthread_cond_init(&O->wake, NULL);
+	pthread_cond_init(&O->done, NULL);
+	if( pthread_create(&O->thread, NULL, out_of_core_thread, O) != 0 )
+	{
+		fprintf(stderr, "Unable to start the out-of-core I/O thread\n");
+		exit(1);
+	}
+
+	return O;
+}
+
+// Stops the I/O thread, frees the slots and removes the backing file. The
+// statistics stay around for the results summary.
+void close_out_of_core( Out_Of_Core * O )
+{
+	pthread_mutex_lock(&O->mutex);
+	O->stop = 1;
+	pthread_cond_signal(&O->wake);
+	pthread_mutex_unlock(&O->mutex);
+	pthread_join(O->thread, NULL);
+
+	pthread_mutex_destroy(&O->mutex);
+	pthread_cond_destroy(&O->wake);
+	pthread_cond_destroy(&O->done);
+	close(O->fd);
+	unlink(O->fname);
+
+	for( int s = 0; s < 2; s++ )
+	{
+		free(O->fine_source[s]);
+		free(O->fine_flux[s]);
+		free(O->sigT[s]);
+	}
+}
+
+// Reads or writes a whole range of the backing file
+void out_of_core_transfer( Out_Of_Core * O, int write, void * buf,
+		size_t bytes, off_t offset )
+{
+	char * p = (char *) buf;
+	while( bytes > 0 )
+	{
+		ssize_t n = write ? pwrite(O->fd, p, bytes, offset) :
+			pread(O->fd, p, bytes, offset);
+		if( n <= 0 )
+		{
+			if( n < 0 && errno == EINTR )
+				continue;
+			fprintf(stderr, "Unable to %s backing file %s: %s\n",
+					write ? "write" : "read", O->fname,
+					n < 0 ? strerror(errno) : "unexpected end of file");
+			exit(1);
+		}
+		p += n;
+		bytes -= n;
+		offset += n;
+	}
+}
+
+// First region and number of regions of a window
+void window_range( Out_Of_Core * O, int window, int * first, int * regions )
+{
+	*first = window * O->window_regions;
+	*regions = O->regions - *first;
+	if( *regions > O->window_regions )
+		*regions = O->window_regions;
+}
+
+// Does one request. Reads bring in a window's fine sources, fine fluxes
+// and cross sections, and write-backs store its (dirty) fine fluxes. Read
+// pages are dropped from the page cache, so later sweeps read them from
+// storage again.
+void out_of_core_io( Out_Of_Core * O, OOC_Request * R )
+{
+	int first, regions;
+	window_range(O, R->window, &first, &regions);
+
+	size_t flux_bytes = (size_t) regions * O->region_flux * sizeof(float);
+	off_t flux_start = (off_t) first * O->region_flux * sizeof(float);
+	size_t sigT_bytes = (size_t) regions * O->egroups * sizeof(float);
+	off_t sigT_start = (off_t) first * O->egroups * sizeof(float);
+
+	if( R->type == OOC_READ )
+	{
+		out_of_core_transfer(O, 0, O->fine_source[R->slot], flux_bytes,
+				flux_start);
+		out_of_core_transfer(O, 0, O->fine_flux[R->slot], flux_bytes,
+				O->flux_offset + flux_start);
+		out_of_core_transfer(O, 0, O->sigT[R->slot], sigT_bytes,
+				O->sigT_offset + sigT_start);
+		posix_fadvise(O->fd, flux_start, flux_bytes, POSIX_FADV_DONTNEED);
+		posix_fadvise(O->fd, O->flux_offset + flux_start, flux_bytes,
+				POSIX_FADV_DONTNEED);
+		posix_fadvise(O->fd, O->sigT_offset + sigT_start, sigT_bytes,
+				POSIX_FADV_DONTNEED);
+		if( R->counted )
+			O->bytes_read += 2 * flux_bytes + sigT_bytes;
+	}
+	else
+	{
+		out_of_core_transfer(O, 1, O->fine_flux[R->slot], flux_bytes,
+				O->flux_offset + flux_start);
+		if( R->counted )
+			O->bytes_written += flux_bytes;
+	}
+}
+
+// Body of the I/O thread - serves the queued requests in order
+void * out_of_core_thread( void * arg )
+{
+	Out_Of_Core * O = (Out_Of_Core *) arg;
+
+	pthread_mutex_lock(&O->mutex);
+	while( 1 )
+	{
+		while( O->completed == O->issued && !O->stop )
+			pthread_cond_wait(&O->wake, &O->mutex);
+		if( O->completed == O->issued )
+			break;
+
+		OOC_Request R = O->queue[O->completed % OOC_QUEUE];
+		pthread_mutex_unlock(&O->mutex);
+
+		double start = get_time();
+		out_of_core_io(O, &R);
+		if( R.counted )
+			O->io_time += get_time() - start;
+
+		pthread_mutex_lock(&O->mutex);
+		O->completed++;
+		pthread_cond_broadcast(&O->done);
+	}
+	pthread_mutex_unlock(&O->mutex);
+
+	return NULL;
+}
+
+// Queues a request. Returns its ticket, to wait on.
+long out_of_core_request( Input * I, Out_Of_Core * O, int type, int window,
+		int slot )
+{
+	pthread_mutex_lock(&O->mutex);
+	while( O->issued - O->completed == OOC_QUEUE )
+		pthread_cond_wait(&O->done, &O->mutex);
+
+	OOC_Request * R = &O->queue[O->issued % OOC_QUEUE];
+	R->type = type;
+	R->window = window;
+	R->slot = slot;
+	R->counted = !I->warmup;
+	long ticket = O->issued++;
+
+	pthread_cond_signal(&O->wake);
+	pthread_mutex_unlock(&O->mutex);
+
+	return ticket;
+}
+
+// Waits until a request (and every one queued before it) is done
+void out_of_core_wait( Out_Of_Core * O, long ticket )
+{
+	pthread_mutex_lock(&O->mutex);
+	while( O->completed <= ticket )
+		pthread_cond_wait(&O->done, &O->mutex);
+	pthread_mutex_unlock(&O->mutex);
+}
+
+// Points the sources of a window's regions at the slot holding them
+void map_window( Input * I, Source * S, Out_Of_Core * O, int slot,
+		int first, int regions )
+{
+	#ifdef COMPACT
+	S->fine_source = O->fine_source[slot];
+	S->fine_flux = O->fine_flux[slot];
+	S->sigT = O->sigT[slot];
+	S->first_region = first;
+	#else
+	for( int i = 0; i < regions; i++ )
+	{
+		S[first + i].fine_source = &O->fine_source[slot][i * O->region_flux];
+		S[first + i].fine_flux = &O->fine_flux[slot][i * O->region_flux];
+		S[first + i].sigT = &O->sigT[slot][(long) i * O->egroups];
+	}
+	#endif
+}
+
+// Fills the backing file with the same random data an in-memory run gets,
+// a window at a time, from the fill's random state
+void fill_out_of_core( Input * I, Out_Of_Core * O, unsigned int * seed )
+{
+	for( int w = 0; w < O->n_windows; w++ )
+	{
+		int first, regions;
+		window_range(O, w, &first, &regions);
+
+		long n = regions * O->region_flux;
+		for( long j = 0; j < n; j++ )
+		{
+			O->fine_source[0][j] = (float) rand_r(seed) / RAND_MAX;
+			O->fine_flux[0][j] = (float) rand_r(seed) / RAND_MAX;
+		}
+
+		off_t start = (off_t) first * O->region_flux * sizeof(float);
+		out_of_core_transfer(O, 1, O->fine_source[0], n * sizeof(float),
+				start);
+		out_of_core_transfer(O, 1, O->fine_flux[0], n * sizeof(float),
+				O->flux_offset + start);
+	}
+
+	for( int w = 0; w < O->n_windows; w++ )
+	{
+		int first, regions;
+		window_range(O, w, &first, &regions);
+
+		long n = (long) regions * O->egroups;
+		for( long j = 0; j < n; j++ )
+			O->sigT[0][j] = (float) rand_r(seed) / RAND_MAX;
+
+		out_of_core_transfer(O, 1, O->sigT[0], n * sizeof(float),
+				O->sigT_offset + (off_t) first * O->egroups * sizeof(float));
+	}
+
+	// Start from storage, not from pages left behind by the fill
+	fdatasync(O->fd);
+	posix_fadvise(O->fd, 0, O->file_bytes, POSIX_FADV_DONTNEED);
+}
+
+// Attenuates a sweep window by window. Each window waits for its read,
+// queues the read-ahead of the next window, runs its share of the
+// segments and queues the write-back of its fluxes. The sweep ends once
+// the last write-back is done.
+void run_out_of_core_sweep( Input * I, Source * S, Table * table,
+		long segments )
+{
+	Out_Of_Core * O = I->ooc;
+	long steals = 0;
+	long begin = 0;
+
+	long ticket = out_of_core_request(I, O, OOC_READ, 0, 0);
+	for( int w = 0; w < O->n_windows; w++ )
+	{
+		int slot = w % 2;
+		int first, regions;
+		window_range(O, w, &first, &regions);
+
+		double t0 = get_time();
+		out_of_core_wait(O, ticket);
+		double t1 = get_time();
+		map_window(I, S, O, slot, first, regions);
+
+		if( w + 1 < O->n_windows )
+			ticket = out_of_core_request(I, O, OOC_READ, w + 1, slot ^ 1);
+
+		// Segments in proportion to the regions of the window
+		long end = segments;
+		if( w + 1 < O->n_windows )
+			end = (long) ((double) segments * (first + regions) / O->regions);
+		run_window(I, S, table, end - begin, first, regions);
+		steals += I->steals;
+		begin = end;
+		double t2 = get_time();
+
+		ticket = out_of_core_request(I, O, OOC_WRITE, w, slot);
+
+		if( !I->warmup )
+		{
+			O->stall_time += t1 - t0;
+			O->compute_time += t2 - t1;
+			O->windows++;
+		}
+	}
+
+	double t3 = get_time();
+	out_of_core_wait(O, ticket);
+	if( !I->warmup )
+		O->drain_time += get_time() - t3;
+
+	I->steals = steals;
+}
+
+// Prints how much of the I/O the attenuation hid
+void print_out_of_core( Input * I )
+{
+	Out_Of_Core * O = I->ooc;
+	double exposed = O->stall_time + O->drain_time;
+	double hidden = O->io_time > 0 ? 1.0 - exposed / O->io_time : 0;
+	if( hidden < 0 )
+		hidden = 0;
+
+	printf("%-25s%d of %d regions (%.2lf MB)\n", "Out-of-Core Window:",
+			O->window_regions, O->regions, (2.0 * O->region_flux +
+				O->egroups) * O->window_regions * sizeof(float) / 1024.0 /
+			1024.0);
+	printf("%-25s%ld\n", "Windows Attenuated:", O->windows);
+	printf("%-25s%.2lf / %.2lf\n", "Read / Written (GB):",
+			O->bytes_read / 1024.0 / 1024.0 / 1024.0,
+			O->bytes_written / 1024.0 / 1024.0 / 1024.0);
+	if( O->io_time > 0 )
+		printf("%-25s%.3lf s (%.2lf GB/s)\n", "I/O Time:", O->io_time,
+				(O->bytes_read + O->bytes_written) / O->io_time / 1.0e9);
+	printf("%-25s%.3lf s\n", "Attenuation Time:", O->compute_time);
+	printf("%-25s%.3lf s waiting for reads, %.3lf s draining writes\n",
+			"Exposed I/O:", O->stall_time, O->drain_time);
+	printf("%-25s%.1lf%%\n", "I/O Hidden:", hidden * 100.);
+}
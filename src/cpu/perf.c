@@ -0,0 +1,606 @@
+#include "SimpleMOC-kernel_header.h"
+
+#ifdef PERF
+
+#include<sys/ioctl.h>
+#include<sys/syscall.h>
+#include<linux/perf_event.h>
+
+// Counter backend built directly on the Linux perf_event_open system call,
+// so hardware counters are available without PAPI. Each thread counts its
+// own events as one perf group, which keeps ratios such as IPC consistent
+// when the kernel has to multiplex counters.
+
+typedef struct{
+	const char * name;
+	const char * description;
+	unsigned int type;
+	unsigned long long config;
+	int intel_only; // Raw Intel event encodings
+} Perf_Event;
+
+#define HW_CACHE(cache, op, result) ((cache) | ((op) << 8) | ((result) << 16))
+
+static const char * perf_group_names[N_PERF_GROUPS] = { "flops",
+	"bandwidth", "stalls", "branch", "tlb", "os" };
+
+static const Perf_Event perf_events[N_PERF_GROUPS][PERF_MAX_EVENTS] = {
+	// FLOPS - FP_ARITH_INST_RETIRED (single precision, FMAs count twice)
+	{
+		{ "cycles", "CPU cycles", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CPU_CYCLES, 0 },
+		{ "instructions", "Instructions retired", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_INSTRUCTIONS, 0 },
+		{ "fp_scalar", "Scalar single precision FP ops", PERF_TYPE_RAW,
+			0x02c7, 1 },
+		{ "fp_128_packed", "128-bit packed single precision FP ops",
+			PERF_TYPE_RAW, 0x08c7, 1 },
+		{ "fp_256_packed", "256-bit packed single precision FP ops",
+			PERF_TYPE_RAW, 0x20c7, 1 },
+		{ "fp_512_packed", "512-bit packed single precision FP ops",
+			PERF_TYPE_RAW, 0x80c7, 1 }
+	},
+	// Bandwidth / LLC
+	{
+		{ "cycles", "CPU cycles", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CPU_CYCLES, 0 },
+		{ "instructions", "Instructions retired", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_INSTRUCTIONS, 0 },
+		{ "llc_references", "Last level cache references",
+			PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, 0 },
+		{ "llc_misses", "Last level cache misses", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CACHE_MISSES, 0 },
+		{ "l1d_loads", "L1 data cache loads", PERF_TYPE_HW_CACHE,
+			HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+					PERF_COUNT_HW_CACHE_RESULT_ACCESS), 0 },
+		{ "l1d_load_misses", "L1 data cache load misses", PERF_TYPE_HW_CACHE,
+			HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+					PERF_COUNT_HW_CACHE_RESULT_MISS), 0 }
+	},
+	// Stalls
+	{
+		{ "cycles", "CPU cycles", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CPU_CYCLES, 0 },
+		{ "instructions", "Instructions retired", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_INSTRUCTIONS, 0 },
+		{ "stalls_frontend", "Cycles stalled in the front end",
+			PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, 0 },
+		{ "stalls_backend", "Cycles stalled in the back end",
+			PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, 0 },
+		{ "stalls_total", "Cycles with no uops executed (CYCLE_ACTIVITY)",
+			PERF_TYPE_RAW, 0x040004a3, 1 },
+		{ "resource_stalls", "Resource stall cycles (RESOURCE_STALLS.ANY)",
+			PERF_TYPE_RAW, 0x01a2, 1 }
+	},
+	// Branch
+	{
+		{ "cycles", "CPU cycles", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CPU_CYCLES, 0 },
+		{ "instructions", "Instructions retired", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_INSTRUCTIONS, 0 },
+		{ "branches", "Branch instructions retired", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_BRANCH_INSTRUCTIONS, 0 },
+		{ "branch_misses", "Mispredicted branches", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_BRANCH_MISSES, 0 }
+	},
+	// TLB
+	{
+		{ "cycles", "CPU cycles", PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CPU_CYCLES, 0 },
+		{ "dtlb_loads", "Data TLB loads", PERF_TYPE_HW_CACHE,
+			HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+					PERF_COUNT_HW_CACHE_RESULT_ACCESS), 0 },
+		{ "dtlb_load_misses", "Data TLB load misses", PERF_TYPE_HW_CACHE,
+			HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+					PERF_COUNT_HW_CACHE_RESULT_MISS), 0 },
+		{ "dtlb_stores", "Data TLB stores", PERF_TYPE_HW_CACHE,
+			HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE,
+					PERF_COUNT_HW_CACHE_RESULT_ACCESS), 0 },
+		{ "dtlb_store_misses", "Data TLB store misses", PERF_TYPE_HW_CACHE,
+			HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE,
+					PERF_COUNT_HW_CACHE_RESULT_MISS), 0 }
+	},
+	// OS - software events, available even without a hardware PMU
+	{
+		{ "task_clock", "Thread CPU time (ns)", PERF_TYPE_SOFTWARE,
+			PERF_COUNT_SW_TASK_CLOCK, 0 },
+		{ "context_switches", "Context switches", PERF_TYPE_SOFTWARE,
+			PERF_COUNT_SW_CONTEXT_SWITCHES, 0 },
+		{ "cpu_migrations", "Migrations between CPUs", PERF_TYPE_SOFTWARE,
+			PERF_COUNT_SW_CPU_MIGRATIONS, 0 },
+		{ "page_faults", "Page faults", PERF_TYPE_SOFTWARE,
+			PERF_COUNT_SW_PAGE_FAULTS, 0 }
+	}
+};
+
+// Returns the group with the given name (-1 if there is none)
+int perf_group_from_name( const char * name )
+{
+	for( int g = 0; g < N_PERF_GROUPS; g++ )
+		if( strcmp(name, perf_group_names[g]) == 0 )
+			return g;
+	return -1;
+}
+
+const char * perf_group_name( int group )
+{
+	return perf_group_names[group];
+}
+
+const char * perf_event_name( int group, int event )
+{
+	return perf_events[group][event].name;
+}
+
+// Parses a comma separated list of group names ("all" for every group).
+// Returns the number of groups, or 0 if a name is unknown.
+int parse_perf_groups( const char * str, int * groups )
+{
+	if( strcmp(str, "all") == 0 )
+	{
+		for( int g = 0; g < N_PERF_GROUPS; g++ )
+			groups[g] = g;
+		return N_PERF_GROUPS;
+	}
+
+	int n = 0;
+	char name[32];
+	const char * p = str;
+	while( *p != '\0' )
+	{
+		size_t len = strcspn(p, ",");
+		if( len == 0 || len >= sizeof(name) || n == N_PERF_GROUPS )
+			return 0;
+		memcpy(name, p, len);
+		name[len] = '\0';
+
+		int g = perf_group_from_name(name);
+		if( g < 0 )
+			return 0;
+
+		// Skip groups given twice
+		int dup = 0;
+		for( int i = 0; i < n; i++ )
+			dup |= groups[i] == g;
+		if( !dup )
+			groups[n++] = g;
+
+		p += len;
+		if( *p == ',' )
+			p++;
+	}
+
+	return n;
+}
+
+// Allocates the per-thread counts of every selected group, summed over the
+// timed runs the group was counted on
+Perf_Counters * perf_init( Input * I )
+{
+	// Raw encodings are Intel specific
+	int intel = 0;
+	FILE * fp = fopen("/proc/cpuinfo", "r");
+	if( fp != NULL )
+	{
+		char line[256];
+		while( fgets(line, sizeof(line), fp) != NULL )
+		{
+			if( strncmp(line, "vendor_id", 9) == 0 )
+			{
+				intel = strstr(line, "GenuineIntel") != NULL;
+				break;
+			}
+		}
+		fclose(fp);
+	}
+
+	Perf_Counters * counters = (Perf_Counters *) malloc( I->n_perf_groups *
+			sizeof(Perf_Counters));
+
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		Perf_Counters * P = &counters[i];
+		P->group = I->perf_groups[i];
+		P->nthreads = I->nthreads;
+		P->n_events = 0;
+		while( P->n_events < PERF_MAX_EVENTS &&
+				perf_events[P->group][P->n_events].name != NULL )
+			P->n_events++;
+		P->counts = (long long *) calloc( P->nthreads * PERF_MAX_EVENTS,
+				sizeof(long long));
+		memset(P->opened, 0, sizeof(P->opened));
+		P->multiplexed = 0;
+		P->intel = intel;
+		P->runs = 0;
+		P->time = 0;
+		P->run_counts = (double *) calloc( I->repetitions * PERF_MAX_EVENTS,
+				sizeof(double));
+		memset(P->last, 0, sizeof(P->last));
+	}
+
+	return counters;
+}
+
+// Whether group i is counted during the current run - all groups when
+// multiplexing, otherwise the one whose turn it is
+int perf_group_active( Input * I, int i )
+{
+	return I->perf_multiplex || i == I->perf_active;
+}
+
+// Credits a timed run to the groups that were counting during it, and
+// keeps the counts of this run on their own for the regression check
+void perf_add_run( Input * I, double runtime )
+{
+	if( I->perf == NULL )
+		return;
+
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		Perf_Counters * P = &I->perf[i];
+		if( !perf_group_active(I, i) )
+			continue;
+
+		for( int e = 0; e < P->n_events; e++ )
+		{
+			double total = 0;
+			for( int t = 0; t < P->nthreads; t++ )
+				total += P->counts[t * PERF_MAX_EVENTS + e];
+			P->run_counts[P->runs * PERF_MAX_EVENTS + e] = total - P->last[e];
+			P->last[e] = total;
+		}
+
+		P->runs++;
+		P->time += runtime;
+	}
+}
+
+long perf_event_open( struct perf_event_attr * attr, pid_t pid, int cpu,
+		int group_fd, unsigned long flags )
+{
+	return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+// Opens and starts one group of counters on the calling thread. Events
+// the machine doesn't support are skipped.
+void perf_open_group( Perf_Counters * P, Perf_Thread * T )
+{
+	T->n = 0;
+	T->leader = -1;
+
+	for( int e = 0; e < P->n_events; e++ )
+	{
+		const Perf_Event * ev = &perf_events[P->group][e];
+		if( ev->intel_only && !P->intel )
+			continue;
+
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = ev->type;
+		attr.config = ev->config;
+		attr.disabled = T->leader == -1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP |
+			PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		int fd = (int) perf_event_open(&attr, 0, -1, T->leader, 0);
+		if( fd < 0 )
+			continue;
+
+		if( T->leader == -1 )
+			T->leader = fd;
+		T->fds[T->n] = fd;
+		T->event[T->n] = e;
+		T->n++;
+	}
+
+	if( T->leader != -1 )
+	{
+		ioctl(T->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(T->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+// Stops one group of the calling thread's counters and adds them to its
+// totals
+void perf_close_group( Perf_Counters * P, Perf_Thread * T, int thread )
+{
+	if( T->leader == -1 )
+		return;
+
+	ioctl(T->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	// nr, time enabled, time running, then one value per event
+	unsigned long long buf[3 + PERF_MAX_EVENTS];
+	if( read(T->leader, buf, sizeof(buf)) > 0 && buf[0] == (unsigned) T->n )
+	{
+		// Scale up if the group was multiplexed with other events
+		double scale = 1.0;
+		if( buf[2] > 0 && buf[2] < buf[1] )
+		{
+			scale = (double) buf[1] / buf[2];
+			P->multiplexed = 1;
+		}
+
+		for( int i = 0; i < T->n; i++ )
+		{
+			P->counts[thread * PERF_MAX_EVENTS + T->event[i]] +=
+				(long long) (buf[3 + i] * scale);
+			if( thread == 0 )
+				P->opened[T->event[i]] = 1;
+		}
+	}
+
+	for( int i = 0; i < T->n; i++ )
+		close(T->fds[i]);
+}
+
+// Starts the calling thread's counters for every active group. T holds
+// one entry per selected group.
+void perf_start( Input * I, Perf_Thread * T )
+{
+	if( I->perf == NULL )
+		return;
+
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		T[i].leader = -1;
+		if( perf_group_active(I, i) )
+			perf_open_group(&I->perf[i], &T[i]);
+	}
+}
+
+void perf_stop( Input * I, Perf_Thread * T, int thread )
+{
+	if( I->perf == NULL )
+		return;
+
+	for( int i = 0; i < I->n_perf_groups; i++ )
+		if( perf_group_active(I, i) )
+			perf_close_group(&I->perf[i], &T[i], thread);
+}
+
+// Total of an event over all threads (-1 if it wasn't counted)
+double perf_total( Perf_Counters * P, const char * name )
+{
+	for( int e = 0; e < P->n_events; e++ )
+	{
+		if( strcmp(perf_events[P->group][e].name, name) != 0 )
+			continue;
+		if( !P->opened[e] )
+			return -1;
+
+		double total = 0;
+		for( int t = 0; t < P->nthreads; t++ )
+			total += P->counts[t * PERF_MAX_EVENTS + e];
+		return total;
+	}
+
+	return -1;
+}
+
+// Looks an event up in every group, returning its total and the group it
+// was counted in (NULL and -1 if no group counted it)
+double perf_find( Input * I, const char * name, Perf_Counters ** P )
+{
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		double v = perf_total(&I->perf[i], name);
+		if( v >= 0 && I->perf[i].runs > 0 )
+		{
+			*P = &I->perf[i];
+			return v;
+		}
+	}
+
+	*P = NULL;
+	return -1;
+}
+
+// Prints the per-thread counts and totals of one group
+void print_perf_group( Perf_Counters * P )
+{
+	const Perf_Event * events = perf_events[P->group];
+
+	printf("%-25s%s (%d run%s)\n", "Event Group:",
+			perf_group_names[P->group], P->runs, P->runs == 1 ? "" : "s");
+
+	int any = 0;
+	for( int e = 0; e < P->n_events; e++ )
+		any |= P->opened[e];
+	if( !any )
+	{
+		printf("No events of this group could be counted - the machine may\n"
+				"not expose a hardware PMU, or perf_event_paranoid may be too\n"
+				"high (try the \"os\" group).\n");
+		return;
+	}
+
+	printf("Count          \tEvent              \tDescription\n");
+	for( int t = 0; t < P->nthreads; t++ )
+	{
+		if( P->nthreads > 1 )
+			printf("Thread %d\n", t);
+		for( int e = 0; e < P->n_events; e++ )
+		{
+			if( P->opened[e] )
+				printf("%-15lld\t%-19s\t%s\n",
+						P->counts[t * PERF_MAX_EVENTS + e], events[e].name,
+						events[e].description);
+			else if( t == 0 )
+				printf("%-15s\t%-19s\t%s\n", "n/a", events[e].name,
+						events[e].description);
+		}
+	}
+	if( P->nthreads > 1 )
+	{
+		printf("Thread Totals:\n");
+		for( int e = 0; e < P->n_events; e++ )
+			if( P->opened[e] )
+				printf("%-15.0lf\t%-19s\t%s\n", perf_total(P, events[e].name),
+						events[e].name, events[e].description);
+	}
+	if( P->multiplexed )
+		printf("Note: counters were multiplexed, counts are scaled estimates\n");
+}
+
+// Prints the counts of every group, then one consolidated report of the
+// metrics derived from them. Each metric uses the counts and wall time of
+// the runs its group was counted on.
+void print_perf_counters( Input * I, Results * R )
+{
+	border_print();
+	center_print("PERF COUNTER RESULTS", 79);
+	border_print();
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		if( i > 0 )
+			printf("\n");
+		print_perf_group(&I->perf[i]);
+	}
+
+	border_print();
+	center_print("PERFORMANCE SUMMARY", 79);
+	border_print();
+
+	Perf_Counters * P;
+	double per_run = (double) R->segments * R->egroups;
+
+	// Core throughput
+	double cycles = perf_find(I, "cycles", &P);
+	if( cycles > 0 )
+	{
+		printf("%-25s%.2lf\n", "Clock (GHz):", cycles / P->nthreads /
+				P->time / 1.0e9);
+		double instructions = perf_total(P, "instructions");
+		if( instructions >= 0 )
+			printf("%-25s%.3lf\n", "IPC:", instructions / cycles);
+	}
+
+	// FLOPS - FP_ARITH counts by vector width
+	double s = perf_find(I, "fp_scalar", &P);
+	if( s >= 0 )
+	{
+		double p128 = perf_total(P, "fp_128_packed");
+		double p256 = perf_total(P, "fp_256_packed");
+		double p512 = perf_total(P, "fp_512_packed");
+		double flops = s + 4 * (p128 > 0 ? p128 : 0) +
+			8 * (p256 > 0 ? p256 : 0) + 16 * (p512 > 0 ? p512 : 0);
+		printf("%-25s%.3lf\n", "GFLOP/s:", flops / P->time / 1.0e9);
+		printf("%-25s%.1lf (analytic %.1lf)\n", "FLOPs per Intersection:",
+				flops / (per_run * P->runs), flops_per_intersection(I));
+		if( flops > 0 )
+			printf("%-25s%.1lf%%\n", "Vectorized FLOPs:",
+					(flops - s) / flops * 100.);
+	}
+
+	// Memory - bandwidth from LLC misses of 64 byte lines
+	double misses = perf_find(I, "llc_misses", &P);
+	if( misses >= 0 )
+	{
+		printf("%-25s%.3lf\n", "LLC Bandwidth (GB/s):",
+				misses * 64. / P->time / 1.0e9);
+		double refs = perf_total(P, "llc_references");
+		if( refs > 0 )
+			printf("%-25s%.2lf%%\n", "LLC Miss Rate:", misses / refs * 100.);
+	}
+	double l1 = perf_find(I, "l1d_loads", &P);
+	if( l1 > 0 )
+	{
+		double l1_misses = perf_total(P, "l1d_load_misses");
+		if( l1_misses >= 0 )
+			printf("%-25s%.2lf%%\n", "L1D Load Miss Rate:",
+					l1_misses / l1 * 100.);
+	}
+
+	// Stalls, as a share of the cycles of the same group
+	const char * stalls[4] = { "stalls_frontend", "stalls_backend",
+		"stalls_total", "resource_stalls" };
+	const char * labels[4] = { "Front End Stalls:", "Back End Stalls:",
+		"Cycles w/o Execution:", "Resource Stalls:" };
+	for( int i = 0; i < 4; i++ )
+	{
+		double v = perf_find(I, stalls[i], &P);
+		double c = v >= 0 ? perf_total(P, "cycles") : -1;
+		if( c > 0 )
+			printf("%-25s%.2lf%%\n", labels[i], v / c * 100.);
+	}
+
+	// Branches
+	double branches = perf_find(I, "branches", &P);
+	if( branches > 0 )
+	{
+		double branch_misses = perf_total(P, "branch_misses");
+		double instructions = perf_total(P, "instructions");
+		if( branch_misses >= 0 )
+			printf("%-25s%.3lf%%\n", "Branch Miss Rate:",
+					branch_misses / branches * 100.);
+		if( instructions > 0 )
+			printf("%-25s%.2lf%%\n", "Branch Share:",
+					branches / instructions * 100.);
+	}
+
+	// TLB
+	double load_misses = perf_find(I, "dtlb_load_misses", &P);
+	if( load_misses >= 0 )
+	{
+		double loads = perf_total(P, "dtlb_loads");
+		double stores = perf_total(P, "dtlb_stores");
+		double store_misses = perf_total(P, "dtlb_store_misses");
+		if( loads > 0 )
+			printf("%-25s%.3lf%%\n", "DTLB Load Miss Rate:",
+					load_misses / loads * 100.);
+		if( stores > 0 && store_misses >= 0 )
+			printf("%-25s%.3lf%%\n", "DTLB Store Miss Rate:",
+					store_misses / stores * 100.);
+		printf("%-25s%.3lf\n", "DTLB Misses/Segment:",
+				load_misses / ((double) R->segments * P->runs));
+	}
+
+	// OS
+	double task = perf_find(I, "task_clock", &P);
+	if( task >= 0 )
+	{
+		printf("%-25s%.1lf%%\n", "CPU Utilization:",
+				task / 1.0e9 / P->time / P->nthreads * 100.);
+		double switches = perf_total(P, "context_switches");
+		double migrations = perf_total(P, "cpu_migrations");
+		if( switches >= 0 )
+			printf("%-25s%.1lf\n", "Context Switches/s:", switches / P->time);
+		if( migrations >= 0 )
+			printf("%-25s%.1lf\n", "CPU Migrations/s:", migrations / P->time);
+	}
+}
+
+// Writes the per-run counts of every counted event, per intersection, as
+// the "perf" member of the JSON results record. Members are named
+// group.event, as some events are counted in several groups.
+void write_perf_json( FILE * fp, Input * I, Results * R )
+{
+	double per_run = (double) R->segments * R->egroups;
+	int first = 1;
+
+	fprintf(fp, "  \"perf\": {");
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		Perf_Counters * P = &I->perf[i];
+		for( int e = 0; e < P->n_events; e++ )
+		{
+			if( !P->opened[e] || P->runs == 0 )
+				continue;
+
+			fprintf(fp, "%s\n    \"%s.%s\": [", first ? "" : ",",
+					perf_group_names[P->group], perf_events[P->group][e].name);
+			for( int r = 0; r < P->runs; r++ )
+				fprintf(fp, "%s%.9le", r ? ", " : "",
+						P->run_counts[r * PERF_MAX_EVENTS + e] / per_run);
+			fprintf(fp, "]");
+			first = 0;
+		}
+	}
+	fprintf(fp, "\n  }");
+}
+
+#endif
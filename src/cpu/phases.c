@@ -0,0 +1,140 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Wall clock breakdown of the whole run, from reading the inputs to
+// teardown. Setup phases are timed by the master thread, while the
+// per-thread setup inside the kernel parallel region is kept per thread,
+// as its slowest thread delays every timed run.
+
+static const char * phase_names[N_PHASES] = { "Read Inputs", "Thread Placement",
+	"Source Allocation", "Lock Init", "Source Fill", "Track Laydown",
+	"Exponential Table", "Boundary Buffers", "Roofline Probes",
+	"Chunk Autotuning", "Warmup Runs", "Timed Runs", "Locked Reference",
+	"Tracking Comparison", "Teardown" };
+
+// Member names in the results records
+static const char * phase_keys[N_PHASES] = { "read_inputs", "thread_placement",
+	"source_allocation", "lock_init", "source_fill", "track_laydown",
+	"exponential_table", "boundary_buffers", "roofline_probes",
+	"chunk_autotuning", "warmup_runs", "timed_runs", "locked_reference",
+	"tracking_comparison", "teardown" };
+
+Phases * init_phases(void)
+{
+	Phases * P = (Phases *) calloc(1, sizeof(Phases));
+	P->start = get_time();
+	return P;
+}
+
+// Sizes the per-thread setup timers, once the thread count is known
+void init_phase_threads( Input * I )
+{
+	Phases * P = I->phases;
+	free(P->thread_setup);
+	P->nthreads = I->nthreads;
+	P->thread_setup = (double *) calloc( P->nthreads, sizeof(double));
+}
+
+void phase_begin( Input * I, int phase )
+{
+	I->phases->begin[phase] = get_time();
+}
+
+void phase_end( Input * I, int phase )
+{
+	Phases * P = I->phases;
+	double now = get_time();
+	P->time[phase] += now - P->begin[phase];
+	P->end = now;
+}
+
+// Credits a kernel thread's setup (vector allocation and flux init) to it.
+// Only timed runs count, so this is a part of the timed runs phase.
+void phase_thread_setup( Input * I, int thread, double t )
+{
+	Phases * P = I->phases;
+	if( I->warmup || thread >= P->nthreads )
+		return;
+	P->thread_setup[thread] += t;
+}
+
+// Slowest and mean per-thread setup time, summed over the timed runs
+void thread_setup_stats( Phases * P, double * max, double * mean )
+{
+	*max = 0;
+	*mean = 0;
+	for( int t = 0; t < P->nthreads; t++ )
+	{
+		if( P->thread_setup[t] > *max )
+			*max = P->thread_setup[t];
+		*mean += P->thread_setup[t];
+	}
+	if( P->nthreads > 0 )
+		*mean /= P->nthreads;
+}
+
+// Prints the breakdown table. Whatever no phase covers (printing, the
+// input summary) is shown as unaccounted.
+void print_phases( Input * I )
+{
+	Phases * P = I->phases;
+	double wall = P->end - P->start;
+
+	printf("%-30s%-14s%s\n", "Phase", "Time (s)", "% of Wall");
+	double accounted = 0;
+	for( int p = 0; p < N_PHASES; p++ )
+	{
+		accounted += P->time[p];
+		if( P->time[p] == 0 )
+			continue;
+		printf("%-30s%-14.6lf%.2lf%%\n", phase_names[p], P->time[p],
+				P->time[p] / wall * 100.);
+
+		if( p == PHASE_KERNEL )
+		{
+			double max, mean;
+			thread_setup_stats(P, &max, &mean);
+			printf("%-30s%-14.6lf%.2lf%%\n", "  Per-Thread Setup (max)", max,
+					max / wall * 100.);
+			printf("%-30s%-14.6lf%.2lf%%\n", "  Per-Thread Setup (mean)",
+					mean, mean / wall * 100.);
+		}
+	}
+	printf("%-30s%-14.6lf%.2lf%%\n", "Unaccounted", wall - accounted,
+			(wall - accounted) / wall * 100.);
+	printf("%-30s%-14.6lf%.2lf%%\n", "Wall Time", wall, 100.);
+}
+
+// Writes the phases as the "phases" member of the JSON results record
+void write_phases_json( FILE * fp, Input * I )
+{
+	Phases * P = I->phases;
+	double max, mean;
+	thread_setup_stats(P, &max, &mean);
+
+	fprintf(fp, "  \"phases\": {\n");
+	for( int p = 0; p < N_PHASES; p++ )
+		fprintf(fp, "    \"%s\": %.9lf,\n", phase_keys[p], P->time[p]);
+	fprintf(fp, "    \"per_thread_setup_max\": %.9lf,\n", max);
+	fprintf(fp, "    \"per_thread_setup_mean\": %.9lf,\n", mean);
+	fprintf(fp, "    \"wall\": %.9lf\n", P->end - P->start);
+	fprintf(fp, "  }");
+}
+
+// Trailing columns of the CSV header and row
+void write_phases_csv_header( FILE * fp )
+{
+	for( int p = 0; p < N_PHASES; p++ )
+		fprintf(fp, ",phase_%s", phase_keys[p]);
+	fprintf(fp, ",phase_per_thread_setup_max,phase_wall");
+}
+
+void write_phases_csv( FILE * fp, Input * I )
+{
+	Phases * P = I->phases;
+	double max, mean;
+	thread_setup_stats(P, &max, &mean);
+
+	for( int p = 0; p < N_PHASES; p++ )
+		fprintf(fp, ",%.9lf", P->time[p]);
+	fprintf(fp, ",%.9lf,%.9lf", max, P->end - P->start);
+}
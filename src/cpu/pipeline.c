@@ -0,0 +1,299 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Pipelined mode (-Q). Normally a thread draws a segment, attenuates it
+// and adds its tally under a lock, one segment at a time. Here each thread
+// runs the three as separate stages, in turn, over batches: the generate
+// stage fills a ring of segment descriptors from the scheduler's chunks
+// (one chunk a round, so the queue follows the chunks the scheduler
+// hands out), the attenuate stage works through them -
+// prefetching the source data of the segments PIPE_PREFETCH places ahead -
+// and queues each tally in a second ring, and the tally stage adds the
+// queued tallies into the fine flux, prefetching the regions a few
+// entries ahead. A full tally ring stops the attenuate stage early
+// (back-pressure), leaving its segments queued for the next round. The time in each stage and the ring depths each stage
+// found are reported, to see how the memory-bound tally traffic weighs
+// against the compute-bound attenuation once they are split apart.
+
+// Pipeline of the calling kernel thread (NULL when off, or outside a sweep)
+__thread Pipeline * pipeline = NULL;
+
+// Bytes before the group tallies of a tally entry, keeping them aligned
+#define TALLY_ENTRY_HEADER 64
+
+void ring_init( Ring * R, unsigned long capacity, size_t entry_bytes )
+{
+	R->entry_bytes = entry_bytes;
+	R->mask = capacity - 1;
+	R->head = 0;
+	R->tail = 0;
+	if( posix_memalign((void **) &R->data, 64, capacity * entry_bytes) != 0 )
+	{
+		fprintf(stderr, "Unable to allocate pipeline ring\n");
+		exit(1);
+	}
+}
+
+void ring_free( Ring * R )
+{
+	free(R->data);
+}
+
+// Allocates the calling thread's pipeline, if pipelined. The tally ring
+// has its own depth (-Q d,t), as its entries hold every group.
+void pipeline_begin( Input * I )
+{
+	pipeline = NULL;
+	if( I->pipeline_depth == 0 )
+		return;
+
+	Pipeline * P;
+	if( posix_memalign((void **) &P, 64, sizeof(Pipeline)) != 0 )
+	{
+		fprintf(stderr, "Unable to allocate pipeline\n");
+		exit(1);
+	}
+	memset(P, 0, sizeof(Pipeline));
+	P->egroups = I->egroups;
+
+	size_t flux_bytes = (I->egroups * sizeof(float) + 63) / 64 * 64;
+	ring_init(&P->segments, I->pipeline_depth, sizeof(Segment_Desc));
+	ring_init(&P->tallies, I->pipeline_tally_depth,
+			TALLY_ENTRY_HEADER + flux_bytes);
+
+	pipeline = P;
+}
+
+// Adds the thread's stage times and queue depths into the totals (timed
+// runs only), and frees its pipeline
+void pipeline_end( Input * I )
+{
+	Pipeline * P = pipeline;
+	if( P == NULL )
+		return;
+
+	if( !I->warmup )
+	{
+		for( int s = 0; s < PIPE_STAGES; s++ )
+		{
+			__atomic_fetch_add(&I->pipe_time[s], P->time[s],
+					__ATOMIC_RELAXED);
+			__atomic_fetch_add(&I->pipe_batches[s], P->batches[s],
+					__ATOMIC_RELAXED);
+		}
+		__atomic_fetch_add(&I->pipe_depth[0], P->depth[0], __ATOMIC_RELAXED);
+		__atomic_fetch_add(&I->pipe_depth[1], P->depth[1], __ATOMIC_RELAXED);
+		__atomic_fetch_add(&I->pipe_backpressure, P->backpressure,
+				__ATOMIC_RELAXED);
+		__atomic_fetch_add(&I->pipe_segments, P->segments_done,
+				__ATOMIC_RELAXED);
+	}
+
+	ring_free(&P->segments);
+	ring_free(&P->tallies);
+	free(P);
+	pipeline = NULL;
+}
+
+// Prefetches the fine sources around a segment and its cross sections
+void prefetch_segment( Input * I, Source * S, Segment_Desc * D )
+{
+	long bytes = I->egroups * sizeof(float);
+	int first = D->FAI_id > 0 ? D->FAI_id - 1 : 0;
+	int last = D->FAI_id < I->fine_axial_intervals - 1 ? D->FAI_id + 1 :
+		D->FAI_id;
+
+	char * source = (char *) (region_fine_source(I, S, D->QSR_id) +
+			first * I->egroups);
+	for( long b = 0; b < (last - first + 1) * bytes; b += 64 )
+		__builtin_prefetch(source + b, 0, 3);
+
+	char * sigT = (char *) region_sigT(I, S, D->QSR_id);
+	for( long b = 0; b < bytes; b += 64 )
+		__builtin_prefetch(sigT + b, 0, 3);
+}
+
+// Queues one tile of the segment's tally. The first tile starts the entry.
+void pipeline_add_tally( Pipeline * P, long fsr, int g0, int ng,
+		float * tally )
+{
+	if( g0 == 0 )
+		*((long *) P->pending) = fsr;
+
+	memcpy((float *) (P->pending + TALLY_ENTRY_HEADER) + g0, tally,
+			ng * sizeof(float));
+}
+
+// Adds a queued tally into the fine flux - through the tally cache if
+// there is one, otherwise under the region's lock
+void pipeline_apply_tally( Input * I, Source * S, long fsr, float * flux )
+{
+	int QSR_id = (int) (fsr / I->fine_axial_intervals);
+	int FAI_id = (int) (fsr % I->fine_axial_intervals);
+
+	if( tally_cache != NULL )
+	{
+		float * line = tally_cache_line(I, S, tally_cache, QSR_id, FAI_id, 0);
+		for( int g = 0; g < I->egroups; g++ )
+			line[g] += flux[g];
+		tally_cache->updates++;
+		return;
+	}
+
+	float * FSR_flux = region_fine_flux(I, S, QSR_id) + FAI_id * I->egroups;
+
+	#ifdef MULTITHREADED
+	Lock * lock = fsr_lock(I, S, QSR_id, FAI_id);
+	#endif
+
+	#if defined MULTITHREADED && defined INSTRUMENT
+	instrumented_set_lock(I, lock, fsr);
+	#elif defined MULTITHREADED
+	set_lock(lock);
+	#endif
+
+	for( int g = 0; g < I->egroups; g++ )
+		FSR_flux[g] += flux[g];
+
+	#ifdef MULTITHREADED
+	unset_lock(lock);
+	#endif
+}
+
+// Runs the thread's share of the sweep through its pipeline, taking
+// chunks from the scheduler as the generate stage needs them, until they
+// run out and the rings are drained
+void run_pipeline( Input * I, Source * S, Table * table, Scheduler * W,
+		int thread, unsigned int * seed, int first_region, int regions,
+		float * state_flux, SIMD_Vectors * simd_vecs, long * progress )
+{
+	Pipeline * P = pipeline;
+	Ring * segments = &P->segments;
+	Ring * tallies = &P->tallies;
+	long next = 0;
+	long end = 0;
+	int more = 1;
+
+	while( more || ring_count(segments) > 0 || ring_count(tallies) > 0 )
+	{
+		double t0 = get_time();
+
+		// Generate - fill the segment ring from one chunk: the rest of the
+		// last one, or a new one if that is used up
+		Segment_Desc * D;
+		int new_chunk = next == end;
+		while( more && (D = (Segment_Desc *) ring_slot(segments)) != NULL )
+		{
+			if( next == end )
+			{
+				if( !new_chunk )
+					break;
+				new_chunk = 0;
+				more = next_chunk(W, thread, seed, &next, &end);
+				if( !more )
+					break;
+				if( progress != NULL )
+					monitor_add(progress, end - next);
+			}
+
+			// Pick Random QSR and Fine Axial Interval
+			D->QSR_id = first_region + rand_r(seed) % regions;
+			D->FAI_id = rand_r(seed) % I->fine_axial_intervals;
+			ring_push(segments);
+			next++;
+		}
+		double t1 = get_time();
+
+		// Attenuate - queued segments, until the tally ring is full
+		unsigned long n = ring_count(segments);
+		P->depth[0] += n;
+		for( unsigned long i = 0; i < n && i < PIPE_PREFETCH; i++ )
+			prefetch_segment(I, S, (Segment_Desc *) ring_peek(segments, i));
+		for( unsigned long i = 0; i < n; i++ )
+		{
+			P->pending = (char *) ring_slot(tallies);
+			if( P->pending == NULL )
+			{
+				P->backpressure++;
+				break;
+			}
+
+			if( i + PIPE_PREFETCH < n )
+				prefetch_segment(I, S, (Segment_Desc *) ring_peek(segments,
+							PIPE_PREFETCH));
+
+			D = (Segment_Desc *) ring_peek(segments, 0);
+			attenuate_segment( I, S, D->QSR_id, D->FAI_id, state_flux,
+					simd_vecs, table );
+			ring_pop(segments);
+			ring_push(tallies);
+			P->segments_done++;
+		}
+		P->pending = NULL;
+		double t2 = get_time();
+
+		// Tally - every queued tally, prefetching the fine flux of the
+		// regions ahead
+		n = ring_count(tallies);
+		P->depth[1] += n;
+		for( unsigned long i = 0; i < n; i++ )
+		{
+			if( i + PIPE_PREFETCH < n )
+			{
+				long fsr = *((long *) ring_peek(tallies, PIPE_PREFETCH));
+				char * flux = (char *) (region_fine_flux(I, S,
+							(int) (fsr / I->fine_axial_intervals)) +
+						fsr % I->fine_axial_intervals * I->egroups);
+				for( long b = 0; b < I->egroups * (long) sizeof(float);
+						b += 64 )
+					__builtin_prefetch(flux + b, 1, 3);
+			}
+
+			char * entry = (char *) ring_peek(tallies, 0);
+			pipeline_apply_tally(I, S, *((long *) entry),
+					(float *) (entry + TALLY_ENTRY_HEADER));
+			ring_pop(tallies);
+		}
+		double t3 = get_time();
+
+		P->time[PIPE_GENERATE] += (long) ((t1 - t0) * 1.0e9);
+		P->time[PIPE_ATTENUATE] += (long) ((t2 - t1) * 1.0e9);
+		P->time[PIPE_TALLY] += (long) ((t3 - t2) * 1.0e9);
+		P->batches[PIPE_GENERATE]++;
+		P->batches[PIPE_ATTENUATE]++;
+		P->batches[PIPE_TALLY]++;
+	}
+}
+
+// Prints how the threads' time split between the stages, and how full the
+// rings were when each stage came to them
+void print_pipeline( Input * I )
+{
+	static const char * names[PIPE_STAGES] = { "Generate", "Attenuate",
+		"Tally" };
+
+	long total = 0;
+	for( int s = 0; s < PIPE_STAGES; s++ )
+		total += I->pipe_time[s];
+	long rounds = I->pipe_batches[PIPE_ATTENUATE];
+
+	printf("%-25s%d segments, %d tallies\n", "Pipeline Rings:",
+			I->pipeline_depth, I->pipeline_tally_depth);
+	for( int s = 0; s < PIPE_STAGES; s++ )
+	{
+		char label[32];
+		sprintf(label, "%s Stage:", names[s]);
+		printf("%-25s%.1lf%% of the time, %.3lf us per batch\n", label,
+				total > 0 ? 100. * I->pipe_time[s] / total : 0.,
+				I->pipe_batches[s] > 0 ? I->pipe_time[s] / 1000. /
+				I->pipe_batches[s] : 0.);
+	}
+	if( rounds > 0 )
+	{
+		printf("%-25s%.1lf of %d segments\n", "Mean Segment Queue:",
+				(double) I->pipe_depth[0] / rounds, I->pipeline_depth);
+		printf("%-25s%.1lf of %d tallies\n", "Mean Tally Queue:",
+				(double) I->pipe_depth[1] / rounds, I->pipeline_tally_depth);
+		printf("%-25s%.1lf%% of attenuate batches\n", "Tally Back-pressure:",
+				100. * I->pipe_backpressure / rounds);
+	}
+}
@@ -0,0 +1,161 @@
+#include "SimpleMOC-kernel_header.h"
+#include<sched.h>
+
+// Reproducible sum mode (-D). With the locked tally, the order in which
+// threads add into a fine source region's flux depends on timing, so the
+// fine flux differs bitwise between runs and thread counts. Here every
+// fixed chunk of segments draws its segments and starting flux from a
+// counter-based random stream, so it doesn't matter which thread runs it.
+// A thread stages the chunk's tallies in segment order, then waits for all
+// earlier chunks to commit before adding them into the fine flux. The
+// additions happen in the same order for any number of threads, so the
+// fine flux is bitwise identical to a serial run.
+
+// Stage of the calling kernel thread (NULL when off, or outside a sweep)
+__thread Tally_Stage * tally_stage = NULL;
+
+// Allocates the calling thread's stage, if in reproducible mode
+void tally_stage_begin( Input * I, long capacity )
+{
+	tally_stage = NULL;
+	if( !I->reproducible )
+		return;
+
+	Tally_Stage * T = (Tally_Stage *) malloc(sizeof(Tally_Stage));
+	T->n = 0;
+	T->capacity = capacity;
+	T->egroups = I->egroups;
+	T->keys = (long *) malloc( capacity * sizeof(long));
+	T->flux = (float *) malloc( capacity * I->egroups * sizeof(float));
+
+	tally_stage = T;
+}
+
+// Stages one tile of a segment's tally. The first tile starts the entry.
+void tally_stage_add( Tally_Stage * T, long fsr, int g0, int ng,
+		float * tally )
+{
+	if( g0 == 0 )
+	{
+		if( T->n == T->capacity )
+		{
+			T->capacity *= 2;
+			T->keys = (long *) realloc( T->keys, T->capacity * sizeof(long));
+			T->flux = (float *) realloc( T->flux,
+					T->capacity * T->egroups * sizeof(float));
+		}
+		T->keys[T->n++] = fsr;
+	}
+
+	memcpy(&T->flux[(T->n - 1) * T->egroups + g0], tally, ng * sizeof(float));
+}
+
+// Waits for the chunks before this one, then adds the staged tallies into
+// the fine flux in segment order and hands the turn to the next chunk.
+// Only one thread commits at a time, so no locks are needed.
+void tally_stage_commit( Input * I, Source * S, Tally_Stage * T,
+		long * committed, long ticket )
+{
+	while( __atomic_load_n(committed, __ATOMIC_ACQUIRE) != ticket )
+		sched_yield();
+
+	for( long e = 0; e < T->n; e++ )
+	{
+		int QSR_id = (int) (T->keys[e] / I->fine_axial_intervals);
+		int FAI_id = (int) (T->keys[e] % I->fine_axial_intervals);
+		float * FSR_flux = region_fine_flux(I, S, QSR_id) +
+			FAI_id * I->egroups;
+		float * flux = &T->flux[e * T->egroups];
+
+		for( int g = 0; g < T->egroups; g++ )
+			FSR_flux[g] += flux[g];
+	}
+	T->n = 0;
+
+	__atomic_store_n(committed, ticket + 1, __ATOMIC_RELEASE);
+}
+
+void tally_stage_end( void )
+{
+	Tally_Stage * T = tally_stage;
+	if( T == NULL )
+		return;
+
+	free(T->keys);
+	free(T->flux);
+	free(T);
+	tally_stage = NULL;
+}
+
+// Uniform float in [0, 1) from the top 24 bits of a random value
+static float unit_float( unsigned long long r )
+{
+	return (float) (r >> 40) * (1.0f / 16777216.0f);
+}
+
+// Attenuates segments [begin, end) of a sweep, independent of the thread
+// running them. The chunk starts from its own random angular flux.
+void attenuate_chunk( Input * I, Source * S, Table * table, long begin,
+		long end, float * state_flux, SIMD_Vectors * simd_vecs )
+{
+	unsigned long long seed = run_seed(I);
+	unsigned long long segment_stream = (unsigned long long) I->rank << 2;
+	unsigned long long flux_stream = segment_stream | 1;
+
+	for( int g = 0; g < I->egroups; g++ )
+		state_flux[g] = unit_float(counter_random(seed, flux_stream,
+					(unsigned long long) begin * I->egroups + g));
+
+	for( long i = begin; i < end; i++ )
+	{
+		unsigned long long r = counter_random(seed, segment_stream, i);
+
+		// Pick Random QSR and Fine Axial Interval
+		int QSR_id = (int) ((r >> 32) % I->source_3D_regions);
+		int FAI_id = (int) ((r & 0xFFFFFFFFULL) % I->fine_axial_intervals);
+
+		attenuate_segment( I, S, QSR_id, FAI_id, state_flux, simd_vecs,
+				table);
+	}
+}
+
+// FNV-1a hash of the bits of the whole fine flux. Under MPI, the hashes of
+// the ranks are combined (xor) on rank 0.
+unsigned long long flux_checksum( Input * I, Source * S )
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	long n = (long) I->fine_axial_intervals * I->egroups;
+
+	for( int q = 0; q < I->source_3D_regions; q++ )
+	{
+		unsigned char * bytes = (unsigned char *) region_fine_flux(I, S, q);
+		for( long b = 0; b < n * (long) sizeof(float); b++ )
+		{
+			hash ^= bytes[b];
+			hash *= 0x100000001B3ULL;
+		}
+	}
+
+	#ifdef MPI
+	unsigned long long local = hash;
+	MPI_Reduce(&local, &hash, 1, MPI_UNSIGNED_LONG_LONG, MPI_BXOR, 0,
+			MPI_COMM_WORLD);
+	#endif
+
+	return hash;
+}
+
+// Prints the checksum to compare runs by, and what the ordered reduction
+// cost against the locked tally
+void print_reproducible( Input * I, Results * R )
+{
+	double ordered = time_per_intersection(R, R->median);
+	double locked = time_per_intersection(R, I->locked_runtime);
+
+	printf("%-25s%016llx\n", "Fine Flux Checksum:", I->flux_checksum);
+	printf("%-25s%.3lf ns (reproducible)\n", "Time per Intersection:",
+			ordered);
+	printf("%-25s%.3lf ns (locked)\n", "", locked);
+	printf("%-25s%+.2lf%%\n", "Reproducible Overhead:",
+			(ordered / locked - 1.0) * 100.);
+}
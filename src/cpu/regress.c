@@ -0,0 +1,379 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Regression check against a stored baseline. The baseline is a JSON
+// results record written by "-o". Its configuration is rerun, and the
+// time per intersection (plus any perf counters both runs counted) of the
+// repetitions is compared with Welch's t-test.
+
+// Reads a whole file into a NUL terminated string (NULL if unreadable)
+char * read_text_file( const char * fname )
+{
+	FILE * fp = fopen(fname, "r");
+	if( fp == NULL )
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	long len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	char * text = (char *) malloc( len + 1 );
+	size_t got = fread(text, 1, len, fp);
+	text[got] = '\0';
+	fclose(fp);
+
+	return text;
+}
+
+// Finds the value of a member of our own JSON records. Member names are
+// unique across the sections, so a flat search for "key": is enough.
+const char * json_find( const char * text, const char * key )
+{
+	char pattern[128];
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+	const char * p = strstr(text, pattern);
+	if( p == NULL )
+		return NULL;
+
+	p += strlen(pattern);
+	while( *p == ' ' )
+		p++;
+	return p;
+}
+
+double json_number( const char * text, const char * key, double fallback )
+{
+	const char * p = json_find(text, key);
+	if( p == NULL )
+		return fallback;
+
+	char * end;
+	double v = strtod(p, &end);
+	return end == p ? fallback : v;
+}
+
+// Copies a string member into buf ("" if missing)
+void json_string( const char * text, const char * key, char * buf, int len )
+{
+	buf[0] = '\0';
+	const char * p = json_find(text, key);
+	if( p == NULL || *p != '"' )
+		return;
+
+	p++;
+	int n = 0;
+	while( *p != '\0' && *p != '"' && n < len - 1 )
+		buf[n++] = *p++;
+	buf[n] = '\0';
+}
+
+// Reads an array of numbers. Returns its length (0 if missing).
+int json_array( const char * text, const char * key, double ** values )
+{
+	*values = NULL;
+	const char * p = json_find(text, key);
+	if( p == NULL || *p != '[' )
+		return 0;
+	p++;
+
+	int n = 0;
+	int capacity = 16;
+	*values = (double *) malloc( capacity * sizeof(double));
+	while( 1 )
+	{
+		char * end;
+		double v = strtod(p, &end);
+		if( end == p )
+			break;
+		if( n == capacity )
+		{
+			capacity *= 2;
+			*values = (double *) realloc( *values, capacity * sizeof(double));
+		}
+		(*values)[n++] = v;
+
+		p = end;
+		while( *p == ' ' || *p == ',' )
+			p++;
+	}
+
+	return n;
+}
+
+// Loads a baseline record, and sets the inputs to the configuration it
+// was run with. The exponential table and threading backend are build
+// options, so comparing builds against each other is up to the caller.
+Baseline * load_baseline( Input * I, const char * fname )
+{
+	Baseline * B = (Baseline *) malloc(sizeof(Baseline));
+	B->fname = (char *) fname;
+	B->text = read_text_file(fname);
+	if( B->text == NULL )
+	{
+		fprintf(stderr, "Unable to read baseline file %s\n", fname);
+		exit(1);
+	}
+
+	B->repetitions = json_array(B->text, "runtimes", &B->runtimes);
+	if( B->repetitions == 0 || json_find(B->text, "egroups") == NULL )
+	{
+		fprintf(stderr, "%s is not a JSON results record\n", fname);
+		exit(1);
+	}
+
+	const char * T = B->text;
+	I->source_2D_regions = (int) json_number(T, "source_2D_regions",
+			I->source_2D_regions);
+	I->coarse_axial_intervals = (int) json_number(T, "coarse_axial_intervals",
+			I->coarse_axial_intervals);
+	I->fine_axial_intervals = (int) json_number(T, "fine_axial_intervals",
+			I->fine_axial_intervals);
+	I->decomp_assemblies_ax = (int) json_number(T, "decomp_assemblies_ax",
+			I->decomp_assemblies_ax);
+	I->segments = (long) json_number(T, "segments", I->segments);
+	I->egroups = (int) json_number(T, "egroups", I->egroups);
+	#ifdef MULTITHREADED
+	I->nthreads = (int) json_number(T, "nthreads", I->nthreads);
+	#endif
+	I->tile_size = (int) json_number(T, "tile_size", I->tile_size);
+	I->scheduler = (int) json_number(T, "scheduler", I->scheduler);
+	I->chunk_size = (long) json_number(T, "chunk_size", I->chunk_size);
+	I->sweeps = (int) json_number(T, "sweeps", I->sweeps);
+	I->boundary_tracks = (int) json_number(T, "boundary_tracks",
+			I->boundary_tracks);
+	I->warmup_runs = (int) json_number(T, "warmup_runs", I->warmup_runs);
+	I->repetitions = (int) json_number(T, "repetitions", I->repetitions);
+	I->tally_cache_lines = (int) json_number(T, "tally_cache_lines",
+			I->tally_cache_lines);
+	I->pipeline_depth = (int) json_number(T, "pipeline_depth",
+			I->pipeline_depth);
+	I->pipeline_tally_depth = (int) json_number(T, "pipeline_tally_depth",
+			I->pipeline_depth);
+	I->reproducible = (int) json_number(T, "reproducible", I->reproducible);
+	I->lattice_pins = (int) json_number(T, "lattice_pins", I->lattice_pins);
+	I->lattice_rings = (int) json_number(T, "lattice_rings", I->lattice_rings);
+	I->lattice_sectors = (int) json_number(T, "lattice_sectors",
+			I->lattice_sectors);
+	I->azimuthal_angles = (int) json_number(T, "azimuthal_angles",
+			I->azimuthal_angles);
+	I->track_spacing = json_number(T, "track_spacing", I->track_spacing);
+	I->store_segments = (int) json_number(T, "store_segments",
+			I->store_segments);
+	I->polar_angles = (int) json_number(T, "polar_angles", I->polar_angles);
+	I->axial_spacing = json_number(T, "axial_spacing", I->axial_spacing);
+	#ifdef COMPACT
+	I->lock_stripes = (int) json_number(T, "lock_stripes", I->lock_stripes);
+	#endif
+
+	// An explicit CPU list isn't recorded, so keep the placement given
+	int affinity = (int) json_number(T, "affinity", I->affinity);
+	if( affinity != AFFINITY_LIST )
+		I->affinity = affinity;
+
+	// Reuse the baseline's fixed seed, if it had one
+	long seed = (long) json_number(T, "seed", -1);
+	if( seed >= 0 )
+		I->seed = seed;
+
+	B->egroups = I->egroups;
+	B->segments = (long) json_number(T, "segments_per_run", I->segments);
+
+	return B;
+}
+
+// Continued fraction of the incomplete beta function (modified Lentz)
+double beta_continued_fraction( double a, double b, double x )
+{
+	const double tiny = 1.0e-30;
+	double c = 1.0;
+	double d = 1.0 - (a + b) * x / (a + 1.0);
+	if( fabs(d) < tiny )
+		d = tiny;
+	d = 1.0 / d;
+	double h = d;
+
+	for( int m = 1; m <= 200; m++ )
+	{
+		// Even step
+		double num = m * (b - m) * x / ((a + 2*m - 1) * (a + 2*m));
+		d = 1.0 + num * d;
+		if( fabs(d) < tiny )
+			d = tiny;
+		c = 1.0 + num / c;
+		if( fabs(c) < tiny )
+			c = tiny;
+		d = 1.0 / d;
+		h *= d * c;
+
+		// Odd step
+		num = -(a + m) * (a + b + m) * x / ((a + 2*m) * (a + 2*m + 1));
+		d = 1.0 + num * d;
+		if( fabs(d) < tiny )
+			d = tiny;
+		c = 1.0 + num / c;
+		if( fabs(c) < tiny )
+			c = tiny;
+		d = 1.0 / d;
+		double delta = d * c;
+		h *= delta;
+
+		if( fabs(delta - 1.0) < 1.0e-12 )
+			break;
+	}
+
+	return h;
+}
+
+// Regularized incomplete beta function I_x(a, b)
+double incomplete_beta( double a, double b, double x )
+{
+	if( x <= 0 )
+		return 0;
+	if( x >= 1 )
+		return 1;
+
+	double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+			a * log(x) + b * log(1.0 - x));
+
+	if( x < (a + 1.0) / (a + b + 2.0) )
+		return front * beta_continued_fraction(a, b, x) / a;
+	return 1.0 - front * beta_continued_fraction(b, a, 1.0 - x) / b;
+}
+
+void sample_mean_var( double * x, int n, double * mean, double * var )
+{
+	double sum = 0;
+	for( int i = 0; i < n; i++ )
+		sum += x[i];
+	*mean = sum / n;
+
+	double ss = 0;
+	for( int i = 0; i < n; i++ )
+		ss += (x[i] - *mean) * (x[i] - *mean);
+	*var = n > 1 ? ss / (n - 1) : 0;
+}
+
+// Welch's unequal variance t-test. Returns the two-sided p-value of the
+// means being equal (-1 if either sample has fewer than two values).
+double welch_test( double * a, int na, double * b, int nb )
+{
+	if( na < 2 || nb < 2 )
+		return -1;
+
+	double ma, va, mb, vb;
+	sample_mean_var(a, na, &ma, &va);
+	sample_mean_var(b, nb, &mb, &vb);
+
+	double sa = va / na;
+	double sb = vb / nb;
+	if( sa + sb == 0 )
+		return ma == mb ? 1 : 0;
+
+	double t = (mb - ma) / sqrt(sa + sb);
+	double df = (sa + sb) * (sa + sb) /
+		(sa * sa / (na - 1) + sb * sb / (nb - 1));
+
+	return incomplete_beta(df / 2.0, 0.5, df / (df + t * t));
+}
+
+// Prints one compared metric. Returns the change of the means in percent.
+double print_comparison( const char * name, double * a, int na, double * b,
+		int nb )
+{
+	double ma, va, mb, vb;
+	sample_mean_var(a, na, &ma, &va);
+	sample_mean_var(b, nb, &mb, &vb);
+	double change = ma != 0 ? (mb / ma - 1.0) * 100. : 0;
+	double p = welch_test(a, na, b, nb);
+
+	printf("%-25s%-13.4lg%-13.4lg%+-10.2lf", name, ma, mb, change);
+	if( p >= 0 )
+		printf("%.4lf%s\n", p, p < 0.05 ? " *" : "");
+	else
+		printf("n/a\n");
+
+	return change;
+}
+
+// Compares the results against the baseline. Returns nonzero if time per
+// intersection got slower than the threshold - significantly so, when
+// both runs have the repetitions for a t-test.
+int check_regression( Input * I, Results * R )
+{
+	Baseline * B = I->baseline;
+
+	border_print();
+	center_print("REGRESSION CHECK", 79);
+	border_print();
+
+	char date[64], compiler[128];
+	json_string(B->text, "date", date, sizeof(date));
+	json_string(B->text, "compiler", compiler, sizeof(compiler));
+	printf("%-25s%s\n", "Baseline:", B->fname);
+	printf("%-25s%s (%s)\n", "Baseline Run:", date, compiler);
+	printf("%-25s%.1lf%% slower\n", "Threshold:", I->threshold);
+	printf("\n%-25s%-13s%-13s%-10s%s\n", "Metric (mean)", "Baseline",
+			"Current", "Change %", "p-value");
+
+	// Time per intersection of every repetition
+	double * base = (double *) malloc( B->repetitions * sizeof(double));
+	for( int r = 0; r < B->repetitions; r++ )
+		base[r] = B->runtimes[r] / B->segments / B->egroups * 1.0e9;
+	double * current = (double *) malloc( R->repetitions * sizeof(double));
+	for( int r = 0; r < R->repetitions; r++ )
+		current[r] = time_per_intersection(R, R->runtimes[r]);
+
+	double slowdown = print_comparison("Time/Intersection (ns)", base,
+			B->repetitions, current, R->repetitions);
+	double p = welch_test(base, B->repetitions, current, R->repetitions);
+
+	// Counters (per intersection) counted by both runs
+	#ifdef PERF
+	double per_run = (double) R->segments * R->egroups;
+	for( int i = 0; i < I->n_perf_groups; i++ )
+	{
+		Perf_Counters * P = &I->perf[i];
+		for( int e = 0; e < P->n_events; e++ )
+		{
+			char key[64];
+			snprintf(key, sizeof(key), "%s.%s", perf_group_name(P->group),
+					perf_event_name(P->group, e));
+
+			double * values;
+			int n = json_array(B->text, key, &values);
+			if( n == 0 || !P->opened[e] || P->runs == 0 )
+			{
+				free(values);
+				continue;
+			}
+
+			double * samples = (double *) malloc( P->runs * sizeof(double));
+			for( int r = 0; r < P->runs; r++ )
+				samples[r] = P->run_counts[r * PERF_MAX_EVENTS + e] / per_run;
+			print_comparison(key, values, n, samples, P->runs);
+			free(samples);
+			free(values);
+		}
+	}
+	#endif
+
+	int failed = slowdown > I->threshold && (p < 0 || p < 0.05);
+
+	printf("\n");
+	if( p < 0 )
+		printf("Fewer than 2 repetitions on one side - no t-test, the\n"
+				"threshold alone decides.\n");
+	if( failed )
+		printf("%-25s%.2lf%% slower than the baseline\n", "REGRESSION:",
+				slowdown);
+	else if( slowdown > I->threshold )
+		printf("%-25s%.2lf%% slower, but not significant (p = %.4lf)\n",
+				"PASSED:", slowdown, p);
+	else
+		printf("%-25s%+.2lf%% vs the baseline\n", "PASSED:", slowdown);
+
+	free(base);
+	free(current);
+
+	return failed;
+}
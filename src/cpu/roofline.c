@@ -0,0 +1,167 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Analytic FLOPs per intersection (one energy group of one segment)
+double flops_per_intersection( Input * I )
+{
+	double flops = 0;
+	for( int s = 0; s < N_STAGES; s++ )
+		flops += stage_flops(I, s);
+	return flops;
+}
+
+// Analytic bytes of source data moved per intersection
+double bytes_per_intersection( Input * I )
+{
+	double bytes = 0;
+	for( int s = 0; s < N_STAGES; s++ )
+		bytes += stage_bytes(I, s);
+	return bytes;
+}
+
+// Body of the bandwidth probe - a STREAM triad over this thread's slice.
+// The first call only touches the arrays, so pages land next to the
+// thread that uses them.
+void triad_thread( void * args )
+{
+	Probe_Args * P = (Probe_Args *) args;
+	int thread = get_thread_num();
+	int nthreads = get_num_threads();
+
+	long begin = P->n * thread / nthreads;
+	long end = P->n * (thread + 1) / nthreads;
+	double * restrict a = P->a;
+	double * restrict b = P->b;
+	double * restrict c = P->c;
+
+	if( P->init )
+	{
+		for( long i = begin; i < end; i++ )
+		{
+			a[i] = 1.0;
+			b[i] = 2.0;
+			c[i] = 0.0;
+		}
+		return;
+	}
+
+	const double scalar = 3.0;
+	for( long i = begin; i < end; i++ )
+		a[i] = b[i] + scalar * c[i];
+}
+
+// Body of the compute probe - independent multiply-adds on an L1 resident
+// array, which the compiler vectorizes like the kernel's group loops
+void fma_thread( void * args )
+{
+	Probe_Args * P = (Probe_Args *) args;
+	int thread = get_thread_num();
+
+	float x[PROBE_FMA_WIDTH];
+	for( int i = 0; i < PROBE_FMA_WIDTH; i++ )
+		x[i] = (float) i / PROBE_FMA_WIDTH;
+
+	const float a = 0.999f;
+	const float b = 0.001f;
+	for( long r = 0; r < P->n; r++ )
+	{
+		for( int i = 0; i < PROBE_FMA_WIDTH; i++ )
+			x[i] = x[i] * a + b;
+	}
+
+	// Keep the result live
+	float sum = 0;
+	for( int i = 0; i < PROBE_FMA_WIDTH; i++ )
+		sum += x[i];
+	P->checksum[thread] = sum;
+}
+
+// Measures the sustainable memory bandwidth (GB/s) with a STREAM-like
+// triad. Each array is 4x the last level cache, as STREAM requires, and
+// the best of 10 passes is kept.
+double probe_bandwidth( Input * I )
+{
+	Probe_Args P;
+	P.n = 4 * detect_cache_size(3) / sizeof(double);
+	if( P.n < (1L << 22) )
+		P.n = 1L << 22;
+	P.a = (double *) malloc( P.n * sizeof(double));
+	P.b = (double *) malloc( P.n * sizeof(double));
+	P.c = (double *) malloc( P.n * sizeof(double));
+
+	P.init = 1;
+	parallel_region( triad_thread, &P );
+	P.init = 0;
+
+	double best = 0;
+	for( int r = 0; r < 10; r++ )
+	{
+		double start = get_time();
+		parallel_region( triad_thread, &P );
+		double t = get_time() - start;
+		if( r == 0 || t < best )
+			best = t;
+	}
+
+	free(P.a);
+	free(P.b);
+	free(P.c);
+
+	// Triad reads two arrays and writes one
+	return 3.0 * P.n * sizeof(double) / best / 1.0e9;
+}
+
+// Measures the attainable single precision compute rate (GFLOP/s)
+double probe_compute( Input * I )
+{
+	Probe_Args P;
+	P.n = 200000;
+	P.checksum = (float *) malloc( I->nthreads * sizeof(float));
+
+	double best = 0;
+	for( int r = 0; r < 5; r++ )
+	{
+		double start = get_time();
+		parallel_region( fma_thread, &P );
+		double t = get_time() - start;
+		if( r == 0 || t < best )
+			best = t;
+	}
+
+	free(P.checksum);
+
+	return 2.0 * PROBE_FMA_WIDTH * P.n * I->nthreads / best / 1.0e9;
+}
+
+// Prints the analytic FLOP/byte counts, and the achieved rates of the
+// median run. If the probes were run, the rates are compared against the
+// roof at the kernel's arithmetic intensity.
+void print_roofline( Input * I, Results * R )
+{
+	double flops = flops_per_intersection(I);
+	double bytes = bytes_per_intersection(I);
+	double ai = flops / bytes;
+	double intersections = (double) R->segments * R->egroups;
+	double gflops = flops * intersections / R->median / 1.0e9;
+	double gbps = bytes * intersections / R->median / 1.0e9;
+
+	printf("%-25s%.1lf\n", "FLOPs per Intersection:", flops);
+	printf("%-25s%.1lf\n", "Bytes per Intersection:", bytes);
+	printf("%-25s%.0lf FLOPs, %.0lf bytes\n", "Per Segment:",
+			flops * I->egroups, bytes * I->egroups);
+	printf("%-25s%.2lf FLOP/byte\n", "Arithmetic Intensity:", ai);
+	printf("%-25s%.2lf\n", "Achieved GFLOP/s:", gflops);
+	printf("%-25s%.2lf\n", "Effective GB/s:", gbps);
+
+	if( I->peak_bandwidth > 0 )
+	{
+		double memory_roof = ai * I->peak_bandwidth;
+		double roof = memory_roof < I->peak_gflops ? memory_roof :
+			I->peak_gflops;
+
+		printf("%-25s%.2lf GB/s\n", "Triad Bandwidth:", I->peak_bandwidth);
+		printf("%-25s%.2lf GFLOP/s\n", "Compute Roof:", I->peak_gflops);
+		printf("%-25s%.2lf GFLOP/s (%s bound)\n", "Roof at this Intensity:",
+				roof, memory_roof < I->peak_gflops ? "memory" : "compute");
+		printf("%-25s%.1lf%%\n", "Fraction of Roof:", gflops / roof * 100.);
+	}
+}
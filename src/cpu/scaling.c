@@ -0,0 +1,299 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Parses a list of values such as "1,2,4", a range "1-8", a stepped range
+// "1-16:3" or a geometric range "1-64:x2". Returns the number of values,
+// or 0 if the list is malformed.
+int parse_range_list( const char * str, long ** list )
+{
+	int n = 0;
+	int max = 16;
+	long * vals = (long *) malloc( max * sizeof(long));
+
+	const char * p = str;
+	while( *p != '\0' )
+	{
+		char * next;
+		long first = strtol(p, &next, 10);
+		long last = first;
+		long step = 1;
+		int geometric = 0;
+		if( next == p || first < 0 )
+		{
+			free(vals);
+			return 0;
+		}
+
+		if( *next == '-' )
+		{
+			p = next + 1;
+			last = strtol(p, &next, 10);
+			if( next == p || last < first )
+			{
+				free(vals);
+				return 0;
+			}
+
+			if( *next == ':' )
+			{
+				p = next + 1;
+				if( *p == 'x' )
+				{
+					geometric = 1;
+					p++;
+				}
+				step = strtol(p, &next, 10);
+				if( next == p || step < 1 || (geometric && step < 2) ||
+						(geometric && first < 1) )
+				{
+					free(vals);
+					return 0;
+				}
+			}
+		}
+
+		for( long v = first; v <= last; v = geometric ? v * step : v + step )
+		{
+			if( n == max )
+			{
+				max *= 2;
+				vals = (long *) realloc( vals, max * sizeof(long));
+			}
+			vals[n++] = v;
+
+			// Stop before the next value would overflow
+			if( geometric ? v > last / step : v > last - step )
+				break;
+		}
+
+		if( *next == ',' )
+			next++;
+		else if( *next != '\0' )
+		{
+			free(vals);
+			return 0;
+		}
+		p = next;
+	}
+
+	*list = vals;
+	return n;
+}
+
+// Times one configuration - the median of the timed repetitions
+double time_configuration( Input * I, Source * S, Table * table )
+{
+	// Autotune the chunk size for every configuration (if requested)
+	long chunk = I->chunk_size;
+	if( chunk == 0 )
+		I->chunk_size = autotune_chunk_size(I, S, table);
+
+	I->warmup = 1;
+	for( int w = 0; w < I->warmup_runs; w++ )
+		run_kernel(I, S, table);
+	I->warmup = 0;
+
+	Results * R = init_results( I->repetitions, I->segments, I->egroups );
+	for( int r = 0; r < I->repetitions; r++ )
+	{
+		double start = get_time();
+		run_kernel(I, S, table);
+		R->runtimes[r] = get_time() - start;
+	}
+	compute_statistics(R);
+
+	double median = R->median;
+	free(R->runtimes);
+	free(R);
+	I->chunk_size = chunk;
+
+	return median;
+}
+
+void set_thread_count( Input * I, int nthreads )
+{
+	I->nthreads = nthreads;
+	set_num_threads(nthreads);
+
+	// Thread placement depends on the thread count
+	free(I->thread_cpus);
+	map_threads_to_cpus(I);
+}
+
+// Runs strong and weak scaling series for every combination of 2D source
+// regions, energy groups and segments. Source data is only rebuilt when the
+// region count or the number of energy groups changes.
+void run_scaling_study( Input * I, Table * table )
+{
+	Scaling * C = I->scaling;
+	int tile_size = I->tile_size;
+	int nthreads = I->nthreads;
+
+	int n_points = C->n_regions * C->n_egroups * C->n_segments *
+		C->n_threads * 2;
+	Scaling_Point * P = (Scaling_Point *) malloc( n_points *
+			sizeof(Scaling_Point));
+	int n = 0;
+
+	for( int r = 0; r < C->n_regions; r++ )
+	{
+		for( int e = 0; e < C->n_egroups; e++ )
+		{
+			I->source_2D_regions = C->regions[r];
+			I->source_3D_regions = count_3D_regions(I);
+			I->egroups = C->egroups[e];
+			I->tile_size = tile_size;
+			I->tile_size = select_tile_size(I);
+
+			Source * S = initialize_sources(I);
+
+			for( int s = 0; s < C->n_segments; s++ )
+			{
+				// Strong scaling - fixed problem, varying threads.
+				// Weak scaling - fixed segments per thread.
+				for( int weak = 0; weak <= 1; weak++ )
+				{
+					for( int t = 0; t < C->n_threads; t++ )
+					{
+						set_thread_count(I, C->threads[t]);
+						I->segments = C->segments[s];
+						if( weak && I->segments > LONG_MAX / C->threads[t] )
+						{
+							fprintf(stderr, "%ld segments per thread on %ld "
+									"threads overflows the segment count\n",
+									I->segments, C->threads[t]);
+							exit(1);
+						}
+						if( weak )
+							I->segments *= C->threads[t];
+
+						printf("%s: %ld 2D regions, %d groups, %ld segments, "
+								"%d threads...\n", weak ? "Weak" : "Strong",
+								C->regions[r], I->egroups, I->segments,
+								I->nthreads);
+
+						Scaling_Point * pt = &P[n++];
+						pt->weak = weak;
+						pt->regions = C->regions[r];
+						pt->egroups = I->egroups;
+						pt->base_segments = C->segments[s];
+						pt->segments = I->segments;
+						pt->nthreads = I->nthreads;
+						pt->runtime = time_configuration(I, S, table);
+						pt->tpi = pt->runtime / (double) pt->segments /
+							(double) pt->egroups * 1.0e9;
+					}
+				}
+			}
+
+			free_sources(I, S);
+		}
+	}
+
+	compute_efficiency(P, n);
+	print_scaling_tables(P, n);
+	if( I->results_file != NULL )
+		write_scaling_results(P, n, I->results_file);
+
+	set_thread_count(I, nthreads);
+	free(P);
+}
+
+// Speedup and parallel efficiency of each point, relative to the lowest
+// thread count of its series (ideally 1 thread)
+void compute_efficiency( Scaling_Point * P, int n )
+{
+	for( int i = 0; i < n; i++ )
+	{
+		Scaling_Point * base = NULL;
+		for( int j = 0; j < n; j++ )
+		{
+			if( P[j].weak == P[i].weak && P[j].regions == P[i].regions &&
+					P[j].egroups == P[i].egroups &&
+					P[j].base_segments == P[i].base_segments &&
+					(base == NULL || P[j].nthreads < base->nthreads) )
+				base = &P[j];
+		}
+
+		if( P[i].weak )
+		{
+			P[i].speedup = base->runtime / P[i].runtime *
+				P[i].nthreads / base->nthreads;
+			P[i].efficiency = base->runtime / P[i].runtime;
+		}
+		else
+		{
+			P[i].speedup = base->runtime / P[i].runtime;
+			P[i].efficiency = P[i].speedup * base->nthreads / P[i].nthreads;
+		}
+	}
+}
+
+void print_scaling_tables( Scaling_Point * P, int n )
+{
+	for( int weak = 0; weak <= 1; weak++ )
+	{
+		border_print();
+		center_print(weak ? "WEAK SCALING" : "STRONG SCALING", 79);
+		border_print();
+		printf("%-10s%-8s%-9s%-14s%-12s%-14s%-10s%s\n", "Regions", "Groups",
+				"Threads", "Segments", "Runtime (s)", "Time/Int (ns)",
+				"Speedup", "Efficiency");
+		for( int i = 0; i < n; i++ )
+		{
+			if( P[i].weak != weak )
+				continue;
+			printf("%-10ld%-8d%-9d%-14ld%-12.4lf%-14.3lf%-10.2lf%.1lf%%\n",
+					P[i].regions, P[i].egroups, P[i].nthreads, P[i].segments,
+					P[i].runtime, P[i].tpi, P[i].speedup,
+					P[i].efficiency * 100.);
+		}
+	}
+	border_print();
+}
+
+// Writes the scaling points - CSV if the name ends in ".csv", JSON otherwise
+void write_scaling_results( Scaling_Point * P, int n, const char * fname )
+{
+	size_t len = strlen(fname);
+	int csv = len > 4 && strcmp(fname + len - 4, ".csv") == 0;
+
+	FILE * fp = fopen(fname, "w");
+	if( fp == NULL )
+	{
+		fprintf(stderr, "Unable to open results file %s\n", fname);
+		return;
+	}
+
+	if( csv )
+		fprintf(fp, "study,source_2D_regions,egroups,base_segments,"
+				"segments,nthreads,runtime,time_per_intersection,speedup,"
+				"efficiency\n");
+	else
+		fprintf(fp, "{\n  \"scaling\": [\n");
+
+	for( int i = 0; i < n; i++ )
+	{
+		if( csv )
+			fprintf(fp, "%s,%ld,%d,%ld,%ld,%d,%.9lf,%.6lf,%.6lf,%.6lf\n",
+					P[i].weak ? "weak" : "strong", P[i].regions,
+					P[i].egroups, P[i].base_segments,
+					P[i].segments, P[i].nthreads, P[i].runtime, P[i].tpi,
+					P[i].speedup, P[i].efficiency);
+		else
+			fprintf(fp, "    {\"study\": \"%s\", \"source_2D_regions\": %ld, "
+					"\"egroups\": %d, \"base_segments\": %ld, "
+					"\"segments\": %ld, \"nthreads\": %d, "
+					"\"runtime\": %.9lf, \"time_per_intersection\": %.6lf, "
+					"\"speedup\": %.6lf, \"efficiency\": %.6lf}%s\n",
+					P[i].weak ? "weak" : "strong", P[i].regions,
+					P[i].egroups, P[i].base_segments, P[i].segments,
+					P[i].nthreads,
+					P[i].runtime, P[i].tpi, P[i].speedup, P[i].efficiency,
+					i < n - 1 ? "," : "");
+	}
+
+	if( !csv )
+		fprintf(fp, "  ]\n}\n");
+
+	fclose(fp);
+}
@@ -0,0 +1,212 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Splits the segments evenly across the per-thread deques. The scheduler
+// and deques are cache line aligned, so the shared counter and each
+// thread's deque sit on lines of their own.
+Scheduler * init_scheduler( int type, long segments, int nthreads,
+		long chunk )
+{
+	Scheduler * W;
+	if( posix_memalign((void **) &W, 64, sizeof(Scheduler)) != 0 ||
+			posix_memalign((void **) &W->deques, 64,
+				nthreads * sizeof(Deque)) != 0 )
+	{
+		fprintf(stderr, "Unable to allocate segment scheduler\n");
+		exit(1);
+	}
+	W->type = type;
+	W->nthreads = nthreads;
+	W->chunk = chunk;
+	W->segments = segments;
+	W->next = 0;
+
+	for( int t = 0; t < nthreads; t++ )
+	{
+		Deque * D = &W->deques[t];
+		D->begin = segments * t / nthreads;
+		D->end = segments * (t+1) / nthreads;
+		D->steals = 0;
+		D->steal_attempts = 0;
+		init_lock(&D->lock);
+	}
+
+	return W;
+}
+
+void free_scheduler( Scheduler * W )
+{
+	for( int t = 0; t < W->nthreads; t++ )
+		destroy_lock(&W->deques[t].lock);
+	free(W->deques);
+	free(W);
+}
+
+// Owner side - takes one chunk off the front of a deque
+int pop_chunk( Scheduler * W, Deque * D, long * begin, long * end )
+{
+	int found = 0;
+
+	set_lock(&D->lock);
+
+	if( D->begin < D->end )
+	{
+		*begin = D->begin;
+		*end = D->begin + W->chunk;
+		if( *end > D->end )
+			*end = D->end;
+		D->begin = *end;
+		found = 1;
+	}
+
+	unset_lock(&D->lock);
+
+	return found;
+}
+
+// Thief side - takes the back half of a victim's remaining range (or all
+// of it, if there is less than one chunk left)
+int steal_range( Scheduler * W, Deque * victim, long * begin,
+		long * end )
+{
+	int found = 0;
+
+	set_lock(&victim->lock);
+
+	long remaining = victim->end - victim->begin;
+	if( remaining > 0 )
+	{
+		long n = remaining;
+		if( remaining > W->chunk )
+			n = remaining / 2;
+		*end = victim->end;
+		*begin = victim->end - n;
+		victim->end = *begin;
+		found = 1;
+	}
+
+	unset_lock(&victim->lock);
+
+	return found;
+}
+
+// Hands the calling thread its next chunk of segments [begin, end).
+// Returns 0 once a pass over the other deques finds nothing to steal.
+// Work is never added back, and a stolen range is held by its thief until
+// the thief's first chunk is carved off and the rest published, so any
+// work such a pass misses is already in the hands of a thread that will
+// run it.
+int next_chunk( Scheduler * W, int thread, unsigned int * seed,
+		long * begin, long * end )
+{
+	if( W->type == SCHED_DYNAMIC )
+		return next_dynamic_chunk(W, begin, end);
+
+	Deque * D = &W->deques[thread];
+
+	if( pop_chunk(W, D, begin, end) )
+		return 1;
+
+	// Own deque is empty - start stealing at a random victim
+	int nthreads = W->nthreads;
+	int first = rand_r(seed) % nthreads;
+	for( int v = 0; v < nthreads; v++ )
+	{
+		int victim = (first + v) % nthreads;
+		if( victim == thread )
+			continue;
+
+		D->steal_attempts++;
+		long b, e;
+		if( steal_range(W, &W->deques[victim], &b, &e) )
+		{
+			D->steals++;
+
+			// Take the first chunk of the stolen range, and refill our
+			// own deque with the rest, so others may in turn steal from
+			// it. Publishing the whole range before taking the chunk
+			// would let another thief empty it in between.
+			*begin = b;
+			*end = b + W->chunk;
+			if( *end > e )
+				*end = e;
+
+			set_lock(&D->lock);
+			D->begin = *end;
+			D->end = e;
+			unset_lock(&D->lock);
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Dynamic scheduling for backends without an OpenMP dynamic loop
+int next_dynamic_chunk( Scheduler * W, long * begin, long * end )
+{
+	*begin = __atomic_fetch_add(&W->next, W->chunk, __ATOMIC_RELAXED);
+	if( *begin >= W->segments )
+		return 0;
+
+	*end = *begin + W->chunk;
+	if( *end > W->segments )
+		*end = W->segments;
+
+	return 1;
+}
+
+long total_steals( Scheduler * W )
+{
+	long steals = 0;
+	for( int t = 0; t < W->nthreads; t++ )
+		steals += W->deques[t].steals;
+	return steals;
+}
+
+// Times a short warmup sweep for each candidate chunk size and keeps the
+// fastest. Each candidate attenuates the same number of segments, so the
+// fine flux picks up a little extra (untimed) work.
+long autotune_chunk_size( Input * I, Source * S, Table * table )
+{
+	long candidates[] = { 16, 32, 64, 128, 256, 512, 1024, 4096 };
+	int n_candidates = sizeof(candidates) / sizeof(long);
+
+	long chunk = I->chunk_size;
+	int warmup = I->warmup;
+
+	// Enough segments that every thread sees several of the largest chunks
+	long warmup_segments = I->segments / 50;
+	long min_segments = (long) I->nthreads * 4 * candidates[n_candidates-1];
+	if( warmup_segments < min_segments )
+		warmup_segments = min_segments;
+
+	I->warmup = 1;
+
+	// Untimed pass to fault in pages and warm the caches
+	I->chunk_size = candidates[0];
+	run_sweep(I, S, table, warmup_segments);
+
+	long best = candidates[0];
+	double best_time = 0;
+	for( int c = 0; c < n_candidates; c++ )
+	{
+		I->chunk_size = candidates[c];
+		double start = get_time();
+		run_sweep(I, S, table, warmup_segments);
+		double time = get_time() - start;
+		if( I->rank == 0 )
+			printf("  Chunk size %-6ld %.3lf seconds\n", candidates[c], time);
+
+		if( c == 0 || time < best_time )
+		{
+			best = candidates[c];
+			best_time = time;
+		}
+	}
+
+	I->chunk_size = chunk;
+	I->warmup = warmup;
+
+	return best;
+}
@@ -0,0 +1,158 @@
+#include "SimpleMOC-kernel_header.h"
+
+// Per-thread tally cache. Segments often revisit the same fine source
+// regions within a short window, so each thread accumulates its tallies
+// into a small set-associative cache of group vectors keyed by the fine
+// source region. The shared fine flux is only updated, under its lock,
+// when a line is evicted and when the thread finishes its segments.
+
+// Cache of the calling kernel thread (NULL when off, or outside a sweep)
+__thread Tally_Cache * tally_cache = NULL;
+
+// Allocates the calling thread's cache, if the cache is enabled (-K)
+void tally_cache_begin( Input * I )
+{
+	tally_cache = NULL;
+	if( I->tally_cache_lines == 0 )
+		return;
+
+	Tally_Cache * C = (Tally_Cache *) checked_malloc( sizeof(Tally_Cache),
+			"tally cache");
+	memset(C, 0, sizeof(Tally_Cache));
+	int lines = I->tally_cache_lines;
+	C->ways = lines < TALLY_CACHE_WAYS ? lines : TALLY_CACHE_WAYS;
+	C->sets = lines / C->ways;
+	C->egroups = I->egroups;
+
+	size_t used_bytes = array_bytes("tally cache", lines, 1, 1,
+			sizeof(unsigned long));
+	size_t flux_bytes = array_bytes("tally cache", lines, I->egroups, 1,
+			sizeof(float));
+	C->keys = (long *) checked_malloc( array_bytes("tally cache", lines, 1,
+				1, sizeof(long)), "tally cache keys");
+	C->used = (unsigned long *) checked_malloc( used_bytes,
+			"tally cache ages");
+	C->flux = (float *) checked_malloc( flux_bytes, "tally cache lines");
+	memset(C->used, 0, used_bytes);
+	memset(C->flux, 0, flux_bytes);
+	for( int l = 0; l < lines; l++ )
+		C->keys[l] = -1;
+
+	tally_cache = C;
+}
+
+// Adds a line into the shared fine flux of its region, and empties it
+void tally_cache_write_back( Input * I, Source * S, Tally_Cache * C,
+		int line )
+{
+	int QSR_id = (int) (C->keys[line] / I->fine_axial_intervals);
+	int FAI_id = (int) (C->keys[line] % I->fine_axial_intervals);
+	float * FSR_flux = region_fine_flux(I, S, QSR_id) + FAI_id * I->egroups;
+	float * flux = &C->flux[(long) line * C->egroups];
+
+	#ifdef MULTITHREADED
+	Lock * lock = fsr_lock(I, S, QSR_id, FAI_id);
+	#endif
+
+	#if defined MULTITHREADED && defined INSTRUMENT
+	instrumented_set_lock(I, lock, C->keys[line]);
+	#elif defined MULTITHREADED
+	set_lock(lock);
+	#endif
+
+	for( int g = 0; g < C->egroups; g++ )
+		FSR_flux[g] += flux[g];
+
+	#ifdef MULTITHREADED
+	unset_lock(lock);
+	#endif
+
+	memset(flux, 0, C->egroups * sizeof(float));
+	C->keys[line] = -1;
+	C->writebacks++;
+}
+
+// Returns the group vector caching a fine source region's tallies, evicting
+// the least recently used line of its set on a miss. Hits and misses are
+// counted once per segment (on its first tile).
+float * tally_cache_line( Input * I, Source * S, Tally_Cache * C,
+		int QSR_id, int FAI_id, int g0 )
+{
+	long fsr = (long) QSR_id * I->fine_axial_intervals + FAI_id;
+	unsigned long long hash = (unsigned long long) fsr * 0x9E3779B97F4A7C15ULL;
+	int first = (int) ((hash >> 32) & (C->sets - 1)) * C->ways;
+	C->clock++;
+
+	int victim = first;
+	for( int l = first; l < first + C->ways; l++ )
+	{
+		if( C->keys[l] == fsr )
+		{
+			if( g0 == 0 )
+				C->hits++;
+			C->used[l] = C->clock;
+			return &C->flux[(long) l * C->egroups];
+		}
+		if( C->used[l] < C->used[victim] )
+			victim = l;
+	}
+
+	if( g0 == 0 )
+		C->misses++;
+	if( C->keys[victim] >= 0 )
+		tally_cache_write_back(I, S, C, victim);
+
+	C->keys[victim] = fsr;
+	C->used[victim] = C->clock;
+	return &C->flux[(long) victim * C->egroups];
+}
+
+// Writes back every line still held, credits the thread's counts to the
+// run (timed runs only) and frees the cache
+void tally_cache_end( Input * I, Source * S )
+{
+	Tally_Cache * C = tally_cache;
+	if( C == NULL )
+		return;
+
+	for( int l = 0; l < C->sets * C->ways; l++ )
+		if( C->keys[l] >= 0 )
+			tally_cache_write_back(I, S, C, l);
+
+	if( !I->warmup )
+	{
+		__atomic_fetch_add(&I->tally_hits, C->hits, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&I->tally_misses, C->misses, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&I->tally_writebacks, C->writebacks,
+				__ATOMIC_RELAXED);
+		__atomic_fetch_add(&I->tally_updates, C->updates, __ATOMIC_RELAXED);
+	}
+
+	free(C->keys);
+	free(C->used);
+	free(C->flux);
+	free(C);
+	tally_cache = NULL;
+}
+
+// Prints the hit rate, and the lock acquisitions the cache saved - without
+// it, every tile of every segment takes its region's lock
+void print_tally_cache( Input * I )
+{
+	long lookups = I->tally_hits + I->tally_misses;
+	long avoided = I->tally_updates - I->tally_writebacks;
+
+	printf("%-25s%d (%d-way, %.1lf KB/thread)\n", "Tally Cache Lines:",
+			I->tally_cache_lines, I->tally_cache_lines < TALLY_CACHE_WAYS ?
+			I->tally_cache_lines : TALLY_CACHE_WAYS,
+			(double) I->tally_cache_lines * I->egroups * sizeof(float) /
+			1024.0);
+	if( lookups > 0 )
+		printf("%-25s%.2lf%%\n", "Tally Cache Hit Rate:",
+				(double) I->tally_hits / lookups * 100.);
+	printf("%-25s%ld of %ld\n", "Lock Acquisitions:", I->tally_writebacks,
+			I->tally_updates);
+	if( I->tally_updates > 0 )
+		printf("%-25s%ld (%.2lf%%)\n", "Locks Avoided:", avoided,
+				(double) avoided / I->tally_updates * 100.);
+}
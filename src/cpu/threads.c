@@ -0,0 +1,244 @@
+#include "SimpleMOC-kernel_header.h"
+
+#ifdef PTHREADS
+
+// Persistent pool of worker threads. The caller of parallel_region runs as
+// thread 0, workers 1..nthreads-1 sleep until a new region is posted. The
+// pool only grows - workers beyond the current thread count sit out.
+typedef struct{
+	pthread_t * threads;
+	int nthreads;
+	int capacity;
+	void (*fn)(void *);
+	void * arg;
+	long generation;
+	int busy;
+	int started;
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_barrier_t barrier;
+} Thread_Pool;
+
+static Thread_Pool pool = { NULL, 1, 0 };
+static __thread int thread_num = 0;
+
+void * pool_worker( void * arg )
+{
+	thread_num = (int) (long) arg;
+
+	// Check in, so the master knows we won't miss the next region
+	pthread_mutex_lock(&pool.mutex);
+	long generation = pool.generation;
+	pool.started++;
+	pthread_cond_signal(&pool.done);
+	pthread_mutex_unlock(&pool.mutex);
+
+	while( 1 )
+	{
+		// Wait for the next parallel region
+		pthread_mutex_lock(&pool.mutex);
+		while( pool.generation == generation )
+			pthread_cond_wait(&pool.start, &pool.mutex);
+		generation = pool.generation;
+		void (*fn)(void *) = pool.fn;
+		void * fn_arg = pool.arg;
+		int active = thread_num < pool.nthreads;
+		pthread_mutex_unlock(&pool.mutex);
+
+		if( !active )
+			continue;
+
+		fn(fn_arg);
+
+		// Report back to the master
+		pthread_mutex_lock(&pool.mutex);
+		if( --pool.busy == 0 )
+			pthread_cond_signal(&pool.done);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	return NULL;
+}
+
+#endif
+
+// Sets the number of threads used by later parallel regions. The pthreads
+// backend spawns any extra workers it needs here.
+void set_num_threads( int nthreads )
+{
+	#ifdef OPENMP
+	omp_set_num_threads(nthreads);
+	#elif defined PTHREADS
+	if( pool.capacity == 0 )
+	{
+		pool.capacity = 1;
+		pool.generation = 0;
+		pool.busy = 0;
+		pool.started = 0;
+		pthread_mutex_init(&pool.mutex, NULL);
+		pthread_cond_init(&pool.start, NULL);
+		pthread_cond_init(&pool.done, NULL);
+	}
+	else if( nthreads == pool.nthreads )
+		return;
+	else
+		pthread_barrier_destroy(&pool.barrier);
+
+	pthread_barrier_init(&pool.barrier, NULL, nthreads);
+
+	// Wake-ups check the thread count under the pool mutex
+	pthread_mutex_lock(&pool.mutex);
+	pool.nthreads = nthreads;
+	pthread_mutex_unlock(&pool.mutex);
+
+	// Spawn any workers the pool doesn't have yet
+	if( nthreads > pool.capacity )
+	{
+		pool.threads = (pthread_t *) realloc( pool.threads,
+				nthreads * sizeof(pthread_t));
+		for( long t = pool.capacity; t < nthreads; t++ )
+		{
+			if( pthread_create(&pool.threads[t], NULL, pool_worker,
+						(void *) t) != 0 )
+			{
+				fprintf(stderr, "Unable to create thread %ld\n", t);
+				exit(1);
+			}
+		}
+		pool.capacity = nthreads;
+
+		pthread_mutex_lock(&pool.mutex);
+		while( pool.started < pool.capacity - 1 )
+			pthread_cond_wait(&pool.done, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+	#endif
+}
+
+// Runs fn(arg) on every thread and returns once all of them are done
+void parallel_region( void (*fn)(void *), void * arg )
+{
+	#ifdef OPENMP
+	#pragma omp parallel default(none) shared(fn, arg)
+	{
+		fn(arg);
+	}
+	#elif defined PTHREADS
+	pthread_mutex_lock(&pool.mutex);
+	pool.fn = fn;
+	pool.arg = arg;
+	pool.busy = pool.nthreads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.mutex);
+
+	fn(arg);
+
+	pthread_mutex_lock(&pool.mutex);
+	while( pool.busy > 0 )
+		pthread_cond_wait(&pool.done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+	#else
+	fn(arg);
+	#endif
+}
+
+int get_thread_num(void)
+{
+	#ifdef OPENMP
+	return omp_get_thread_num();
+	#elif defined PTHREADS
+	return thread_num;
+	#else
+	return 0;
+	#endif
+}
+
+int get_num_threads(void)
+{
+	#ifdef OPENMP
+	return omp_get_num_threads();
+	#elif defined PTHREADS
+	return pool.nthreads;
+	#else
+	return 1;
+	#endif
+}
+
+// Number of processors available to the program
+int get_num_procs(void)
+{
+	#ifdef OPENMP
+	return omp_get_num_procs();
+	#else
+	return (int) sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+}
+
+// Waits for all threads of the current parallel region
+void thread_barrier(void)
+{
+	#ifdef OPENMP
+	#pragma omp barrier
+	#elif defined PTHREADS
+	pthread_barrier_wait(&pool.barrier);
+	#endif
+}
+
+// Locks. The pthreads backend uses a test-and-test-and-set spinlock, as
+// critical sections are only a few hundred cycles long. Serial builds make
+// these no-ops.
+void init_lock( Lock * L )
+{
+	#ifdef OPENMP
+	omp_init_lock(L);
+	#elif defined PTHREADS
+	L->locked = 0;
+	#endif
+}
+
+void destroy_lock( Lock * L )
+{
+	#ifdef OPENMP
+	omp_destroy_lock(L);
+	#endif
+}
+
+void set_lock( Lock * L )
+{
+	#ifdef OPENMP
+	omp_set_lock(L);
+	#elif defined PTHREADS
+	while( __atomic_exchange_n(&L->locked, 1, __ATOMIC_ACQUIRE) )
+	{
+		while( __atomic_load_n(&L->locked, __ATOMIC_RELAXED) )
+		{
+			#if defined __x86_64__ || defined __i386__
+			__builtin_ia32_pause();
+			#endif
+		}
+	}
+	#endif
+}
+
+// Takes the lock if it is free, returning nonzero on success
+int test_lock( Lock * L )
+{
+	#ifdef OPENMP
+	return omp_test_lock(L);
+	#elif defined PTHREADS
+	return !__atomic_exchange_n(&L->locked, 1, __ATOMIC_ACQUIRE);
+	#else
+	return 1;
+	#endif
+}
+
+void unset_lock( Lock * L )
+{
+	#ifdef OPENMP
+	omp_unset_lock(L);
+	#elif defined PTHREADS
+	__atomic_store_n(&L->locked, 0, __ATOMIC_RELEASE);
+	#endif
+}